@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "animation_node_procedural_animation.h"
+
+#include "scene/animation/animation_player.h"
+
+Ref<ProceduralAnimation> AnimationNodeProceduralAnimation::get_procedural_animation() const {
+	return _procedural_animation;
+}
+void AnimationNodeProceduralAnimation::set_procedural_animation(const Ref<ProceduralAnimation> &value) {
+	_procedural_animation = value;
+
+	emit_changed();
+}
+
+void AnimationNodeProceduralAnimation::get_parameter_list(List<PropertyInfo> *r_list) const {
+	r_list->push_back(PropertyInfo(Variant::REAL, _time, PROPERTY_HINT_NONE, "", 0));
+}
+
+String AnimationNodeProceduralAnimation::get_caption() const {
+	return "ProceduralAnimation";
+}
+
+float AnimationNodeProceduralAnimation::process(float p_time, bool p_seek) {
+	AnimationPlayer *ap = state->player;
+	ERR_FAIL_COND_V(!ap, 0);
+
+	if (!_procedural_animation.is_valid()) {
+		make_invalid(RTR("No ProceduralAnimation set."));
+		return 0;
+	}
+
+	Ref<Animation> source = _procedural_animation->get_animation();
+
+	if (!source.is_valid()) {
+		make_invalid(RTR("The ProceduralAnimation doesn't have a source animation."));
+		return 0;
+	}
+
+	StringName source_name = ap->find_animation(source);
+
+	if (source_name == StringName()) {
+		make_invalid(RTR("The ProceduralAnimation's source animation has to be added to the AnimationPlayer."));
+		return 0;
+	}
+
+	float time = get_parameter(_time);
+
+	if (p_seek) {
+		time = p_time;
+	} else {
+		time = MAX(0, time + p_time);
+	}
+
+	float length = _procedural_animation->get_graph_length();
+
+	if (_procedural_animation->has_loop()) {
+		if (length > 0)
+			time = Math::fposmod(time, length);
+	} else if (time > length) {
+		time = length;
+	}
+
+	set_parameter(_time, time);
+
+	int frames[ProceduralAnimation::MAX_SAMPLED_POSES];
+	float weights[ProceduralAnimation::MAX_SAMPLED_POSES];
+
+	int pose_count = _procedural_animation->sample_graph_poses(time, frames, weights, &_segment_cursor);
+
+	if (pose_count == 0)
+		return length - time;
+
+	if (_procedural_animation->has_track_filter())
+		_apply_track_filter();
+
+	float key_step = 1.0 / static_cast<float>(_procedural_animation->get_animation_fps());
+
+	//Every pose is a seek into the source, its method and audio tracks should not fire from here.
+	//Keyframes with pose blending add their second source frame, so up to 4 poses get blended.
+	for (int i = 0; i < pose_count; ++i) {
+		blend_animation(source_name, frames[i] * key_step, 0, true, weights[i]);
+	}
+
+	return length - time;
+}
+
+//The baked tracks are filtered by process_animation_data(), here the same filter is applied
+//by zeroing the blend of the tracks it rejects. The source tracks are walked, as the filter needs the track type.
+void AnimationNodeProceduralAnimation::_apply_track_filter() {
+	Ref<Animation> source = _procedural_animation->get_animation();
+
+	if (!source.is_valid())
+		return;
+
+	for (int i = 0; i < source->get_track_count(); ++i) {
+		const NodePath &path = source->track_get_path(i);
+
+		if (_procedural_animation->is_track_path_allowed(path, source->track_get_type(i)))
+			continue;
+
+		const int *idx = state->track_map.getptr(path);
+
+		if (idx && *idx < blends.size()) {
+			blends.write[*idx] = 0;
+		}
+	}
+}
+
+AnimationNodeProceduralAnimation::AnimationNodeProceduralAnimation() {
+	_time = "time";
+	_segment_cursor = 0;
+}
+
+AnimationNodeProceduralAnimation::~AnimationNodeProceduralAnimation() {
+	_procedural_animation.unref();
+}
+
+void AnimationNodeProceduralAnimation::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_procedural_animation"), &AnimationNodeProceduralAnimation::get_procedural_animation);
+	ClassDB::bind_method(D_METHOD("set_procedural_animation", "value"), &AnimationNodeProceduralAnimation::set_procedural_animation);
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "procedural_animation", PROPERTY_HINT_RESOURCE_TYPE, "ProceduralAnimation"), "set_procedural_animation", "get_procedural_animation");
+}
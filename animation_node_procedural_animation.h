@@ -0,0 +1,61 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef ANIMATION_NODE_PROCEDURAL_ANIMATION_H
+#define ANIMATION_NODE_PROCEDURAL_ANIMATION_H
+
+#include "scene/animation/animation_tree.h"
+
+#include "procedural_animation.h"
+
+//Plays a ProceduralAnimation in an AnimationTree by blending the two source frames of the
+//current graph segment directly, so the ProceduralAnimation itself doesn't need baked tracks.
+//The source animation has to be added to the tree's AnimationPlayer.
+class AnimationNodeProceduralAnimation : public AnimationRootNode {
+	GDCLASS(AnimationNodeProceduralAnimation, AnimationRootNode);
+
+public:
+	Ref<ProceduralAnimation> get_procedural_animation() const;
+	void set_procedural_animation(const Ref<ProceduralAnimation> &value);
+
+	void get_parameter_list(List<PropertyInfo> *r_list) const;
+
+	virtual String get_caption() const;
+	virtual float process(float p_time, bool p_seek);
+
+	AnimationNodeProceduralAnimation();
+	~AnimationNodeProceduralAnimation();
+
+protected:
+	void _apply_track_filter();
+
+	static void _bind_methods();
+
+private:
+	Ref<ProceduralAnimation> _procedural_animation;
+	StringName _time;
+
+	//Segment of the last sample, only a lookup hint
+	int _segment_cursor;
+};
+
+#endif
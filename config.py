@@ -12,6 +12,13 @@ def get_doc_classes():
     return [
         "ProceduralAnimation",
         "ProceduralAnimationPlayer",
+        "ProceduralAnimationBaker",
+        "ProceduralAnimationBakeMainLoop",
+        "ProceduralAnimationCrowdEvaluator",
+        "ProceduralAnimationKeyPoseExtractor",
+        "ProceduralAnimationLibrary",
+        "ProceduralAnimationPoseIndex",
+        "AnimationNodeProceduralAnimation",
     ]
 
 def get_doc_path():
@@ -22,20 +22,291 @@ SOFTWARE.
 
 #include "procedural_animation.h"
 
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/config/engine.h"
+#include "core/config/project_settings.h"
+#include "core/templates/hashfuncs.h"
+#include "core/templates/set.h"
+#include "servers/display_server.h"
+#else
+#include "core/engine.h"
+#include "core/hashfuncs.h"
+#include "core/project_settings.h"
+#include "core/set.h"
+#endif
+
+#include "core/core_string_names.h"
+#include "core/io/resource_loader.h"
+#include "procedural_animation_baker.h"
+#include "procedural_animation_compact.h"
+#include "procedural_animation_pose_index.h"
+#include "core/os/os.h"
+#include "core/os/thread.h"
+#include "scene/main/scene_tree.h"
+
+List<ProceduralAnimation *> ProceduralAnimation::_instances;
+Mutex ProceduralAnimation::_instances_mutex;
+
+const char *ProceduralAnimation::HEADLESS_MODE_SETTING = "procedural_animations/headless/mode";
+const char *ProceduralAnimation::HEADLESS_TRACKS_SETTING = "procedural_animations/headless/tracks";
+
+int ProceduralAnimation::_headless_state = -1;
+PoolVector<String> ProceduralAnimation::_headless_tracks;
+
+#if VERSION_MAJOR > 3
+typedef Callable::CallError MethodCallError;
+#else
+typedef Variant::CallError MethodCallError;
+#endif
+
 Ref<Animation> ProceduralAnimation::get_animation() const {
 	return _animation;
 }
 void ProceduralAnimation::set_animation(const Ref<Animation> &value) {
-	_animation = value;
+	_set_source(value);
+
+	if (_animation.is_valid())
+		_source_animation_path = _animation->get_path();
+	else
+		_source_animation_path = "";
+
+	emit_changed();
+}
+
+//Deferred source loading
+bool ProceduralAnimation::get_deferred_source_loading() const {
+	return _deferred_source_loading;
+}
+void ProceduralAnimation::set_deferred_source_loading(const bool value) {
+	_deferred_source_loading = value;
+
+#if VERSION_MAJOR < 4
+	property_list_changed_notify();
+#else
+	notify_property_list_changed();
+#endif
+
+	emit_changed();
+}
+
+String ProceduralAnimation::get_source_animation_path() const {
+	if (_animation.is_valid())
+		return _animation->get_path();
+
+	return _source_animation_path;
+}
+//Only saved when the source is deferred. When it's set during load, the source is loaded synchronously
+//in the editor, and with load_source_async() once the engine gets back to the main loop otherwise.
+void ProceduralAnimation::set_source_animation_path(const String &value) {
+	if (_animation.is_valid() && _animation->get_path() == value)
+		return;
+
+	_set_source(Ref<Animation>());
+	_source_animation_path = value;
+
+	if (_source_animation_path == "")
+		return;
+
+	if (Engine::get_singleton()->is_editor_hint())
+		load_source();
+	else
+		call_deferred("load_source_async");
+}
+
+bool ProceduralAnimation::is_source_loaded() const {
+	return _animation.is_valid();
+}
+bool ProceduralAnimation::is_source_loading() const {
+	return _source_loading;
+}
+
+void ProceduralAnimation::load_source() {
+	if (_animation.is_valid() || _source_loading || _source_animation_path == "")
+		return;
+
+	Ref<Animation> source = ResourceLoader::load(_source_animation_path);
+
+	ERR_FAIL_COND_MSG(!source.is_valid(), "ProceduralAnimation: Could not load source animation " + _source_animation_path);
+
+	_finish_source_loading(source);
+}
+
+//Loads the source in the background, and finishes on the main thread.
+//source_ready is emitted when the source is available.
+void ProceduralAnimation::load_source_async() {
+	if (_animation.is_valid() || _source_loading || _source_animation_path == "")
+		return;
+
+	SceneTree *tree = SceneTree::get_singleton();
+
+	//No main loop to poll from, (the baker for example)
+	if (!tree) {
+		load_source();
+		return;
+	}
+
+#if VERSION_MAJOR > 3
+	Error err = ResourceLoader::load_threaded_request(_source_animation_path);
+
+	ERR_FAIL_COND_MSG(err != OK, "ProceduralAnimation: Could not start loading source animation " + _source_animation_path);
+
+	tree->connect("process_frame", callable_mp(this, &ProceduralAnimation::_poll_source_loading));
+#else
+	//A poll of the interactive loader can take as long as loading the whole file, so it's loaded
+	//on a thread instead, and the result is handed back with call_deferred().
+	_source_thread_path = _source_animation_path;
+	_source_thread = Thread::create(_source_thread_func, this);
+#endif
+
+	_source_loading = true;
+}
+
+//Edits of the source are followed by a rebake. Every change in a frame is coalesced into one rebake
+//at the end of that frame.
+void ProceduralAnimation::_set_source(const Ref<Animation> &source) {
+	if (_animation == source)
+		return;
+
+	_analysis_dirty = true;
+
+	if (_animation.is_valid()) {
+#if VERSION_MAJOR < 4
+		_animation->disconnect(CoreStringNames::get_singleton()->changed, this, "_on_source_changed");
+#else
+		_animation->disconnect(CoreStringNames::get_singleton()->changed, callable_mp(this, &ProceduralAnimation::_on_source_changed));
+#endif
+	}
+
+	_animation = source;
+
+	if (_animation.is_valid()) {
+#if VERSION_MAJOR < 4
+		_animation->connect(CoreStringNames::get_singleton()->changed, this, "_on_source_changed");
+#else
+		_animation->connect(CoreStringNames::get_singleton()->changed, callable_mp(this, &ProceduralAnimation::_on_source_changed));
+#endif
+	}
+}
+
+void ProceduralAnimation::_on_source_changed() {
+	if (_rebake_pending)
+		return;
+
+	_rebake_pending = true;
+
+	call_deferred("_process_pending_rebake");
+}
+
+void ProceduralAnimation::_process_pending_rebake() {
+	if (!_rebake_pending)
+		return;
+
+	_rebake_pending = false;
+	_analysis_dirty = true;
+
+	if (!_animation.is_valid())
+		return;
+
+	process_animation_data();
 
 	emit_changed();
 }
 
+bool ProceduralAnimation::_is_source_deferred() const {
+	if (!_deferred_source_loading)
+		return false;
+
+	//Built-in sources have to be saved into the resource
+	String path = get_source_animation_path();
+
+	return path == "" || path.find("::") == -1;
+}
+
+#if VERSION_MAJOR > 3
+void ProceduralAnimation::_poll_source_loading() {
+	ERR_FAIL_COND(!_source_loading);
+
+	ResourceLoader::ThreadLoadStatus status = ResourceLoader::load_threaded_get_status(_source_animation_path);
+
+	if (status == ResourceLoader::THREAD_LOAD_IN_PROGRESS)
+		return;
+
+	Ref<Animation> source;
+
+	if (status == ResourceLoader::THREAD_LOAD_LOADED)
+		source = ResourceLoader::load_threaded_get(_source_animation_path);
+
+	SceneTree::get_singleton()->disconnect("process_frame", callable_mp(this, &ProceduralAnimation::_poll_source_loading));
+
+	_source_loading = false;
+
+	ERR_FAIL_COND_MSG(!source.is_valid(), "ProceduralAnimation: Could not load source animation " + _source_animation_path);
+
+	_finish_source_loading(source);
+}
+#else
+//Only reads _source_thread_path, which doesn't change until the thread is finished.
+void ProceduralAnimation::_source_thread_func(void *p_userdata) {
+	ProceduralAnimation *self = static_cast<ProceduralAnimation *>(p_userdata);
+
+	Ref<Animation> source = ResourceLoader::load(self->_source_thread_path);
+
+	self->call_deferred("_source_thread_finished", source);
+}
+
+void ProceduralAnimation::_source_thread_finished(const Ref<Animation> &source) {
+	ERR_FAIL_COND(!_source_loading);
+
+	if (_source_thread) {
+		Thread::wait_to_finish(_source_thread);
+		memdelete(_source_thread);
+		_source_thread = NULL;
+	}
+
+	_source_loading = false;
+
+	//The path was changed while the old source was loading
+	if (_source_thread_path != _source_animation_path) {
+		load_source_async();
+		return;
+	}
+
+	ERR_FAIL_COND_MSG(!source.is_valid(), "ProceduralAnimation: Could not load source animation " + _source_thread_path);
+
+	_finish_source_loading(source);
+}
+#endif
+
+//Tracks that were saved baked are kept, the bake only runs if there is nothing baked yet.
+void ProceduralAnimation::_finish_source_loading(const Ref<Animation> &source) {
+	_set_source(source);
+
+	if (_bake_tracks && get_track_count() == 0 && _compact_data.size() == 0 && _keyframes.size() > 0)
+		process_animation_data();
+
+	emit_signal("source_ready");
+}
+
+void ProceduralAnimation::_validate_property(PropertyInfo &property) const {
+	if (property.name == "animation") {
+		if (_is_source_deferred())
+			property.usage = PROPERTY_USAGE_EDITOR;
+	} else if (property.name == "source_animation_path") {
+		if (_is_source_deferred())
+			property.usage = PROPERTY_USAGE_STORAGE;
+		else
+			property.usage = 0;
+	}
+}
+
 int ProceduralAnimation::get_animation_fps() const {
 	return _animation_fps;
 }
 void ProceduralAnimation::set_animation_fps(const int index) {
 	_animation_fps = index;
+	_analysis_dirty = true;
 
 	emit_changed();
 }
@@ -84,282 +355,2346 @@ void ProceduralAnimation::set_start_node_position(const Vector2 &value) {
 	emit_changed();
 }
 
-int ProceduralAnimation::get_start_frame_index() const {
-	return _start_frame_index;
-}
-void ProceduralAnimation::set_start_frame_index(const int value) {
-	_start_frame_index = value;
+int ProceduralAnimation::get_start_frame_index() const {
+	return _start_frame_index;
+}
+void ProceduralAnimation::set_start_frame_index(const int value) {
+	_start_frame_index = value;
+	_graph_changed();
+
+	process_animation_data();
+
+	emit_changed();
+}
+
+//Track filter
+PoolVector<String> ProceduralAnimation::get_track_filter_include() const {
+	return _track_filter_include;
+}
+void ProceduralAnimation::set_track_filter_include(const PoolVector<String> &value) {
+	_track_filter_include = value;
+
+	emit_changed();
+}
+
+PoolVector<String> ProceduralAnimation::get_track_filter_exclude() const {
+	return _track_filter_exclude;
+}
+void ProceduralAnimation::set_track_filter_exclude(const PoolVector<String> &value) {
+	_track_filter_exclude = value;
+
+	emit_changed();
+}
+
+PoolVector<String> ProceduralAnimation::get_bone_filter() const {
+	return _bone_filter;
+}
+void ProceduralAnimation::set_bone_filter(const PoolVector<String> &value) {
+	_bone_filter = value;
+
+	emit_changed();
+}
+
+//Patterns support the * and ? wildcards. An empty include list means everything is included,
+//and the bone filter only applies to transform tracks that point to a bone (Skeleton:bone).
+bool ProceduralAnimation::is_track_path_allowed(const NodePath &path, const Animation::TrackType type) const {
+	if (is_headless() && !is_headless_track(path))
+		return false;
+
+	String path_str = path;
+
+	if (_track_filter_include.size() > 0) {
+		bool found = false;
+
+		for (int i = 0; i < _track_filter_include.size(); ++i) {
+			if (path_str.match(_track_filter_include[i])) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			return false;
+		}
+	}
+
+	for (int i = 0; i < _track_filter_exclude.size(); ++i) {
+		if (path_str.match(_track_filter_exclude[i])) {
+			return false;
+		}
+	}
+
+	if (_bone_filter.size() > 0 && type == Animation::TYPE_TRANSFORM && path.get_subname_count() > 0) {
+		String bone = path.get_subname(0);
+
+		for (int i = 0; i < _bone_filter.size(); ++i) {
+			if (bone.match(_bone_filter[i])) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+//Headless mode
+void ProceduralAnimation::register_settings() {
+	GLOBAL_DEF(HEADLESS_MODE_SETTING, HEADLESS_MODE_DISABLED);
+	GLOBAL_DEF(HEADLESS_TRACKS_SETTING, PoolVector<String>());
+
+	ProjectSettings::get_singleton()->set_custom_property_info(HEADLESS_MODE_SETTING, PropertyInfo(Variant::INT, HEADLESS_MODE_SETTING, PROPERTY_HINT_ENUM, "Disabled,Server,Always"));
+
+	_update_headless_settings();
+}
+
+//In headless mode only the tracks that match a pattern of procedural_animations/headless/tracks
+//are baked and evaluated, on top of the resource's own filters. Root motion and method events
+//don't depend on tracks, they are always kept.
+//It's never active in the editor, or while batch baking, so resources are never saved with the restricted tracks.
+bool ProceduralAnimation::is_headless() {
+	if (_headless_state == -1)
+		_update_headless_settings();
+
+	return _headless_state == 1;
+}
+
+bool ProceduralAnimation::is_headless_track(const NodePath &path) {
+	if (_headless_state == -1)
+		_update_headless_settings();
+
+	String path_str = path;
+
+	for (int i = 0; i < _headless_tracks.size(); ++i) {
+		if (path_str.match(_headless_tracks[i])) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//Scripts can't call static methods, so this is is_headless() for them.
+bool ProceduralAnimation::is_headless_mode_active() const {
+	return is_headless();
+}
+
+//Removes the baked tracks that headless mode doesn't need. The method track is kept.
+void ProceduralAnimation::strip_headless_tracks() {
+	for (int i = get_track_count() - 1; i >= 0; --i) {
+		if (track_get_type(i) == Animation::TYPE_METHOD)
+			continue;
+
+		if (!is_headless_track(track_get_path(i)))
+			remove_track(i);
+	}
+
+	_resampled_dirty = true;
+
+	emit_changed();
+}
+
+void ProceduralAnimation::_update_headless_settings() {
+	_headless_tracks = GLOBAL_GET(HEADLESS_TRACKS_SETTING);
+
+	int mode = GLOBAL_GET(HEADLESS_MODE_SETTING);
+
+	bool active = mode == HEADLESS_MODE_ALWAYS;
+
+	if (mode == HEADLESS_MODE_SERVER) {
+#if VERSION_MAJOR > 3
+		active = DisplayServer::get_singleton() && DisplayServer::get_singleton()->get_name() == "headless";
+#else
+		active = OS::get_singleton()->has_feature("Server");
+#endif
+	}
+
+	if (Engine::get_singleton()->is_editor_hint() || ProceduralAnimationBakeMainLoop::requested_from_command_line())
+		active = false;
+
+	_headless_state = active ? 1 : 0;
+}
+
+//Keyframes
+PoolVector<int> ProceduralAnimation::get_keyframe_indices() const {
+	PoolVector<int> idxr;
+	idxr.resize(_keyframes.size());
+
+	int i = 0;
+	for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next()) {
+		idxr.set(i, E->key());
+		++i;
+	}
+
+	return idxr;
+}
+int ProceduralAnimation::add_keyframe() {
+	int key = -1;
+	for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next()) {
+		if (E->key() > key) {
+			key = E->key();
+		}
+	}
+	++key;
+
+	AnimationKeyFrame *entry = memnew(AnimationKeyFrame);
+
+	_keyframes[key] = entry;
+	_graph_changed();
+
+	process_animation_data();
+
+	return key;
+}
+void ProceduralAnimation::remove_keyframe(const int keyframe_index) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	AnimationKeyFrame *entry = _keyframes[keyframe_index];
+
+	_keyframes.erase(keyframe_index);
+	_graph_changed();
+
+	memdelete(entry);
+
+	process_animation_data();
+
+	emit_changed();
+}
+
+bool ProceduralAnimation::has_keyframe(const int keyframe_index) const {
+	return _keyframes.has(keyframe_index);
+}
+
+String ProceduralAnimation::get_keyframe_name(const int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), "");
+
+	return _keyframes[keyframe_index]->name;
+}
+void ProceduralAnimation::set_keyframe_name(const int keyframe_index, const String &value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	_keyframes[keyframe_index]->name = value;
+
+	emit_changed();
+}
+
+int ProceduralAnimation::get_keyframe_animation_keyframe_index(const int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), 0);
+
+	return _keyframes[keyframe_index]->animation_keyframe_index;
+}
+void ProceduralAnimation::set_keyframe_animation_keyframe_index(const int keyframe_index, const int value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	_keyframes[keyframe_index]->animation_keyframe_index = value;
+	_graph_changed();
+
+	process_animation_data();
+
+	emit_changed();
+}
+
+int ProceduralAnimation::get_keyframe_blend_animation_keyframe_index(const int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), -1);
+
+	return _keyframes[keyframe_index]->blend_animation_keyframe_index;
+}
+void ProceduralAnimation::set_keyframe_blend_animation_keyframe_index(const int keyframe_index, const int value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	_keyframes[keyframe_index]->blend_animation_keyframe_index = value;
+	_graph_changed();
+
+	process_animation_data();
+
+	emit_changed();
+}
+
+float ProceduralAnimation::get_keyframe_blend_weight(const int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), 0);
+
+	return _keyframes[keyframe_index]->blend_weight;
+}
+void ProceduralAnimation::set_keyframe_blend_weight(const int keyframe_index, const float value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	_keyframes[keyframe_index]->blend_weight = CLAMP(value, 0, 1);
+	_graph_changed();
+
+	process_animation_data();
+
+	emit_changed();
+}
+
+int ProceduralAnimation::get_keyframe_next_keyframe_index(const int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), 0);
+
+	return _keyframes[keyframe_index]->next_keyframe;
+}
+void ProceduralAnimation::set_keyframe_next_keyframe_index(const int keyframe_index, const int value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	_keyframes[keyframe_index]->next_keyframe = value;
+	_graph_changed();
+
+	process_animation_data();
+
+	emit_changed();
+}
+
+float ProceduralAnimation::get_keyframe_transition(const int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), 0);
+
+	return _keyframes[keyframe_index]->transition;
+}
+void ProceduralAnimation::set_keyframe_transition(const int keyframe_index, const float value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	_keyframes[keyframe_index]->transition = value;
+	_graph_changed();
+
+	process_animation_data();
+
+	emit_changed();
+}
+
+float ProceduralAnimation::get_keyframe_time(const int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), 0);
+
+	return _keyframes[keyframe_index]->time;
+}
+void ProceduralAnimation::set_keyframe_time(const int keyframe_index, const float value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	_keyframes[keyframe_index]->time = value;
+	_graph_changed();
+
+	process_animation_data();
+
+	emit_changed();
+}
+
+String ProceduralAnimation::get_method_name(int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), "");
+
+	return _keyframes[keyframe_index]->method_name;
+}
+void ProceduralAnimation::set_method_name(int keyframe_index, const String &value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	_keyframes[keyframe_index]->method_name = value;
+	_graph_changed();
+
+	emit_changed();
+}
+
+Array ProceduralAnimation::get_keyframe_method_args(const int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), Array());
+
+	return _keyframes[keyframe_index]->method_args;
+}
+void ProceduralAnimation::set_keyframe_method_args(const int keyframe_index, const Array &value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+	ERR_FAIL_COND(value.size() > MAX_METHOD_ARGS);
+
+	_keyframes[keyframe_index]->method_args = value;
+	_graph_changed();
+
+	emit_changed();
+}
+
+Vector2 ProceduralAnimation::get_keyframe_node_position(const int keyframe_index) const {
+	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), Vector2());
+
+	return _keyframes[keyframe_index]->position;
+}
+void ProceduralAnimation::set_keyframe_node_position(const int keyframe_index, const Vector2 &value) {
+	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+
+	_keyframes[keyframe_index]->position = value;
+
+	emit_changed();
+}
+
+Dictionary ProceduralAnimation::get_keyframe_data() const {
+	return get_keyframe_data_for(get_keyframe_indices());
+}
+
+//Same as get_keyframe_data(), but only for the given keyframes. Missing keyframes are skipped.
+Dictionary ProceduralAnimation::get_keyframe_data_for(const PoolVector<int> &keyframe_indices) const {
+	int size = 0;
+
+	for (int i = 0; i < keyframe_indices.size(); ++i) {
+		if (_keyframes.has(keyframe_indices[i]))
+			++size;
+	}
+
+	PoolVector<int> indices;
+	PoolVector<String> names;
+	PoolVector<int> animation_keyframe_indices;
+	PoolVector<int> blend_animation_keyframe_indices;
+	PoolVector<real_t> blend_weights;
+	PoolVector<int> next_keyframes;
+	PoolVector<real_t> transitions;
+	PoolVector<real_t> times;
+	PoolVector<String> method_names;
+	Array method_args;
+	PoolVector<Vector2> positions;
+
+	indices.resize(size);
+	names.resize(size);
+	animation_keyframe_indices.resize(size);
+	blend_animation_keyframe_indices.resize(size);
+	blend_weights.resize(size);
+	next_keyframes.resize(size);
+	transitions.resize(size);
+	times.resize(size);
+	method_names.resize(size);
+	method_args.resize(size);
+	positions.resize(size);
+
+	int i = 0;
+	for (int k = 0; k < keyframe_indices.size(); ++k) {
+		const Map<int, AnimationKeyFrame *>::Element *E = _keyframes.find(keyframe_indices[k]);
+
+		if (!E)
+			continue;
+
+		const AnimationKeyFrame *frame = E->get();
+
+		indices.set(i, E->key());
+		names.set(i, frame->name);
+		animation_keyframe_indices.set(i, frame->animation_keyframe_index);
+		blend_animation_keyframe_indices.set(i, frame->blend_animation_keyframe_index);
+		blend_weights.set(i, frame->blend_weight);
+		next_keyframes.set(i, frame->next_keyframe);
+		transitions.set(i, frame->transition);
+		times.set(i, frame->time);
+		method_names.set(i, frame->method_name);
+		method_args[i] = frame->method_args;
+		positions.set(i, frame->position);
+		++i;
+	}
+
+	Dictionary data;
+	data["start_frame_index"] = _start_frame_index;
+	data["indices"] = indices;
+	data["names"] = names;
+	data["animation_keyframe_indices"] = animation_keyframe_indices;
+	data["blend_animation_keyframe_indices"] = blend_animation_keyframe_indices;
+	data["blend_weights"] = blend_weights;
+	data["next_keyframes"] = next_keyframes;
+	data["transitions"] = transitions;
+	data["times"] = times;
+	data["method_names"] = method_names;
+	data["method_args"] = method_args;
+	data["positions"] = positions;
+
+	return data;
+}
+
+//Replaces every keyframe, then bakes once. Only "indices" is required, missing fields use their defaults.
+void ProceduralAnimation::set_keyframe_data(const Dictionary &data) {
+	ERR_FAIL_COND(!data.has("indices"));
+
+	if (!_apply_keyframe_data(data, true))
+		return;
+
+	_graph_changed();
+
+	process_animation_data();
+
+	emit_changed();
+}
+
+//Applies a partial change, then bakes once. The keyframes in "indices" are created if they don't exist yet,
+//and only the fields that are present are written. The keyframes in "removed" are deleted first.
+//"start_frame_index" is optional. The editor's undo/redo actions are stored in this form.
+void ProceduralAnimation::update_keyframe_data(const Dictionary &data) {
+	//Graph node positions are editor only data, moving existing nodes doesn't need a rebake
+	bool layout_only = true;
+
+	Array keys = data.keys();
+	for (int i = 0; i < keys.size(); ++i) {
+		String key = keys[i];
+
+		if (key != "indices" && key != "positions") {
+			layout_only = false;
+			break;
+		}
+	}
+
+	if (layout_only) {
+		PoolVector<int> indices = data.get("indices", PoolVector<int>());
+
+		for (int i = 0; i < indices.size(); ++i) {
+			if (!_keyframes.has(indices[i])) {
+				layout_only = false;
+				break;
+			}
+		}
+	}
+
+	if (!_apply_keyframe_data(data, false))
+		return;
+
+	if (!layout_only) {
+		_graph_changed();
+
+		process_animation_data();
+	}
+
+	emit_changed();
+}
+
+//Nothing is changed if a field's size doesn't match "indices".
+bool ProceduralAnimation::_apply_keyframe_data(const Dictionary &data, const bool replace) {
+	PoolVector<int> indices = data.get("indices", PoolVector<int>());
+	int size = indices.size();
+
+	PoolVector<int> removed = data.get("removed", PoolVector<int>());
+	PoolVector<String> names = data.get("names", PoolVector<String>());
+	PoolVector<int> animation_keyframe_indices = data.get("animation_keyframe_indices", PoolVector<int>());
+	PoolVector<int> blend_animation_keyframe_indices = data.get("blend_animation_keyframe_indices", PoolVector<int>());
+	PoolVector<real_t> blend_weights = data.get("blend_weights", PoolVector<real_t>());
+	PoolVector<int> next_keyframes = data.get("next_keyframes", PoolVector<int>());
+	PoolVector<real_t> transitions = data.get("transitions", PoolVector<real_t>());
+	PoolVector<real_t> times = data.get("times", PoolVector<real_t>());
+	PoolVector<String> method_names = data.get("method_names", PoolVector<String>());
+	Array method_args = data.get("method_args", Array());
+	PoolVector<Vector2> positions = data.get("positions", PoolVector<Vector2>());
+
+	ERR_FAIL_COND_V(names.size() != 0 && names.size() != size, false);
+	ERR_FAIL_COND_V(animation_keyframe_indices.size() != 0 && animation_keyframe_indices.size() != size, false);
+	ERR_FAIL_COND_V(blend_animation_keyframe_indices.size() != 0 && blend_animation_keyframe_indices.size() != size, false);
+	ERR_FAIL_COND_V(blend_weights.size() != 0 && blend_weights.size() != size, false);
+	ERR_FAIL_COND_V(next_keyframes.size() != 0 && next_keyframes.size() != size, false);
+	ERR_FAIL_COND_V(transitions.size() != 0 && transitions.size() != size, false);
+	ERR_FAIL_COND_V(times.size() != 0 && times.size() != size, false);
+	ERR_FAIL_COND_V(method_names.size() != 0 && method_names.size() != size, false);
+	ERR_FAIL_COND_V(method_args.size() != 0 && method_args.size() != size, false);
+
+	for (int i = 0; i < method_args.size(); ++i) {
+		Array args = method_args[i];
+
+		ERR_FAIL_COND_V_MSG(args.size() > MAX_METHOD_ARGS, false, "ProceduralAnimation: Keyframe " + itos(indices[i]) + " has more than " + itos(MAX_METHOD_ARGS) + " method args.");
+	}
+	ERR_FAIL_COND_V(positions.size() != 0 && positions.size() != size, false);
+
+	if (replace) {
+		for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next())
+			memdelete(E->get());
+
+		_keyframes.clear();
+	}
+
+	for (int i = 0; i < removed.size(); ++i) {
+		Map<int, AnimationKeyFrame *>::Element *E = _keyframes.find(removed[i]);
+
+		if (!E)
+			continue;
+
+		memdelete(E->get());
+		_keyframes.erase(E);
+	}
+
+	for (int i = 0; i < size; ++i) {
+		AnimationKeyFrame *frame;
+
+		Map<int, AnimationKeyFrame *>::Element *E = _keyframes.find(indices[i]);
+
+		if (E) {
+			frame = E->get();
+		} else {
+			frame = memnew(AnimationKeyFrame);
+			_keyframes[indices[i]] = frame;
+		}
+
+		if (names.size() != 0)
+			frame->name = names[i];
+		if (animation_keyframe_indices.size() != 0)
+			frame->animation_keyframe_index = animation_keyframe_indices[i];
+		if (blend_animation_keyframe_indices.size() != 0)
+			frame->blend_animation_keyframe_index = blend_animation_keyframe_indices[i];
+		if (blend_weights.size() != 0)
+			frame->blend_weight = CLAMP(blend_weights[i], 0, 1);
+		if (next_keyframes.size() != 0)
+			frame->next_keyframe = next_keyframes[i];
+		if (transitions.size() != 0)
+			frame->transition = transitions[i];
+		if (times.size() != 0)
+			frame->time = times[i];
+		if (method_names.size() != 0)
+			frame->method_name = method_names[i];
+		if (method_args.size() != 0)
+			frame->method_args = method_args[i];
+		if (positions.size() != 0)
+			frame->position = positions[i];
+	}
+
+	if (data.has("start_frame_index"))
+		_start_frame_index = data["start_frame_index"];
+
+	return true;
+}
+
+bool ProceduralAnimation::get_bake_tracks() const {
+	return _bake_tracks;
+}
+void ProceduralAnimation::set_bake_tracks(const bool value) {
+	_bake_tracks = value;
+
+	emit_changed();
+}
+
+//Root motion
+NodePath ProceduralAnimation::get_root_motion_track() const {
+	return _root_motion_track;
+}
+void ProceduralAnimation::set_root_motion_track(const NodePath &value) {
+	_root_motion_track = value;
+
+	emit_changed();
+}
+
+PoolVector<Vector3> ProceduralAnimation::get_root_motion_positions() const {
+	return _root_motion_positions;
+}
+void ProceduralAnimation::set_root_motion_positions(const PoolVector<Vector3> &value) {
+	_root_motion_positions = value;
+}
+
+PoolVector<real_t> ProceduralAnimation::get_root_motion_rotations() const {
+	return _root_motion_rotations;
+}
+void ProceduralAnimation::set_root_motion_rotations(const PoolVector<real_t> &value) {
+	_root_motion_rotations = value;
+}
+
+bool ProceduralAnimation::has_root_motion() const {
+	return _root_motion_positions.size() > 0 && _root_motion_positions.size() == get_segment_count() + 1 && _root_motion_rotations.size() == _root_motion_positions.size() * 4;
+}
+
+//Accumulated root translation since the start of the graph, eased the same way as the pose tracks.
+Vector3 ProceduralAnimation::get_root_motion_position(const float time) const {
+	if (!has_root_motion())
+		return Vector3();
+
+	int s = find_segment(time);
+	const Segment &segment = _segments[s];
+
+	float c = 0;
+
+	if (segment.duration > CMP_EPSILON)
+		c = CLAMP((time - segment.start_time) / segment.duration, 0, 1);
+
+	float w = _ease_tables[segment.ease_table].sample(c);
+
+	return _root_motion_positions[s].linear_interpolate(_root_motion_positions[s + 1], w);
+}
+
+Quat ProceduralAnimation::get_root_motion_rotation(const float time) const {
+	if (!has_root_motion())
+		return Quat();
+
+	int s = find_segment(time);
+	const Segment &segment = _segments[s];
+
+	float c = 0;
+
+	if (segment.duration > CMP_EPSILON)
+		c = CLAMP((time - segment.start_time) / segment.duration, 0, 1);
+
+	float w = _ease_tables[segment.ease_table].sample(c);
+
+	Quat a(_root_motion_rotations[s * 4], _root_motion_rotations[s * 4 + 1], _root_motion_rotations[s * 4 + 2], _root_motion_rotations[s * 4 + 3]);
+	Quat b(_root_motion_rotations[s * 4 + 4], _root_motion_rotations[s * 4 + 5], _root_motion_rotations[s * 4 + 6], _root_motion_rotations[s * 4 + 7]);
+
+	return a.slerp(b, w);
+}
+
+//The root motion between two playback positions. If the animation loops and to_time is smaller than
+//from_time, the playhead is treated as having wrapped once.
+//The translation is relative to the root's pose at from_time, so it can be applied to a turning character.
+Transform ProceduralAnimation::get_root_motion(const float from_time, const float to_time) const {
+	if (!has_root_motion())
+		return Transform();
+
+	Vector3 from_position = get_root_motion_position(from_time);
+	Vector3 to_position = get_root_motion_position(to_time);
+	Quat from_rotation = get_root_motion_rotation(from_time);
+	Quat to_rotation = get_root_motion_rotation(to_time);
+
+	if (to_time < from_time && has_loop()) {
+		int last = _root_motion_positions.size() - 1;
+
+		Quat end_rotation(_root_motion_rotations[last * 4], _root_motion_rotations[last * 4 + 1], _root_motion_rotations[last * 4 + 2], _root_motion_rotations[last * 4 + 3]);
+
+		//The next loop starts where this one ended, turned by the rotation of a whole loop
+		to_position = _root_motion_positions[last] + end_rotation.xform(to_position);
+		to_rotation = to_rotation * end_rotation;
+	}
+
+	return Transform(Basis(to_rotation * from_rotation.inverse()), from_rotation.inverse().xform(to_position - from_position));
+}
+
+//Samples the root track at the source frame of every segment, and accumulates the deltas between them.
+//When looping, the last segment goes back to the first source frame. Taking the delta between those two
+//frames would undo the motion of the whole loop, so if the chain plays the source forwards, the last segment
+//moves like the source's own loop does (from its source frame to the clip's end, then from the clip's start
+//to the first source frame). Otherwise it keeps the velocity of the segment before it.
+//Doesn't move at the end when not looping.
+void ProceduralAnimation::_bake_root_motion() {
+	_root_motion_positions.resize(0);
+	_root_motion_rotations.resize(0);
+
+	if (_root_motion_track.is_empty() || !_animation.is_valid())
+		return;
+
+	int root_track = -1;
+
+	for (int i = 0; i < _animation->get_track_count(); ++i) {
+		if (_animation->track_get_type(i) == Animation::TYPE_TRANSFORM && _animation->track_get_path(i) == _root_motion_track) {
+			root_track = i;
+			break;
+		}
+	}
+
+	ERR_FAIL_COND_MSG(root_track == -1, "ProceduralAnimation: root motion track " + String(_root_motion_track) + " is not a transform track of the source animation.");
+
+	int size = _segments.size();
+
+	if (size == 0)
+		return;
+
+	Vector<Vector3> locations;
+	Vector<Quat> rotations;
+	locations.resize(size);
+	rotations.resize(size);
+
+	Vector3 location;
+	Quat rotation;
+
+	for (int i = 0; i < size; ++i) {
+		int key_index = find_source_key(root_track, _segments[i].source_frame);
+
+		if (key_index != -1) {
+			Dictionary d = _animation->track_get_key_value(root_track, key_index);
+
+			location = d.get("location", Vector3());
+			rotation = d.get("rotation", Quat());
+
+			int blend_key_index = -1;
+
+			if (_segments[i].blend_source_frame != -1)
+				blend_key_index = find_source_key(root_track, _segments[i].blend_source_frame);
+
+			if (blend_key_index != -1) {
+				Dictionary bd = _animation->track_get_key_value(root_track, blend_key_index);
+
+				location = location.linear_interpolate(bd.get("location", Vector3()), _segments[i].blend_weight);
+				rotation = rotation.slerp(bd.get("rotation", Quat()), _segments[i].blend_weight);
+			}
+		}
+
+		locations.write[i] = location;
+		rotations.write[i] = rotation;
+	}
+
+	bool looping = has_loop();
+	int last = size - 1;
+
+	Vector3 wrap_location;
+	Quat wrap_rotation;
+
+	if (looping) {
+		if (_segments[last].source_frame >= _segments[0].source_frame) {
+			Vector3 start_location;
+			Quat start_rotation;
+			Vector3 end_location;
+			Quat end_rotation;
+
+			_animation->transform_track_interpolate(root_track, 0, &start_location, &start_rotation, NULL);
+			_animation->transform_track_interpolate(root_track, _animation->get_length(), &end_location, &end_rotation, NULL);
+
+			wrap_location = (end_location - locations[last]) + (locations[0] - start_location);
+			wrap_rotation = (rotations[0] * start_rotation.inverse()) * (end_rotation * rotations[last].inverse());
+		} else if (size > 1 && _segments[last - 1].duration > CMP_EPSILON) {
+			float r = _segments[last].duration / _segments[last - 1].duration;
+
+			wrap_location = (locations[last] - locations[last - 1]) * r;
+			wrap_rotation = Quat().slerp(rotations[last] * rotations[last - 1].inverse(), r);
+		}
+	}
+
+	_root_motion_positions.resize(size + 1);
+	_root_motion_rotations.resize((size + 1) * 4);
+
+	Vector3 position;
+	Quat accumulated;
+
+	for (int i = 0; i <= size; ++i) {
+		_root_motion_positions.set(i, position);
+		_root_motion_rotations.set(i * 4, accumulated.x);
+		_root_motion_rotations.set(i * 4 + 1, accumulated.y);
+		_root_motion_rotations.set(i * 4 + 2, accumulated.z);
+		_root_motion_rotations.set(i * 4 + 3, accumulated.w);
+
+		if (i == size)
+			break;
+
+		if (i == last) {
+			if (looping) {
+				position += wrap_location;
+				accumulated = wrap_rotation * accumulated;
+			}
+
+			continue;
+		}
+
+		position += locations[i + 1] - locations[i];
+		accumulated = (rotations[i + 1] * rotations[i].inverse()) * accumulated;
+	}
+
+	//A looping locomotion cycle has to move the character forward once per loop
+	if (looping) {
+		Vector3 source_start;
+		Vector3 source_end;
+
+		_animation->transform_track_interpolate(root_track, 0, &source_start, NULL, NULL);
+		_animation->transform_track_interpolate(root_track, _animation->get_length(), &source_end, NULL, NULL);
+
+		if (!(source_end - source_start).is_equal_approx(Vector3()) && _root_motion_positions[size].is_equal_approx(Vector3())) {
+			WARN_PRINT("ProceduralAnimation: " + get_path() + " loops, but its root motion doesn't move over a whole loop, even though the source animation does.");
+		}
+	}
+}
+
+void ProceduralAnimation::process_animation_data() {
+	if (!_animation.is_valid())
+		return;
+
+	bool looping = has_loop();
+
+	clear();
+
+	_compact_data.clear();
+	_resampled_dirty = true;
+
+	//Evaluated from the graph directly (AnimationNodeProceduralAnimation), only the length is needed.
+	if (!_bake_tracks) {
+		_compile_graph();
+		_bake_root_motion();
+
+		set_length(_graph_length);
+		set_loop(looping);
+		return;
+	}
+
+	//source track index -> baked track index, -1 if the track is filtered out
+	Vector<int> track_map;
+	track_map.resize(_animation->get_track_count());
+
+	for (int si = 0; si < _animation->get_track_count(); ++si) {
+		if (!is_track_path_allowed(_animation->track_get_path(si), _animation->track_get_type(si))) {
+			track_map.write[si] = -1;
+			continue;
+		}
+
+		Animation::TrackType type = _animation->track_get_type(si);
+
+		int i = add_track(type);
+		track_map.write[si] = i;
+
+		track_set_interpolation_type(i, _animation->track_get_interpolation_type(si));
+		track_set_interpolation_loop_wrap(i, _animation->track_get_interpolation_loop_wrap(si));
+		track_set_path(i, _animation->track_get_path(si));
+		track_set_enabled(i, _animation->track_is_enabled(si));
+
+		switch (type) {
+			case Animation::TYPE_TRANSFORM: {
+				//nothing to do
+			} break;
+			case Animation::TYPE_VALUE: {
+				value_track_set_update_mode(i, _animation->value_track_get_update_mode(si));
+			} break;
+			case Animation::TYPE_METHOD: {
+				//nothing to do
+			} break;
+			case Animation::TYPE_BEZIER: {
+				//nothing to do
+			} break;
+			case Animation::TYPE_AUDIO: {
+				//nothing to do
+			} break;
+			case Animation::TYPE_ANIMATION: {
+				//nothing to do
+			} break;
+		}
+	}
+
+	//The root translation is moved out of the poses into the root motion data.
+	int root_motion_source_track = -1;
+
+	if (!_root_motion_track.is_empty()) {
+		for (int si = 0; si < _animation->get_track_count(); ++si) {
+			if (_animation->track_get_type(si) == Animation::TYPE_TRANSFORM && _animation->track_get_path(si) == _root_motion_track) {
+				root_motion_source_track = si;
+				break;
+			}
+		}
+	}
+
+	int custom_call_method_track = -1;
+
+	float target_keyframe_time = 0;
+	float key_step = 1.0 / static_cast<float>(_animation_fps);
+
+	int next_animation_key = _start_frame_index;
+	Vector<int> _used_keys;
+	while (next_animation_key != -1) {
+		ERR_BREAK(!_keyframes.has(next_animation_key));
+		ERR_BREAK_MSG(_used_keys.find(next_animation_key, 0) != -1, "ProceduralAnimation: " + get_name() + " " + get_path() + " contains a cycle in it's graph. Stopping generation.");
+		_used_keys.push_back(next_animation_key);
+		AnimationKeyFrame *frame = _keyframes[next_animation_key];
+		next_animation_key = frame->next_keyframe;
+
+		int animation_keyframe_index = frame->animation_keyframe_index;
+		int blend_animation_keyframe_index = frame->blend_weight > CMP_EPSILON ? frame->blend_animation_keyframe_index : -1;
+
+		float time = static_cast<float>(animation_keyframe_index) * key_step;
+
+		bool found_keyframe = false;
+		for (int si = 0; si < _animation->get_track_count(); ++si) {
+			int i = track_map[si];
+
+			if (i == -1)
+				continue;
+
+			int key_index = find_source_key(si, animation_keyframe_index);
+
+			if (key_index == -1)
+				continue;
+
+			Variant key_value = _animation->track_get_key_value(si, key_index);
+
+			if (key_value.get_type() == Variant::NIL)
+				continue;
+
+			if (blend_animation_keyframe_index != -1) {
+				int blend_key_index = find_source_key(si, blend_animation_keyframe_index);
+
+				if (blend_key_index != -1)
+					key_value = blend_key_values(key_value, _animation->track_get_key_value(si, blend_key_index), frame->blend_weight);
+			}
+
+			if (si == root_motion_source_track) {
+				Dictionary d = key_value;
+				d = d.duplicate();
+				d["location"] = Vector3();
+				key_value = d;
+			}
+
+			track_insert_key(i, target_keyframe_time, key_value, frame->transition);
+
+			found_keyframe = true;
+		}
+
+		if (frame->method_name != "") {
+			if (custom_call_method_track == -1) {
+				custom_call_method_track = add_track(Animation::TYPE_METHOD);
+
+				track_set_path(custom_call_method_track, NodePath("."));
+				track_set_enabled(custom_call_method_track, true);
+			}
+
+			Dictionary d;
+			d["method"] = frame->method_name;
+			d["args"] = frame->method_args;
+
+			track_insert_key(custom_call_method_track, target_keyframe_time, d);
+		}
+
+		if (!found_keyframe)
+			ERR_PRINT("Could not find any keyframe! Index: " + String::num(animation_keyframe_index) + " at time: " + String::num(time));
+
+		target_keyframe_time += frame->time;
+	}
+
+	set_length(target_keyframe_time);
+	set_loop(looping);
+
+	if (_bake_compact) {
+		_compact_data = ProceduralAnimationCompact::build(this);
+
+		if (_strip_compacted_tracks) {
+			for (int i = get_track_count() - 1; i >= 0; --i) {
+				if (track_get_type(i) == Animation::TYPE_TRANSFORM)
+					remove_track(i);
+			}
+		}
+	}
+
+	_compile_graph();
+	_bake_root_motion();
+}
+
+//The key that is exactly at the source frame, or the closest one before it.
+int ProceduralAnimation::find_source_key(const int source_track, const int animation_keyframe_index) const {
+	ERR_FAIL_COND_V(!_animation.is_valid(), -1);
+
+	float key_step = 1.0 / static_cast<float>(_animation_fps);
+	float time = static_cast<float>(animation_keyframe_index) * key_step;
+
+	int key_index = _animation->track_find_key(source_track, time, true);
+
+	if (key_index == -1)
+		key_index = _animation->track_find_key(source_track, time, false);
+
+	return key_index;
+}
+
+//Blends two key values of the same source track. Transform keys are interpolated per component,
+//everything else with Variant::interpolate(), which snaps at 0.5 for types it can't interpolate.
+Variant ProceduralAnimation::blend_key_values(const Variant &a, const Variant &b, const float weight) {
+	if (weight <= 0)
+		return a;
+
+	if (weight >= 1)
+		return b;
+
+	if (a.get_type() == Variant::DICTIONARY && b.get_type() == Variant::DICTIONARY) {
+		Dictionary da = a;
+		Dictionary db = b;
+
+		Vector3 la = da.get("location", Vector3());
+		Quat ra = da.get("rotation", Quat());
+		Vector3 sa = da.get("scale", Vector3(1, 1, 1));
+
+		Dictionary d;
+		d["location"] = la.linear_interpolate(db.get("location", Vector3()), weight);
+		d["rotation"] = ra.slerp(db.get("rotation", Quat()), weight);
+		d["scale"] = sa.linear_interpolate(db.get("scale", Vector3(1, 1, 1)), weight);
+
+		return d;
+	}
+
+	if (a.get_type() != b.get_type())
+		return weight < 0.5 ? a : b;
+
+	Variant r;
+	Variant::interpolate(a, b, weight, r);
+
+	return r;
+}
+
+PoolVector<int> ProceduralAnimation::get_keyframe_chain() const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	PoolVector<int> chain;
+	chain.resize(_segments.size());
+
+	for (int i = 0; i < _segments.size(); ++i) {
+		chain.set(i, _segments[i].keyframe);
+	}
+
+	return chain;
+}
+
+float ProceduralAnimation::get_graph_length() const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	return _graph_length;
+}
+
+//Returns the two source frames that are interpolated at time, and the already eased weight between them.
+//Follows the same rules as the baked tracks: after the last keyframe it wraps to the first one
+//when looping, otherwise it holds the last pose.
+//If r_cursor is set, it's used as the starting point of the segment lookup, and receives the segment that was sampled.
+bool ProceduralAnimation::sample_graph(const float time, int *r_from_frame, int *r_to_frame, float *r_weight, int *r_cursor) const {
+	int s = r_cursor ? find_segment_cursor(time, *r_cursor) : find_segment(time);
+
+	if (s == -1)
+		return false;
+
+	if (r_cursor)
+		*r_cursor = s;
+
+	const Segment &segment = _segments[s];
+
+	*r_from_frame = segment.source_frame;
+
+	if (s + 1 < _segments.size())
+		*r_to_frame = _segments[s + 1].source_frame;
+	else if (has_loop())
+		*r_to_frame = _segments[0].source_frame;
+	else
+		*r_to_frame = segment.source_frame;
+
+	float c = 0;
+
+	if (segment.duration > CMP_EPSILON)
+		c = CLAMP((time - segment.start_time) / segment.duration, 0, 1);
+
+	*r_weight = _ease_tables[segment.ease_table].sample(c);
+
+	return true;
+}
+
+//Same as sample_graph(), but with pose blending resolved: returns up to MAX_SAMPLED_POSES source frames
+//and their weights (which add up to 1), duplicate frames are merged.
+int ProceduralAnimation::sample_graph_poses(const float time, int *r_frames, float *r_weights, int *r_cursor) const {
+	int s = r_cursor ? find_segment_cursor(time, *r_cursor) : find_segment(time);
+
+	if (s == -1)
+		return 0;
+
+	if (r_cursor)
+		*r_cursor = s;
+
+	const Segment &segment = _segments[s];
+
+	int next = s;
+
+	if (s + 1 < _segments.size())
+		next = s + 1;
+	else if (has_loop())
+		next = 0;
+
+	float c = 0;
+
+	if (segment.duration > CMP_EPSILON)
+		c = CLAMP((time - segment.start_time) / segment.duration, 0, 1);
+
+	float w = next == s ? 0 : _ease_tables[segment.ease_table].sample(c);
+
+	const Segment *segments[2] = { &segment, &_segments[next] };
+	float segment_weights[2] = { 1.0f - w, w };
+
+	int count = 0;
+
+	for (int i = 0; i < 2; ++i) {
+		const Segment *sg = segments[i];
+
+		int frames[2] = { sg->source_frame, sg->blend_source_frame };
+		float weights[2] = { segment_weights[i] * (1.0f - sg->blend_weight), segment_weights[i] * sg->blend_weight };
+
+		for (int j = 0; j < 2; ++j) {
+			if (frames[j] == -1 || weights[j] < CMP_EPSILON)
+				continue;
+
+			int k = 0;
+			while (k < count && r_frames[k] != frames[j])
+				++k;
+
+			if (k == count) {
+				r_frames[count] = frames[j];
+				r_weights[count] = 0;
+				++count;
+			}
+
+			r_weights[k] += weights[j];
+		}
+	}
+
+	return count;
+}
+
+bool ProceduralAnimation::has_track_filter() const {
+	return is_headless() || _track_filter_include.size() > 0 || _track_filter_exclude.size() > 0 || _bone_filter.size() > 0;
+}
+
+const ProceduralAnimation::EaseTable &ProceduralAnimation::get_keyframe_ease_table(const int keyframe_index) const {
+	static EaseTable linear;
+
+	const Map<int, AnimationKeyFrame *>::Element *E = _keyframes.find(keyframe_index);
+
+	ERR_FAIL_COND_V(!E, linear);
+
+	if (_graph_dirty)
+		_compile_graph();
+
+	return _ease_tables[E->get()->ease_table];
+}
+
+const ProceduralAnimation::EaseTable &ProceduralAnimation::get_ease_table(const int index) const {
+	static EaseTable linear;
+
+	ERR_FAIL_INDEX_V(index, _ease_tables.size(), linear);
+
+	return _ease_tables[index];
+}
+
+//Compact output
+bool ProceduralAnimation::get_bake_compact() const {
+	return _bake_compact;
+}
+void ProceduralAnimation::set_bake_compact(const bool value) {
+	_bake_compact = value;
+
+	emit_changed();
+}
+
+//The transform tracks are only kept in compact_data, AnimationPlayer won't see them.
+bool ProceduralAnimation::get_strip_compacted_tracks() const {
+	return _strip_compacted_tracks;
+}
+void ProceduralAnimation::set_strip_compacted_tracks(const bool value) {
+	_strip_compacted_tracks = value;
+
+	emit_changed();
+}
+
+PoolVector<uint8_t> ProceduralAnimation::get_compact_data() const {
+#if VERSION_MAJOR > 3
+	return _compact_data;
+#else
+	PoolVector<uint8_t> data;
+	data.resize(_compact_data.size());
+
+	if (_compact_data.size() > 0) {
+		PoolVector<uint8_t>::Write w = data.write();
+		memcpy(w.ptr(), _compact_data.ptr(), _compact_data.size());
+	}
+
+	return data;
+#endif
+}
+void ProceduralAnimation::set_compact_data(const PoolVector<uint8_t> &value) {
+	_compact_data.clear();
+	_resampled_dirty = true;
+
+	if (value.size() == 0)
+		return;
+
+#if VERSION_MAJOR > 3
+	const uint8_t *r = value.ptr();
+#else
+	PoolVector<uint8_t>::Read rd = value.read();
+	const uint8_t *r = rd.ptr();
+#endif
+
+	ERR_FAIL_COND_MSG(!ProceduralAnimationCompact::validate(r, value.size()), "ProceduralAnimation: " + get_path() + " has invalid compact data.");
+
+	_compact_data.resize(value.size());
+	memcpy(_compact_data.ptrw(), r, value.size());
+}
+
+bool ProceduralAnimation::has_compact_data() const {
+	return _compact_data.size() > 0;
+}
+
+//NULL if there is no compact data, otherwise it's already validated.
+const uint8_t *ProceduralAnimation::get_compact_data_ptr() const {
+	if (_compact_data.size() == 0)
+		return NULL;
+
+	return _compact_data.ptr();
+}
+
+int ProceduralAnimation::get_compact_track_count() const {
+	if (_compact_data.size() == 0)
+		return 0;
+
+	return ProceduralAnimationCompact::get_header(_compact_data.ptr())->track_count;
+}
+NodePath ProceduralAnimation::get_compact_track_path(const int track) const {
+	ERR_FAIL_COND_V(_compact_data.size() == 0, NodePath());
+
+	return ProceduralAnimationCompact::get_track_path(_compact_data.ptr(), track);
+}
+int ProceduralAnimation::find_compact_track(const NodePath &path) const {
+	if (_compact_data.size() == 0)
+		return -1;
+
+	return ProceduralAnimationCompact::find_track(_compact_data.ptr(), path);
+}
+
+bool ProceduralAnimation::sample_compact(const int track, const float time, Vector3 *r_loc, Quat *r_rot, Vector3 *r_scale) const {
+	ERR_FAIL_COND_V(_compact_data.size() == 0, false);
+
+	return ProceduralAnimationCompact::sample(_compact_data.ptr(), track, time, r_loc, r_rot, r_scale);
+}
+
+Transform ProceduralAnimation::sample_compact_transform(const int track, const float time) const {
+	Vector3 loc;
+	Quat rot;
+	Vector3 scale(1, 1, 1);
+
+	sample_compact(track, time, &loc, &rot, &scale);
+
+	Transform t;
+	t.basis.set_quat_scale(rot, scale);
+	t.origin = loc;
+
+	return t;
+}
+
+//Resampled output
+int ProceduralAnimation::get_resample_fps() const {
+	return _resample_fps;
+}
+void ProceduralAnimation::set_resample_fps(const int value) {
+	ERR_FAIL_COND(value < 0);
+
+	_resample_fps = value;
+	_resampled_dirty = true;
+
+	emit_changed();
+}
+
+bool ProceduralAnimation::get_resample_quantized() const {
+	return _resample_quantized;
+}
+void ProceduralAnimation::set_resample_quantized(const bool value) {
+	_resample_quantized = value;
+	_resampled_dirty = true;
+
+	emit_changed();
+}
+
+void ProceduralAnimation::resample() {
+	_resample();
+}
+
+int ProceduralAnimation::get_resampled_track_count() const {
+	if (_resampled_dirty)
+		_resample();
+
+	return _resampled_track_paths.size();
+}
+NodePath ProceduralAnimation::get_resampled_track_path(const int track) const {
+	if (_resampled_dirty)
+		_resample();
+
+	ERR_FAIL_INDEX_V(track, _resampled_track_paths.size(), NodePath());
+
+	return _resampled_track_paths[track];
+}
+int ProceduralAnimation::find_resampled_track(const NodePath &path) const {
+	if (_resampled_dirty)
+		_resample();
+
+	return _resampled_track_paths.find(path);
+}
+
+int ProceduralAnimation::get_resampled_frame_count() const {
+	if (_resampled_dirty)
+		_resample();
+
+	return _resampled_frame_count;
+}
+
+//Writes the RESAMPLED_CHANNEL_COUNT channels of one frame into r_channels, dequantized if needed.
+void ProceduralAnimation::get_resampled_frame(const int track, const int frame, float *r_channels) const {
+	if (_resampled_dirty)
+		_resample();
+
+	ERR_FAIL_INDEX(track, _resampled_track_paths.size());
+	ERR_FAIL_INDEX(frame, _resampled_frame_count);
+
+	int index = (track * _resampled_frame_count + frame) * RESAMPLED_CHANNEL_COUNT;
+
+	if (!_resample_quantized) {
+		const float *d = _resampled_data.ptr() + index;
+
+		for (int c = 0; c < RESAMPLED_CHANNEL_COUNT; ++c) {
+			r_channels[c] = d[c];
+		}
+
+		return;
+	}
+
+	const uint16_t *q = _resampled_quantized_data.ptr() + index;
+	const float *range = _resampled_ranges.ptr() + track * 12;
+	const float inv = 1.0 / 65535.0;
+
+	for (int c = 0; c < 3; ++c) {
+		r_channels[c] = range[c] + q[c] * inv * range[3 + c];
+	}
+
+	for (int c = 3; c < 7; ++c) {
+		r_channels[c] = q[c] * inv * 2.0 - 1.0;
+	}
+
+	for (int c = 7; c < 10; ++c) {
+		r_channels[c] = range[6 + c - 7] + q[c] * inv * range[9 + c - 7];
+	}
+}
+
+//Finds the two frames around time directly from the frame rate, no key search needed.
+//The last frame is at length, so the last interval can be shorter than a frame.
+//Rotations are nlerped, neighbouring frames are kept in the same hemisphere by _resample().
+void ProceduralAnimation::sample_resampled(const int track, const float time, Vector3 *r_loc, Quat *r_rot, Vector3 *r_scale) const {
+	if (_resampled_dirty)
+		_resample();
+
+	ERR_FAIL_INDEX(track, _resampled_track_paths.size());
+
+	float length = get_length();
+	float t;
+
+	if (has_loop() && length > 0)
+		t = Math::fposmod(time, length);
+	else
+		t = CLAMP(time, 0, length);
+
+	float step = 1.0 / static_cast<float>(_resample_fps);
+
+	int i = MIN(static_cast<int>(t * _resample_fps), _resampled_frame_count - 1);
+	int n = MIN(i + 1, _resampled_frame_count - 1);
+
+	float ti = MIN(i * step, length);
+	float tn = MIN(n * step, length);
+	float w = tn - ti > CMP_EPSILON ? CLAMP((t - ti) / (tn - ti), 0, 1) : 0;
+
+	float a[RESAMPLED_CHANNEL_COUNT];
+	float b[RESAMPLED_CHANNEL_COUNT];
+
+	get_resampled_frame(track, i, a);
+	get_resampled_frame(track, n, b);
+
+	float r[RESAMPLED_CHANNEL_COUNT];
+
+	for (int c = 0; c < RESAMPLED_CHANNEL_COUNT; ++c) {
+		r[c] = a[c] + (b[c] - a[c]) * w;
+	}
+
+	if (r_loc)
+		*r_loc = Vector3(r[0], r[1], r[2]);
+
+	if (r_rot)
+		*r_rot = Quat(r[3], r[4], r[5], r[6]).normalized();
+
+	if (r_scale)
+		*r_scale = Vector3(r[7], r[8], r[9]);
+}
+
+Transform ProceduralAnimation::sample_resampled_transform(const int track, const float time) const {
+	Vector3 loc;
+	Quat rot;
+	Vector3 scale(1, 1, 1);
+
+	sample_resampled(track, time, &loc, &rot, &scale);
+
+	Transform t;
+	t.basis.set_quat_scale(rot, scale);
+	t.origin = loc;
+
+	return t;
+}
+
+void ProceduralAnimation::_resample() const {
+	_resampled_dirty = false;
+
+	_resampled_track_paths.clear();
+	_resampled_data.clear();
+	_resampled_quantized_data.clear();
+	_resampled_ranges.clear();
+	_resampled_frame_count = 0;
+
+	if (_resample_fps <= 0)
+		return;
+
+	Vector<int> tracks;
+
+	//The transform tracks only exist in the compact data when they were stripped
+	bool from_compact = _strip_compacted_tracks && _compact_data.size() > 0;
+
+	if (from_compact) {
+		for (int i = 0; i < get_compact_track_count(); ++i) {
+			if (is_headless() && !is_headless_track(get_compact_track_path(i)))
+				continue;
+
+			tracks.push_back(i);
+			_resampled_track_paths.push_back(get_compact_track_path(i));
+		}
+	} else {
+		for (int i = 0; i < get_track_count(); ++i) {
+			if (track_get_type(i) != Animation::TYPE_TRANSFORM)
+				continue;
+
+			if (is_headless() && !is_headless_track(track_get_path(i)))
+				continue;
+
+			tracks.push_back(i);
+			_resampled_track_paths.push_back(track_get_path(i));
+		}
+	}
+
+	if (tracks.size() == 0)
+		return;
+
+	float length = get_length();
+	float step = 1.0 / static_cast<float>(_resample_fps);
+	int track_count = tracks.size();
+	int frame_count = static_cast<int>(Math::ceil(length * _resample_fps)) + 1;
+
+	_resampled_frame_count = frame_count;
+
+	Vector<float> data;
+	data.resize(track_count * frame_count * RESAMPLED_CHANNEL_COUNT);
+	float *dw = data.ptrw();
+
+	for (int t = 0; t < track_count; ++t) {
+		Quat previous;
+
+		for (int f = 0; f < frame_count; ++f) {
+			Vector3 loc;
+			Quat rot;
+			Vector3 scale(1, 1, 1);
+
+			if (from_compact)
+				sample_compact(tracks[t], MIN(f * step, length), &loc, &rot, &scale);
+			else
+				transform_track_interpolate(tracks[t], MIN(f * step, length), &loc, &rot, &scale);
+
+			//q and -q are the same rotation, but only one of them nlerps the short way to the previous frame
+			if (f > 0 && previous.dot(rot) < 0)
+				rot = -rot;
+
+			previous = rot;
+
+			float *d = dw + (t * frame_count + f) * RESAMPLED_CHANNEL_COUNT;
+
+			d[0] = loc.x;
+			d[1] = loc.y;
+			d[2] = loc.z;
+			d[3] = rot.x;
+			d[4] = rot.y;
+			d[5] = rot.z;
+			d[6] = rot.w;
+			d[7] = scale.x;
+			d[8] = scale.y;
+			d[9] = scale.z;
+		}
+	}
+
+	if (!_resample_quantized) {
+		_resampled_data = data;
+		return;
+	}
+
+	_resampled_ranges.resize(track_count * 12);
+	_resampled_quantized_data.resize(data.size());
+
+	float *range = _resampled_ranges.ptrw();
+	uint16_t *qw = _resampled_quantized_data.ptrw();
+
+	for (int t = 0; t < track_count; ++t) {
+		const float *td = dw + t * frame_count * RESAMPLED_CHANNEL_COUNT;
+		float *tr = range + t * 12;
+
+		//location channels map to range 0-2 (min) and 3-5 (extent), scale channels to 6-8 and 9-11
+		const int channels[6] = { 0, 1, 2, 7, 8, 9 };
+
+		for (int i = 0; i < 6; ++i) {
+			int c = channels[i];
+
+			float mn = td[c];
+			float mx = td[c];
+
+			for (int f = 1; f < frame_count; ++f) {
+				float v = td[f * RESAMPLED_CHANNEL_COUNT + c];
+
+				mn = MIN(mn, v);
+				mx = MAX(mx, v);
+			}
+
+			int base = i < 3 ? i : 6 + i - 3;
+
+			tr[base] = mn;
+			tr[base + 3] = mx - mn;
+		}
+
+		for (int f = 0; f < frame_count; ++f) {
+			const float *d = td + f * RESAMPLED_CHANNEL_COUNT;
+			uint16_t *q = qw + (t * frame_count + f) * RESAMPLED_CHANNEL_COUNT;
+
+			for (int i = 0; i < 6; ++i) {
+				int c = channels[i];
+				int base = i < 3 ? i : 6 + i - 3;
+
+				float extent = tr[base + 3];
+				float n = extent > CMP_EPSILON ? (d[c] - tr[base]) / extent : 0;
+
+				q[c] = static_cast<uint16_t>(CLAMP(n, 0, 1) * 65535.0 + 0.5);
+			}
+
+			for (int c = 3; c < 7; ++c) {
+				q[c] = static_cast<uint16_t>(CLAMP(d[c] * 0.5 + 0.5, 0, 1) * 65535.0 + 0.5);
+			}
+		}
+	}
+}
+
+//Segments
+void ProceduralAnimation::compile_graph() {
+	_compile_graph();
+}
+
+int ProceduralAnimation::get_segment_count() const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	return _segments.size();
+}
+
+const ProceduralAnimation::Segment &ProceduralAnimation::get_segment(const int index) const {
+	static Segment empty;
+
+	if (_graph_dirty)
+		_compile_graph();
+
+	ERR_FAIL_INDEX_V(index, _segments.size(), empty);
+
+	return _segments[index];
+}
+
+//The last segment that starts at, or before time, -1 if the chain is empty.
+int ProceduralAnimation::find_segment(const float time) const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	if (_segments.size() == 0)
+		return -1;
+
+	const Segment *segments = _segments.ptr();
+
+	int lo = 0;
+	int hi = _segments.size() - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi + 1) >> 1;
+
+		if (segments[mid].start_time <= time)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+//Same as find_segment(), but checks the segment of the previous lookup and the one after it first,
+//so a playhead that moves forward is found in constant time.
+int ProceduralAnimation::find_segment_cursor(const float time, const int cursor) const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	int size = _segments.size();
+
+	for (int i = cursor; i >= 0 && i < size && i <= cursor + 1; ++i) {
+		const Segment &segment = _segments[i];
+
+		if (segment.start_time <= time && (time < segment.start_time + segment.duration || i == size - 1))
+			return i;
+	}
+
+	return find_segment(time);
+}
+
+Dictionary ProceduralAnimation::get_segment_data() const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	int size = _segments.size();
+
+	PoolVector<real_t> start_times;
+	PoolVector<real_t> durations;
+	PoolVector<int> keyframes;
+	PoolVector<int> source_frames;
+	PoolVector<int> blend_source_frames;
+	PoolVector<real_t> blend_weights;
+	PoolVector<real_t> transitions;
+	PoolVector<String> methods;
+
+	start_times.resize(size);
+	durations.resize(size);
+	keyframes.resize(size);
+	source_frames.resize(size);
+	blend_source_frames.resize(size);
+	blend_weights.resize(size);
+	transitions.resize(size);
+	methods.resize(size);
+
+	for (int i = 0; i < size; ++i) {
+		const Segment &segment = _segments[i];
+
+		start_times.set(i, segment.start_time);
+		durations.set(i, segment.duration);
+		keyframes.set(i, segment.keyframe);
+		source_frames.set(i, segment.source_frame);
+		blend_source_frames.set(i, segment.blend_source_frame);
+		blend_weights.set(i, segment.blend_weight);
+		transitions.set(i, _ease_tables[segment.ease_table].transition);
+		methods.set(i, segment.method);
+	}
+
+	Dictionary data;
+	data["start_times"] = start_times;
+	data["durations"] = durations;
+	data["keyframes"] = keyframes;
+	data["source_frames"] = source_frames;
+	data["blend_source_frames"] = blend_source_frames;
+	data["blend_weights"] = blend_weights;
+	data["transitions"] = transitions;
+	data["methods"] = methods;
+
+	return data;
+}
+
+//Method events
+int ProceduralAnimation::get_method_event_count() const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	return _method_events.size();
+}
+
+float ProceduralAnimation::get_method_event_time(const int index) const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	ERR_FAIL_INDEX_V(index, _method_events.size(), 0);
+
+	return _method_events[index].time;
+}
+
+StringName ProceduralAnimation::get_method_event_method(const int index) const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	ERR_FAIL_INDEX_V(index, _method_events.size(), StringName());
+
+	return _method_events[index].method;
+}
+
+Array ProceduralAnimation::get_method_event_args(const int index) const {
+	if (_graph_dirty)
+		_compile_graph();
+
+	ERR_FAIL_INDEX_V(index, _method_events.size(), Array());
+
+	const MethodEvent &event = _method_events[index];
+
+	Array args;
+	args.resize(event.args.size());
+
+	for (int i = 0; i < event.args.size(); ++i) {
+		args[i] = event.args[i];
+	}
+
+	return args;
+}
+
+//Calls the methods of the events in (from_time, to_time] on target. When looping and to_time is
+//smaller than from_time, the playhead wrapped, and the events up to the end, then from the start are called.
+//Pass a negative from_time to include the events at 0.
+//Like every other Object call, only use this from the thread that owns target.
+int ProceduralAnimation::call_method_events(Object *target, const float from_time, const float to_time) const {
+	ERR_FAIL_COND_V(!target, 0);
+
+	if (_graph_dirty)
+		_compile_graph();
+
+	if (_method_events.size() == 0)
+		return 0;
+
+	if (!target->get_script_instance())
+		_resolve_method_events(target);
+
+	if (to_time < from_time && has_loop()) {
+		int count = _call_method_events(target, from_time, _graph_length);
+
+		return count + _call_method_events(target, -1, to_time);
+	}
+
+	return _call_method_events(target, from_time, to_time);
+}
+
+//The MethodBinds of a class don't change, so for targets without scripts they are only looked up
+//when the class changes, and the events are dispatched without going through Object::call().
+void ProceduralAnimation::_resolve_method_events(const Object *target) const {
+	StringName class_name = target->get_class_name();
+
+	if (_method_bind_class == class_name && _method_binds.size() == _method_events.size())
+		return;
+
+	_method_bind_class = class_name;
+	_method_binds.resize(_method_events.size());
+
+	for (int i = 0; i < _method_events.size(); ++i) {
+		_method_binds.write[i] = ClassDB::get_method(class_name, _method_events[i].method);
+	}
+}
+
+int ProceduralAnimation::_call_method_events(Object *target, const float from_time, const float to_time) const {
+	//Local copies, the called methods are allowed to change this animation.
+	Vector<MethodEvent> events = _method_events;
+	Vector<MethodBind *> binds = _method_binds;
+
+	bool use_binds = !target->get_script_instance() && _method_bind_class == target->get_class_name() && binds.size() == events.size();
+
+	int size = events.size();
+
+	//first event after from_time
+	int lo = 0;
+	int hi = size;
+
+	while (lo < hi) {
+		int mid = (lo + hi) >> 1;
+
+		if (events[mid].time <= from_time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	const Variant *args[MAX_METHOD_ARGS];
+	int count = 0;
+
+	for (int i = lo; i < size; ++i) {
+		const MethodEvent &event = events[i];
+
+		if (event.time > to_time)
+			break;
+
+		int argc = event.args.size();
+
+		for (int j = 0; j < argc; ++j) {
+			args[j] = &event.args[j];
+		}
+
+		MethodCallError ce;
+
+		if (use_binds && binds[i])
+			binds[i]->call(target, args, argc, ce);
+		else
+			target->call(event.method, args, argc, ce);
+
+		++count;
+	}
+
+	return count;
+}
+
+void ProceduralAnimation::_graph_changed() {
+	_graph_dirty = true;
+	_analysis_dirty = true;
+}
+
+//Pose index
+Ref<ProceduralAnimationPoseIndex> ProceduralAnimation::get_source_pose_index() const {
+	if (!_animation.is_valid())
+		return Ref<ProceduralAnimationPoseIndex>();
+
+	return ProceduralAnimationPoseIndex::get_cached(_animation, _animation_fps);
+}
+
+//Source frames that look like the given one, the closest first. Neighbouring frames are skipped.
+PoolVector<int> ProceduralAnimation::find_similar_source_frames(const int animation_keyframe_index, const int count) const {
+	Ref<ProceduralAnimationPoseIndex> index = get_source_pose_index();
+
+	ERR_FAIL_COND_V(!index.is_valid(), PoolVector<int>());
+
+	return index->find_similar_frames(animation_keyframe_index, count, 1);
+}
+
+//Graph analysis
+bool ProceduralAnimation::get_prune_unreachable_on_save() const {
+	return _prune_unreachable_on_save;
+}
+void ProceduralAnimation::set_prune_unreachable_on_save(const bool value) {
+	_prune_unreachable_on_save = value;
+
+	emit_changed();
+}
+
+//reachable: the keyframes of the chain, in play order
+//unreachable: every other keyframe
+//cycle_keyframe: the keyframe the chain loops back to, -1 if it ends
+//missing_next_keyframes: keyframes on the chain whose next keyframe doesn't exist
+//missing_source_frames: keyframes on the chain whose source frame is outside of the source animation
+//Cached until the graph, the fps, or the source changes.
+Dictionary ProceduralAnimation::get_graph_analysis() const {
+	if (_analysis_dirty)
+		_analyze_graph();
+
+	return _analysis.duplicate();
+}
+
+bool ProceduralAnimation::is_keyframe_reachable(const int keyframe_index) const {
+	if (_analysis_dirty)
+		_analyze_graph();
+
+	return _reachable_keyframes.has(keyframe_index);
+}
+
+//Removes every keyframe that is not on the chain. The chain stays the same, so no rebake is needed.
+int ProceduralAnimation::prune_unreachable_keyframes() {
+	if (_analysis_dirty)
+		_analyze_graph();
+
+	Vector<int> unreachable;
+
+	for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next()) {
+		if (!_reachable_keyframes.has(E->key()))
+			unreachable.push_back(E->key());
+	}
+
+	for (int i = 0; i < unreachable.size(); ++i) {
+		memdelete(_keyframes[unreachable[i]]);
+		_keyframes.erase(unreachable[i]);
+	}
+
+	if (unreachable.size() > 0) {
+		_graph_changed();
+
+		emit_changed();
+	}
+
+	return unreachable.size();
+}
+
+//One walk along the chain, and one pass over the keyframes.
+void ProceduralAnimation::_analyze_graph() const {
+	_reachable_keyframes.clear();
+
+	PoolVector<int> reachable;
+	PoolVector<int> unreachable;
+	PoolVector<int> missing_next_keyframes;
+	PoolVector<int> missing_source_frames;
+	int cycle_keyframe = -1;
+
+	float source_length = -1;
+
+	if (_animation.is_valid())
+		source_length = _animation->get_length();
+
+	float key_step = 1.0 / static_cast<float>(_animation_fps);
+
+	int key = _start_frame_index;
+	int previous = -1;
+
+	while (key != -1) {
+		if (_reachable_keyframes.has(key)) {
+			cycle_keyframe = key;
+			break;
+		}
+
+		const Map<int, AnimationKeyFrame *>::Element *E = _keyframes.find(key);
+
+		if (!E) {
+			if (previous != -1)
+				missing_next_keyframes.push_back(previous);
+
+			break;
+		}
+
+		const AnimationKeyFrame *frame = E->get();
 
-	process_animation_data();
+		_reachable_keyframes.insert(key);
+		reachable.push_back(key);
 
-	emit_changed();
-}
+		if (frame->animation_keyframe_index < 0 || (source_length >= 0 && frame->animation_keyframe_index * key_step > source_length + CMP_EPSILON))
+			missing_source_frames.push_back(key);
+		else if (frame->blend_animation_keyframe_index >= 0 && source_length >= 0 && frame->blend_animation_keyframe_index * key_step > source_length + CMP_EPSILON)
+			missing_source_frames.push_back(key);
 
-//Keyframes
-PoolVector<int> ProceduralAnimation::get_keyframe_indices() const {
-	PoolVector<int> idxr;
-	idxr.resize(_keyframes.size());
+		previous = key;
+		key = frame->next_keyframe;
+	}
 
-	int i = 0;
 	for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next()) {
-		idxr.set(i, E->key());
-		++i;
+		if (!_reachable_keyframes.has(E->key()))
+			unreachable.push_back(E->key());
 	}
 
-	return idxr;
+	_analysis = Dictionary();
+	_analysis["reachable"] = reachable;
+	_analysis["unreachable"] = unreachable;
+	_analysis["cycle_keyframe"] = cycle_keyframe;
+	_analysis["missing_next_keyframes"] = missing_next_keyframes;
+	_analysis["missing_source_frames"] = missing_source_frames;
+
+	_analysis_dirty = false;
 }
-int ProceduralAnimation::add_keyframe() {
-	int key = -1;
+
+//Flattens the keyframe chain into the segment table, which is what every runtime consumer samples.
+//Happens lazily on first use after a change, and at the end of every bake.
+void ProceduralAnimation::_compile_graph() const {
+	_ease_tables.clear();
+
 	for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next()) {
-		if (E->key() > key) {
-			key = E->key();
+		AnimationKeyFrame *frame = E->get();
+
+		int index = -1;
+
+		for (int i = 0; i < _ease_tables.size(); ++i) {
+			if (_ease_tables[i].transition == frame->transition) {
+				index = i;
+				break;
+			}
 		}
+
+		if (index == -1) {
+			EaseTable table;
+			table.build(frame->transition);
+
+			index = _ease_tables.size();
+			_ease_tables.push_back(table);
+		}
+
+		frame->ease_table = index;
 	}
-	++key;
 
-	AnimationKeyFrame *entry = memnew(AnimationKeyFrame);
+	_segments.clear();
+	_method_events.clear();
+	_method_bind_class = StringName();
+	_method_binds.clear();
 
-	_keyframes[key] = entry;
+	Set<int> visited;
+	float time = 0;
+	int key = _start_frame_index;
 
-	process_animation_data();
+	while (key != -1 && !visited.has(key)) {
+		const Map<int, AnimationKeyFrame *>::Element *E = _keyframes.find(key);
 
-	return key;
-}
-void ProceduralAnimation::remove_keyframe(const int keyframe_index) {
-	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+		if (!E)
+			break;
 
-	AnimationKeyFrame *entry = _keyframes[keyframe_index];
+		visited.insert(key);
 
-	_keyframes.erase(keyframe_index);
+		const AnimationKeyFrame *frame = E->get();
 
-	memdelete(entry);
+		Segment segment;
+		segment.start_time = time;
+		segment.duration = frame->time;
+		segment.keyframe = key;
+		segment.source_frame = frame->animation_keyframe_index;
+		segment.ease_table = frame->ease_table;
 
-	process_animation_data();
+		if (frame->blend_animation_keyframe_index >= 0 && frame->blend_weight > CMP_EPSILON) {
+			segment.blend_source_frame = frame->blend_animation_keyframe_index;
+			segment.blend_weight = frame->blend_weight;
+		}
 
-	emit_changed();
-}
+		if (frame->method_name != "") {
+			segment.method = frame->method_name;
 
-bool ProceduralAnimation::has_keyframe(const int keyframe_index) const {
-	return _keyframes.has(keyframe_index);
-}
+			MethodEvent event;
+			event.time = time;
+			event.segment = _segments.size();
+			event.method = segment.method;
 
-String ProceduralAnimation::get_keyframe_name(const int keyframe_index) const {
-	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), "");
+			//The setters reject longer arg lists, this only guards against keyframes edited in some other way
+			if (frame->method_args.size() > MAX_METHOD_ARGS) {
+				ERR_PRINT("ProceduralAnimation: The method args of keyframe " + itos(key) + " are truncated to " + itos(MAX_METHOD_ARGS) + ".");
+			}
 
-	return _keyframes[keyframe_index]->name;
-}
-void ProceduralAnimation::set_keyframe_name(const int keyframe_index, const String &value) {
-	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+			int argc = MIN(frame->method_args.size(), static_cast<int>(MAX_METHOD_ARGS));
+			event.args.resize(argc);
 
-	_keyframes[keyframe_index]->name = value;
+			for (int i = 0; i < argc; ++i) {
+				event.args.write[i] = frame->method_args[i];
+			}
 
-	emit_changed();
+			_method_events.push_back(event);
+		}
+
+		_segments.push_back(segment);
+
+		time += frame->time;
+		key = frame->next_keyframe;
+	}
+
+	_graph_length = time;
+	_graph_dirty = false;
 }
 
-int ProceduralAnimation::get_keyframe_animation_keyframe_index(const int keyframe_index) const {
-	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), 0);
+void ProceduralAnimation::EaseTable::build(const float p_transition) {
+	transition = p_transition;
 
-	return _keyframes[keyframe_index]->animation_keyframe_index;
+	for (int i = 0; i <= SIZE; ++i) {
+		values[i] = Math::ease(static_cast<float>(i) / static_cast<float>(SIZE), p_transition);
+	}
 }
-void ProceduralAnimation::set_keyframe_animation_keyframe_index(const int keyframe_index, const int value) {
-	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
 
-	_keyframes[keyframe_index]->animation_keyframe_index = value;
+//Covers everything process_animation_data() reads, so equal hashes mean equal bake results
+//as long as the source animation did not change.
+uint32_t ProceduralAnimation::get_graph_hash() const {
+	uint32_t h = hash_djb2_one_32(_animation_fps);
+	h = hash_djb2_one_32(_start_frame_index, h);
+	h = hash_djb2_one_32(has_loop() ? 1 : 0, h);
+	h = hash_djb2_one_32(_bake_tracks ? 1 : 0, h);
+	//The format version is hashed too, so a format change rebakes the compact data
+	h = hash_djb2_one_32(_bake_compact ? static_cast<uint32_t>(ProceduralAnimationCompact::VERSION) : 0, h);
+	h = hash_djb2_one_32(_strip_compacted_tracks ? 1 : 0, h);
+
+	String source_path = get_source_animation_path();
+
+	if (source_path != "") {
+		h = hash_djb2_one_32(source_path.hash(), h);
+	}
 
-	process_animation_data();
+	for (int i = 0; i < _track_filter_include.size(); ++i) {
+		h = hash_djb2_one_32(_track_filter_include[i].hash(), h);
+	}
 
-	emit_changed();
-}
+	h = hash_djb2_one_32(0, h);
 
-int ProceduralAnimation::get_keyframe_next_keyframe_index(const int keyframe_index) const {
-	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), 0);
+	for (int i = 0; i < _track_filter_exclude.size(); ++i) {
+		h = hash_djb2_one_32(_track_filter_exclude[i].hash(), h);
+	}
 
-	return _keyframes[keyframe_index]->next_keyframe;
+	h = hash_djb2_one_32(0, h);
+
+	for (int i = 0; i < _bone_filter.size(); ++i) {
+		h = hash_djb2_one_32(_bone_filter[i].hash(), h);
+	}
+
+	h = hash_djb2_one_32(String(_root_motion_track).hash(), h);
+
+	for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next()) {
+		const AnimationKeyFrame *frame = E->get();
+
+		h = hash_djb2_one_32(E->key(), h);
+		h = hash_djb2_one_32(frame->animation_keyframe_index, h);
+		h = hash_djb2_one_32(frame->blend_animation_keyframe_index, h);
+		h = hash_djb2_one_float(frame->blend_weight, h);
+		h = hash_djb2_one_32(frame->next_keyframe, h);
+		h = hash_djb2_one_float(frame->transition, h);
+		h = hash_djb2_one_float(frame->time, h);
+		h = hash_djb2_one_32(frame->method_name.hash(), h);
+		h = hash_djb2_one_32(frame->method_args.hash(), h);
+	}
+
+	return h;
 }
-void ProceduralAnimation::set_keyframe_next_keyframe_index(const int keyframe_index, const int value) {
-	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
 
-	_keyframes[keyframe_index]->next_keyframe = value;
+//Drops everything that is only used by the editor's graph view. With strip_keyframe_graph the keyframes
+//and the source animation are dropped too, and only the baked tracks remain. That only works if the
+//tracks are baked, graph based evaluation (segments, method events, root motion, crowds) needs the graph.
+void ProceduralAnimation::strip_editor_data(const bool strip_keyframe_graph) {
+	_editor_data_stripped = true;
+	_start_node_position = Vector2();
+	_keyframe_names.clear();
 
-	process_animation_data();
+	for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next()) {
+		E->get()->name = "";
+		E->get()->position = Vector2();
+	}
 
-	emit_changed();
+	if (strip_keyframe_graph && _bake_tracks) {
+		for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next())
+			memdelete(E->get());
+
+		_keyframes.clear();
+		_start_frame_index = -1;
+		_root_motion_positions.resize(0);
+		_root_motion_rotations.resize(0);
+		_set_source(Ref<Animation>());
+		_source_animation_path = "";
+		_graph_changed();
+	}
 }
 
-float ProceduralAnimation::get_keyframe_transition(const int keyframe_index) const {
-	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), 0);
+bool ProceduralAnimation::is_editor_data_stripped() const {
+	return _editor_data_stripped;
+}
 
-	return _keyframes[keyframe_index]->transition;
+//Memory
+static _FORCE_INLINE_ uint64_t _string_memory_usage(const String &s) {
+	return static_cast<uint64_t>(s.size()) * sizeof(*s.ptr());
 }
-void ProceduralAnimation::set_keyframe_transition(const int keyframe_index, const float value) {
-	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
 
-	_keyframes[keyframe_index]->transition = value;
+//Estimates, the sizes of the internal containers are approximated with the sizes of their elements.
+//The source animation is reported separately, and not included in "total", as it's usually shared.
+Dictionary ProceduralAnimation::get_memory_usage() const {
+	uint64_t keyframes = 0;
+	uint64_t strings = 0;
 
-	process_animation_data();
+	for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next()) {
+		const AnimationKeyFrame *frame = E->get();
 
-	emit_changed();
-}
+		keyframes += sizeof(Map<int, AnimationKeyFrame *>::Element) + sizeof(AnimationKeyFrame);
+		keyframes += frame->method_args.size() * sizeof(Variant);
 
-float ProceduralAnimation::get_keyframe_time(const int keyframe_index) const {
-	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), 0);
+		strings += _string_memory_usage(frame->name);
+		strings += _string_memory_usage(frame->method_name);
+	}
 
-	return _keyframes[keyframe_index]->time;
-}
-void ProceduralAnimation::set_keyframe_time(const int keyframe_index, const float value) {
-	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+	for (Map<int, String>::Element *E = _keyframe_names.front(); E; E = E->next()) {
+		strings += sizeof(Map<int, String>::Element) + _string_memory_usage(E->get());
+	}
 
-	_keyframes[keyframe_index]->time = value;
+	for (int i = 0; i < _track_filter_include.size(); ++i) {
+		strings += sizeof(String) + _string_memory_usage(_track_filter_include[i]);
+	}
 
-	process_animation_data();
+	for (int i = 0; i < _track_filter_exclude.size(); ++i) {
+		strings += sizeof(String) + _string_memory_usage(_track_filter_exclude[i]);
+	}
 
-	emit_changed();
-}
+	for (int i = 0; i < _bone_filter.size(); ++i) {
+		strings += sizeof(String) + _string_memory_usage(_bone_filter[i]);
+	}
 
-String ProceduralAnimation::get_method_name(int keyframe_index) const {
-	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), "");
+	uint64_t compiled = 0;
 
-	return _keyframes[keyframe_index]->method_name;
-}
-void ProceduralAnimation::set_method_name(int keyframe_index, const String &value) {
-	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
+	compiled += _segments.size() * sizeof(Segment);
+	compiled += _ease_tables.size() * sizeof(EaseTable);
+	compiled += _method_binds.size() * sizeof(MethodBind *);
 
-	_keyframes[keyframe_index]->method_name = value;
+	for (int i = 0; i < _method_events.size(); ++i) {
+		compiled += sizeof(MethodEvent) + _method_events[i].args.size() * sizeof(Variant);
+	}
 
-	emit_changed();
-}
+	uint64_t root_motion = _root_motion_positions.size() * sizeof(Vector3) + _root_motion_rotations.size() * sizeof(real_t);
 
-Vector2 ProceduralAnimation::get_keyframe_node_position(const int keyframe_index) const {
-	ERR_FAIL_COND_V(!_keyframes.has(keyframe_index), Vector2());
+	uint64_t compact = _compact_data.size();
+	uint64_t resampled = _resampled_data.size() * sizeof(float) + _resampled_quantized_data.size() * sizeof(uint16_t) + _resampled_ranges.size() * sizeof(float);
 
-	return _keyframes[keyframe_index]->position;
+	for (int i = 0; i < _resampled_track_paths.size(); ++i) {
+		resampled += sizeof(NodePath) + _string_memory_usage(String(_resampled_track_paths[i]));
+	}
+	uint64_t baked_tracks = get_animation_memory_usage(this);
+	uint64_t source_animation = 0;
+
+	if (_animation.is_valid())
+		source_animation = get_animation_memory_usage(_animation.ptr());
+
+	Dictionary usage;
+	usage["keyframes"] = keyframes;
+	usage["strings"] = strings;
+	usage["compiled"] = compiled;
+	usage["root_motion"] = root_motion;
+	usage["baked_tracks"] = baked_tracks;
+	usage["compact"] = compact;
+	usage["resampled"] = resampled;
+	usage["source_animation"] = source_animation;
+	usage["total"] = sizeof(ProceduralAnimation) + keyframes + strings + compiled + root_motion + baked_tracks + compact + resampled;
+
+	return usage;
 }
-void ProceduralAnimation::set_keyframe_node_position(const int keyframe_index, const Vector2 &value) {
-	ERR_FAIL_COND(!_keyframes.has(keyframe_index));
 
-	_keyframes[keyframe_index]->position = value;
+//Scripts can't call static methods, so this is get_total_memory_usage() for them.
+uint64_t ProceduralAnimation::get_module_memory_usage() const {
+	return get_total_memory_usage();
+}
 
-	emit_changed();
+//Sum of the "total" of every live ProceduralAnimation.
+uint64_t ProceduralAnimation::get_total_memory_usage() {
+	MutexLock lock(_instances_mutex);
+
+	uint64_t total = 0;
+
+	for (List<ProceduralAnimation *>::Element *E = _instances.front(); E; E = E->next()) {
+		total += static_cast<uint64_t>(E->get()->get_memory_usage()["total"]);
+	}
+
+	return total;
 }
 
-void ProceduralAnimation::process_animation_data() {
-	if (!_animation.is_valid())
-		return;
+uint64_t ProceduralAnimation::get_instance_count() {
+	MutexLock lock(_instances_mutex);
 
-	bool looping = has_loop();
+	return _instances.size();
+}
 
-	clear();
+uint64_t ProceduralAnimation::get_animation_memory_usage(const Animation *animation) {
+	ERR_FAIL_COND_V(!animation, 0);
 
-	for (int i = 0; i < _animation->get_track_count(); ++i) {
-		Animation::TrackType type = _animation->track_get_type(i);
+	uint64_t size = 0;
 
-		add_track(type);
+	for (int i = 0; i < animation->get_track_count(); ++i) {
+		uint64_t key_count = animation->track_get_key_count(i);
 
-		track_set_interpolation_type(i, _animation->track_get_interpolation_type(i));
-		track_set_interpolation_loop_wrap(i, _animation->track_get_interpolation_loop_wrap(i));
-		track_set_path(i, _animation->track_get_path(i));
-		track_set_enabled(i, _animation->track_is_enabled(i));
+		//time + transition
+		uint64_t key_size = sizeof(float) * 2;
 
-		switch (type) {
+		switch (animation->track_get_type(i)) {
 			case Animation::TYPE_TRANSFORM: {
-				//nothing to do
+				key_size += sizeof(Vector3) * 2 + sizeof(Quat);
 			} break;
 			case Animation::TYPE_VALUE: {
-				value_track_set_update_mode(i, _animation->value_track_get_update_mode(i));
+				key_size += sizeof(Variant);
 			} break;
 			case Animation::TYPE_METHOD: {
-				//nothing to do
+				key_size += sizeof(StringName) + sizeof(Vector<Variant>);
 			} break;
 			case Animation::TYPE_BEZIER: {
-				//nothing to do
+				key_size += sizeof(Vector2) * 2 + sizeof(float);
 			} break;
 			case Animation::TYPE_AUDIO: {
-				//nothing to do
+				key_size += sizeof(Ref<Resource>) + sizeof(float) * 2;
 			} break;
 			case Animation::TYPE_ANIMATION: {
-				//nothing to do
+				key_size += sizeof(StringName);
+			} break;
+			default: {
+				key_size += sizeof(Variant);
 			} break;
 		}
-	}
-
-	int custom_call_method_track = -1;
-
-	float target_keyframe_time = 0;
-	float key_step = 1.0 / static_cast<float>(_animation_fps);
-
-	int next_animation_key = _start_frame_index;
-	Vector<int> _used_keys;
-	while (next_animation_key != -1) {
-		ERR_BREAK(!_keyframes.has(next_animation_key));
-		ERR_BREAK_MSG(_used_keys.find(next_animation_key, 0) != -1, "ProceduralAnimation: " + get_name() + " " + get_path() + " contains a cycle in it's graph. Stopping generation.");
-		_used_keys.push_back(next_animation_key);
-		AnimationKeyFrame *frame = _keyframes[next_animation_key];
-		next_animation_key = frame->next_keyframe;
-
-		int animation_keyframe_index = frame->animation_keyframe_index;
-
-		float time = static_cast<float>(animation_keyframe_index) * key_step;
-
-		bool found_keyframe = false;
-		for (int i = 0; i < _animation->get_track_count(); ++i) {
-			int key_index = _animation->track_find_key(i, time, true);
-			Variant key_value;
-
-			if (key_index == -1) {
-				key_index = _animation->track_find_key(i, time, false);
-
-				if (key_index != -1)
-					key_value = _animation->track_get_key_value(i, key_index);
-			} else {
-				key_value = _animation->track_get_key_value(i, key_index);
-			}
-
-			if (key_value.get_type() == Variant::NIL)
-				continue;
-
-			track_insert_key(i, target_keyframe_time, key_value, frame->transition);
-
-			found_keyframe = true;
-		}
-
-		if (frame->method_name != "") {
-			if (custom_call_method_track == -1) {
-				custom_call_method_track = add_track(Animation::TYPE_METHOD);
-
-				track_set_path(custom_call_method_track, NodePath("."));
-				track_set_enabled(custom_call_method_track, true);
-			}
-
-			Dictionary d;
-			d["method"] = frame->method_name;
-			d["args"] = Array();
-
-			track_insert_key(custom_call_method_track, target_keyframe_time, d);
-		}
-
-		if (!found_keyframe)
-			ERR_PRINT("Could not find any keyframe! Index: " + String::num(animation_keyframe_index) + " at time: " + String::num(time));
 
-		target_keyframe_time += frame->time;
+		size += sizeof(NodePath) + _string_memory_usage(String(animation->track_get_path(i)));
+		size += key_count * key_size;
 	}
 
-	set_length(target_keyframe_time);
-	set_loop(looping);
+	return size;
 }
 
 ProceduralAnimation::ProceduralAnimation() {
 	_initialized = false;
+	_editor_data_stripped = false;
+	_deferred_source_loading = false;
+	_source_loading = false;
+	_rebake_pending = false;
+#if VERSION_MAJOR < 4
+	_source_thread = NULL;
+#endif
+	_prune_unreachable_on_save = false;
+	_analysis_dirty = true;
 	_animation_fps = 15;
+	_bake_tracks = true;
+	_bake_compact = false;
+	_strip_compacted_tracks = false;
+	_resample_fps = 0;
+	_resample_quantized = false;
+	_resampled_frame_count = 0;
+	_resampled_dirty = true;
+	_graph_dirty = true;
+	_graph_length = 0;
 	_start_frame_index = -1;
+
+	MutexLock lock(_instances_mutex);
+	_instance_element = _instances.push_back(this);
 }
 
 ProceduralAnimation::~ProceduralAnimation() {
+#if VERSION_MAJOR < 4
+	//The loader thread uses this object until it's finished, its deferred call is dropped with the object
+	if (_source_thread) {
+		Thread::wait_to_finish(_source_thread);
+		memdelete(_source_thread);
+		_source_thread = NULL;
+	}
+#endif
+
+	_instances_mutex.lock();
+	_instances.erase(_instance_element);
+	_instances_mutex.unlock();
+
 	for (Map<int, AnimationKeyFrame *>::Element *E = _keyframes.front(); E; E = E->next())
 		memdelete(E->get());
 
 	_keyframes.clear();
 
-	_animation.unref();
+	_set_source(Ref<Animation>());
 }
 
 bool ProceduralAnimation::_set(const StringName &p_name, const Variant &p_value) {
@@ -371,6 +2706,7 @@ bool ProceduralAnimation::_set(const StringName &p_name, const Variant &p_value)
 		return true;
 	} else if (name == "start_frame_index") {
 		_start_frame_index = p_value;
+		_graph_changed();
 
 		return true;
 	} else if (name.get_slicec('/', 0) == "keyframe") {
@@ -383,6 +2719,8 @@ bool ProceduralAnimation::_set(const StringName &p_name, const Variant &p_value)
 			_keyframes[keyframe_index] = keyframe;
 		}
 
+		_graph_changed();
+
 		AnimationKeyFrame *keyframe = _keyframes[keyframe_index];
 
 		if (keyframe_name == "name") {
@@ -392,6 +2730,14 @@ bool ProceduralAnimation::_set(const StringName &p_name, const Variant &p_value)
 		} else if (keyframe_name == "animation_keyframe_index") {
 			keyframe->animation_keyframe_index = p_value;
 
+			return true;
+		} else if (keyframe_name == "blend_animation_keyframe_index") {
+			keyframe->blend_animation_keyframe_index = p_value;
+
+			return true;
+		} else if (keyframe_name == "blend_weight") {
+			keyframe->blend_weight = p_value;
+
 			return true;
 		} else if (keyframe_name == "next_keyframe") {
 			keyframe->next_keyframe = p_value;
@@ -408,6 +2754,14 @@ bool ProceduralAnimation::_set(const StringName &p_name, const Variant &p_value)
 		} else if (keyframe_name == "method_name") {
 			keyframe->method_name = p_value;
 
+			return true;
+		} else if (keyframe_name == "method_args") {
+			Array args = p_value;
+
+			ERR_FAIL_COND_V_MSG(args.size() > MAX_METHOD_ARGS, false, "ProceduralAnimation: Keyframe " + itos(keyframe_index) + " has more than " + itos(MAX_METHOD_ARGS) + " method args.");
+
+			keyframe->method_args = args;
+
 			return true;
 		} else if (keyframe_name == "position") {
 			keyframe->position = p_value;
@@ -447,6 +2801,14 @@ bool ProceduralAnimation::_get(const StringName &p_name, Variant &r_ret) const {
 		} else if (keyframe_prop_name == "animation_keyframe_index") {
 			r_ret = keyframe->animation_keyframe_index;
 
+			return true;
+		} else if (keyframe_prop_name == "blend_animation_keyframe_index") {
+			r_ret = keyframe->blend_animation_keyframe_index;
+
+			return true;
+		} else if (keyframe_prop_name == "blend_weight") {
+			r_ret = keyframe->blend_weight;
+
 			return true;
 		} else if (keyframe_prop_name == "next_keyframe") {
 			r_ret = keyframe->next_keyframe;
@@ -463,6 +2825,10 @@ bool ProceduralAnimation::_get(const StringName &p_name, Variant &r_ret) const {
 		} else if (keyframe_prop_name == "method_name") {
 			r_ret = keyframe->method_name;
 
+			return true;
+		} else if (keyframe_prop_name == "method_args") {
+			r_ret = keyframe->method_args;
+
 			return true;
 		} else if (keyframe_prop_name == "position") {
 			r_ret = keyframe->position;
@@ -482,17 +2848,26 @@ void ProceduralAnimation::_get_property_list(List<PropertyInfo> *p_list) const {
 	//int property_usange = PROPERTY_USAGE_STORAGE | PROPERTY_USAGE_INTERNAL;
 	int property_usange = PROPERTY_USAGE_DEFAULT;
 
-	p_list->push_back(PropertyInfo(Variant::VECTOR2, "start_node_position", PROPERTY_HINT_NONE, "", property_usange));
+	if (!_editor_data_stripped)
+		p_list->push_back(PropertyInfo(Variant::VECTOR2, "start_node_position", PROPERTY_HINT_NONE, "", property_usange));
+
 	p_list->push_back(PropertyInfo(Variant::INT, "start_frame_index", PROPERTY_HINT_NONE, "", property_usange));
 
 	for (Map<int, AnimationKeyFrame *>::Element *K = _keyframes.front(); K; K = K->next()) {
-		p_list->push_back(PropertyInfo(Variant::STRING, "keyframe/" + itos(K->key()) + "/name", PROPERTY_HINT_NONE, "", property_usange));
+		if (!_editor_data_stripped)
+			p_list->push_back(PropertyInfo(Variant::STRING, "keyframe/" + itos(K->key()) + "/name", PROPERTY_HINT_NONE, "", property_usange));
+
 		p_list->push_back(PropertyInfo(Variant::INT, "keyframe/" + itos(K->key()) + "/animation_keyframe_index", PROPERTY_HINT_NONE, "", property_usange));
+		p_list->push_back(PropertyInfo(Variant::INT, "keyframe/" + itos(K->key()) + "/blend_animation_keyframe_index", PROPERTY_HINT_NONE, "", property_usange));
+		p_list->push_back(PropertyInfo(Variant::REAL, "keyframe/" + itos(K->key()) + "/blend_weight", PROPERTY_HINT_RANGE, "0,1,0.01", property_usange));
 		p_list->push_back(PropertyInfo(Variant::INT, "keyframe/" + itos(K->key()) + "/next_keyframe", PROPERTY_HINT_NONE, "", property_usange));
 		p_list->push_back(PropertyInfo(Variant::REAL, "keyframe/" + itos(K->key()) + "/transition", PROPERTY_HINT_EXP_EASING, "", property_usange));
 		p_list->push_back(PropertyInfo(Variant::REAL, "keyframe/" + itos(K->key()) + "/time", PROPERTY_HINT_NONE, "", property_usange));
 		p_list->push_back(PropertyInfo(Variant::STRING, "keyframe/" + itos(K->key()) + "/method_name", PROPERTY_HINT_NONE, "", property_usange));
-		p_list->push_back(PropertyInfo(Variant::VECTOR2, "keyframe/" + itos(K->key()) + "/position", PROPERTY_HINT_NONE, "", property_usange));
+		p_list->push_back(PropertyInfo(Variant::ARRAY, "keyframe/" + itos(K->key()) + "/method_args", PROPERTY_HINT_NONE, "", property_usange));
+
+		if (!_editor_data_stripped)
+			p_list->push_back(PropertyInfo(Variant::VECTOR2, "keyframe/" + itos(K->key()) + "/position", PROPERTY_HINT_NONE, "", property_usange));
 	}
 }
 
@@ -501,6 +2876,28 @@ void ProceduralAnimation::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_animation", "value"), &ProceduralAnimation::set_animation);
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "animation", PROPERTY_HINT_RESOURCE_TYPE, "Animation"), "set_animation", "get_animation");
 
+	ADD_SIGNAL(MethodInfo("source_ready"));
+
+	ClassDB::bind_method(D_METHOD("get_deferred_source_loading"), &ProceduralAnimation::get_deferred_source_loading);
+	ClassDB::bind_method(D_METHOD("set_deferred_source_loading", "value"), &ProceduralAnimation::set_deferred_source_loading);
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "deferred_source_loading"), "set_deferred_source_loading", "get_deferred_source_loading");
+
+	ClassDB::bind_method(D_METHOD("get_source_animation_path"), &ProceduralAnimation::get_source_animation_path);
+	ClassDB::bind_method(D_METHOD("set_source_animation_path", "value"), &ProceduralAnimation::set_source_animation_path);
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "source_animation_path", PROPERTY_HINT_FILE), "set_source_animation_path", "get_source_animation_path");
+
+	ClassDB::bind_method(D_METHOD("is_source_loaded"), &ProceduralAnimation::is_source_loaded);
+	ClassDB::bind_method(D_METHOD("is_source_loading"), &ProceduralAnimation::is_source_loading);
+	ClassDB::bind_method(D_METHOD("load_source"), &ProceduralAnimation::load_source);
+	ClassDB::bind_method(D_METHOD("load_source_async"), &ProceduralAnimation::load_source_async);
+
+#if VERSION_MAJOR < 4
+	ClassDB::bind_method(D_METHOD("_source_thread_finished", "source"), &ProceduralAnimation::_source_thread_finished);
+	ClassDB::bind_method(D_METHOD("_on_source_changed"), &ProceduralAnimation::_on_source_changed);
+#endif
+
+	ClassDB::bind_method(D_METHOD("_process_pending_rebake"), &ProceduralAnimation::_process_pending_rebake);
+
 	ClassDB::bind_method(D_METHOD("get_animation_fps"), &ProceduralAnimation::get_animation_fps);
 	ClassDB::bind_method(D_METHOD("set_animation_fps", "value"), &ProceduralAnimation::set_animation_fps);
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "animation_fps"), "set_animation_fps", "get_animation_fps");
@@ -516,6 +2913,24 @@ void ProceduralAnimation::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_start_frame_index"), &ProceduralAnimation::get_start_frame_index);
 	ClassDB::bind_method(D_METHOD("set_start_frame_index", "value"), &ProceduralAnimation::set_start_frame_index);
 
+	//Track filter
+	ClassDB::bind_method(D_METHOD("get_track_filter_include"), &ProceduralAnimation::get_track_filter_include);
+	ClassDB::bind_method(D_METHOD("set_track_filter_include", "value"), &ProceduralAnimation::set_track_filter_include);
+	ADD_PROPERTY(PropertyInfo(Variant::POOL_STRING_ARRAY, "track_filter_include"), "set_track_filter_include", "get_track_filter_include");
+
+	ClassDB::bind_method(D_METHOD("get_track_filter_exclude"), &ProceduralAnimation::get_track_filter_exclude);
+	ClassDB::bind_method(D_METHOD("set_track_filter_exclude", "value"), &ProceduralAnimation::set_track_filter_exclude);
+	ADD_PROPERTY(PropertyInfo(Variant::POOL_STRING_ARRAY, "track_filter_exclude"), "set_track_filter_exclude", "get_track_filter_exclude");
+
+	ClassDB::bind_method(D_METHOD("get_bone_filter"), &ProceduralAnimation::get_bone_filter);
+	ClassDB::bind_method(D_METHOD("set_bone_filter", "value"), &ProceduralAnimation::set_bone_filter);
+	ADD_PROPERTY(PropertyInfo(Variant::POOL_STRING_ARRAY, "bone_filter"), "set_bone_filter", "get_bone_filter");
+
+	ClassDB::bind_method(D_METHOD("is_track_path_allowed", "path", "type"), &ProceduralAnimation::is_track_path_allowed, DEFVAL(Animation::TYPE_TRANSFORM));
+
+	ClassDB::bind_method(D_METHOD("is_headless_mode_active"), &ProceduralAnimation::is_headless_mode_active);
+	ClassDB::bind_method(D_METHOD("strip_headless_tracks"), &ProceduralAnimation::strip_headless_tracks);
+
 	//Keyframes
 	ClassDB::bind_method(D_METHOD("get_keyframe_indices"), &ProceduralAnimation::get_keyframe_indices);
 	ClassDB::bind_method(D_METHOD("add_keyframe"), &ProceduralAnimation::add_keyframe);
@@ -528,6 +2943,12 @@ void ProceduralAnimation::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_keyframe_animation_keyframe_index", "keyframe_index"), &ProceduralAnimation::get_keyframe_animation_keyframe_index);
 	ClassDB::bind_method(D_METHOD("set_keyframe_animation_keyframe_index", "keyframe_index", "value"), &ProceduralAnimation::set_keyframe_animation_keyframe_index);
 
+	ClassDB::bind_method(D_METHOD("get_keyframe_blend_animation_keyframe_index", "keyframe_index"), &ProceduralAnimation::get_keyframe_blend_animation_keyframe_index);
+	ClassDB::bind_method(D_METHOD("set_keyframe_blend_animation_keyframe_index", "keyframe_index", "value"), &ProceduralAnimation::set_keyframe_blend_animation_keyframe_index);
+
+	ClassDB::bind_method(D_METHOD("get_keyframe_blend_weight", "keyframe_index"), &ProceduralAnimation::get_keyframe_blend_weight);
+	ClassDB::bind_method(D_METHOD("set_keyframe_blend_weight", "keyframe_index", "value"), &ProceduralAnimation::set_keyframe_blend_weight);
+
 	ClassDB::bind_method(D_METHOD("get_keyframe_next_keyframe_index", "keyframe_index"), &ProceduralAnimation::get_keyframe_next_keyframe_index);
 	ClassDB::bind_method(D_METHOD("set_keyframe_next_keyframe_index", "keyframe_index", "value"), &ProceduralAnimation::set_keyframe_next_keyframe_index);
 
@@ -540,8 +2961,111 @@ void ProceduralAnimation::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_method_name", "keyframe_index"), &ProceduralAnimation::get_method_name);
 	ClassDB::bind_method(D_METHOD("set_method_name", "keyframe_index", "value"), &ProceduralAnimation::set_method_name);
 
+	ClassDB::bind_method(D_METHOD("get_keyframe_method_args", "keyframe_index"), &ProceduralAnimation::get_keyframe_method_args);
+	ClassDB::bind_method(D_METHOD("set_keyframe_method_args", "keyframe_index", "value"), &ProceduralAnimation::set_keyframe_method_args);
+
 	ClassDB::bind_method(D_METHOD("get_keyframe_node_position", "keyframe_index"), &ProceduralAnimation::get_keyframe_node_position);
 	ClassDB::bind_method(D_METHOD("set_keyframe_node_position", "keyframe_index", "value"), &ProceduralAnimation::set_keyframe_node_position);
 
+	ClassDB::bind_method(D_METHOD("get_bake_tracks"), &ProceduralAnimation::get_bake_tracks);
+	ClassDB::bind_method(D_METHOD("set_bake_tracks", "value"), &ProceduralAnimation::set_bake_tracks);
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "bake_tracks"), "set_bake_tracks", "get_bake_tracks");
+
+	//Compact output
+	ClassDB::bind_method(D_METHOD("get_bake_compact"), &ProceduralAnimation::get_bake_compact);
+	ClassDB::bind_method(D_METHOD("set_bake_compact", "value"), &ProceduralAnimation::set_bake_compact);
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "bake_compact"), "set_bake_compact", "get_bake_compact");
+
+	ClassDB::bind_method(D_METHOD("get_strip_compacted_tracks"), &ProceduralAnimation::get_strip_compacted_tracks);
+	ClassDB::bind_method(D_METHOD("set_strip_compacted_tracks", "value"), &ProceduralAnimation::set_strip_compacted_tracks);
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "strip_compacted_tracks"), "set_strip_compacted_tracks", "get_strip_compacted_tracks");
+
+	ClassDB::bind_method(D_METHOD("get_compact_data"), &ProceduralAnimation::get_compact_data);
+	ClassDB::bind_method(D_METHOD("set_compact_data", "value"), &ProceduralAnimation::set_compact_data);
+	ADD_PROPERTY(PropertyInfo(Variant::POOL_BYTE_ARRAY, "compact_data", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NOEDITOR), "set_compact_data", "get_compact_data");
+
+	ClassDB::bind_method(D_METHOD("has_compact_data"), &ProceduralAnimation::has_compact_data);
+	ClassDB::bind_method(D_METHOD("get_compact_track_count"), &ProceduralAnimation::get_compact_track_count);
+	ClassDB::bind_method(D_METHOD("get_compact_track_path", "track"), &ProceduralAnimation::get_compact_track_path);
+	ClassDB::bind_method(D_METHOD("find_compact_track", "path"), &ProceduralAnimation::find_compact_track);
+	ClassDB::bind_method(D_METHOD("sample_compact_transform", "track", "time"), &ProceduralAnimation::sample_compact_transform);
+
+	//Resampled output
+	ClassDB::bind_method(D_METHOD("get_resample_fps"), &ProceduralAnimation::get_resample_fps);
+	ClassDB::bind_method(D_METHOD("set_resample_fps", "value"), &ProceduralAnimation::set_resample_fps);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "resample_fps", PROPERTY_HINT_RANGE, "0,240,1"), "set_resample_fps", "get_resample_fps");
+
+	ClassDB::bind_method(D_METHOD("get_resample_quantized"), &ProceduralAnimation::get_resample_quantized);
+	ClassDB::bind_method(D_METHOD("set_resample_quantized", "value"), &ProceduralAnimation::set_resample_quantized);
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "resample_quantized"), "set_resample_quantized", "get_resample_quantized");
+
+	ClassDB::bind_method(D_METHOD("resample"), &ProceduralAnimation::resample);
+	ClassDB::bind_method(D_METHOD("get_resampled_track_count"), &ProceduralAnimation::get_resampled_track_count);
+	ClassDB::bind_method(D_METHOD("get_resampled_track_path", "track"), &ProceduralAnimation::get_resampled_track_path);
+	ClassDB::bind_method(D_METHOD("find_resampled_track", "path"), &ProceduralAnimation::find_resampled_track);
+	ClassDB::bind_method(D_METHOD("get_resampled_frame_count"), &ProceduralAnimation::get_resampled_frame_count);
+	ClassDB::bind_method(D_METHOD("sample_resampled_transform", "track", "time"), &ProceduralAnimation::sample_resampled_transform);
+
+	//Root motion
+	ClassDB::bind_method(D_METHOD("get_root_motion_track"), &ProceduralAnimation::get_root_motion_track);
+	ClassDB::bind_method(D_METHOD("set_root_motion_track", "value"), &ProceduralAnimation::set_root_motion_track);
+	ADD_PROPERTY(PropertyInfo(Variant::NODE_PATH, "root_motion_track"), "set_root_motion_track", "get_root_motion_track");
+
+	ClassDB::bind_method(D_METHOD("get_root_motion_positions"), &ProceduralAnimation::get_root_motion_positions);
+	ClassDB::bind_method(D_METHOD("set_root_motion_positions", "value"), &ProceduralAnimation::set_root_motion_positions);
+	ADD_PROPERTY(PropertyInfo(Variant::POOL_VECTOR3_ARRAY, "root_motion_positions", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NOEDITOR), "set_root_motion_positions", "get_root_motion_positions");
+
+	ClassDB::bind_method(D_METHOD("get_root_motion_rotations"), &ProceduralAnimation::get_root_motion_rotations);
+	ClassDB::bind_method(D_METHOD("set_root_motion_rotations", "value"), &ProceduralAnimation::set_root_motion_rotations);
+	ADD_PROPERTY(PropertyInfo(Variant::POOL_REAL_ARRAY, "root_motion_rotations", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NOEDITOR), "set_root_motion_rotations", "get_root_motion_rotations");
+
+	ClassDB::bind_method(D_METHOD("has_root_motion"), &ProceduralAnimation::has_root_motion);
+	ClassDB::bind_method(D_METHOD("get_root_motion_position", "time"), &ProceduralAnimation::get_root_motion_position);
+	ClassDB::bind_method(D_METHOD("get_root_motion_rotation", "time"), &ProceduralAnimation::get_root_motion_rotation);
+	ClassDB::bind_method(D_METHOD("get_root_motion", "from_time", "to_time"), &ProceduralAnimation::get_root_motion);
+
+	ClassDB::bind_method(D_METHOD("get_graph_length"), &ProceduralAnimation::get_graph_length);
+	ClassDB::bind_method(D_METHOD("get_keyframe_chain"), &ProceduralAnimation::get_keyframe_chain);
+
+	//Segments
+	ClassDB::bind_method(D_METHOD("compile_graph"), &ProceduralAnimation::compile_graph);
+	ClassDB::bind_method(D_METHOD("get_segment_count"), &ProceduralAnimation::get_segment_count);
+	ClassDB::bind_method(D_METHOD("find_segment", "time"), &ProceduralAnimation::find_segment);
+	ClassDB::bind_method(D_METHOD("find_segment_cursor", "time", "cursor"), &ProceduralAnimation::find_segment_cursor);
+	ClassDB::bind_method(D_METHOD("get_segment_data"), &ProceduralAnimation::get_segment_data);
+
+	//Method events
+	ClassDB::bind_method(D_METHOD("get_method_event_count"), &ProceduralAnimation::get_method_event_count);
+	ClassDB::bind_method(D_METHOD("get_method_event_time", "index"), &ProceduralAnimation::get_method_event_time);
+	ClassDB::bind_method(D_METHOD("get_method_event_method", "index"), &ProceduralAnimation::get_method_event_method);
+	ClassDB::bind_method(D_METHOD("get_method_event_args", "index"), &ProceduralAnimation::get_method_event_args);
+	ClassDB::bind_method(D_METHOD("call_method_events", "target", "from_time", "to_time"), &ProceduralAnimation::call_method_events);
+
+	ClassDB::bind_method(D_METHOD("find_source_key", "source_track", "animation_keyframe_index"), &ProceduralAnimation::find_source_key);
+
+	ClassDB::bind_method(D_METHOD("get_keyframe_data"), &ProceduralAnimation::get_keyframe_data);
+	ClassDB::bind_method(D_METHOD("get_keyframe_data_for", "keyframe_indices"), &ProceduralAnimation::get_keyframe_data_for);
+	ClassDB::bind_method(D_METHOD("set_keyframe_data", "data"), &ProceduralAnimation::set_keyframe_data);
+	ClassDB::bind_method(D_METHOD("update_keyframe_data", "data"), &ProceduralAnimation::update_keyframe_data);
+
 	ClassDB::bind_method(D_METHOD("process_animation_data"), &ProceduralAnimation::process_animation_data);
+
+	ClassDB::bind_method(D_METHOD("get_graph_hash"), &ProceduralAnimation::get_graph_hash);
+
+	ClassDB::bind_method(D_METHOD("get_source_pose_index"), &ProceduralAnimation::get_source_pose_index);
+	ClassDB::bind_method(D_METHOD("find_similar_source_frames", "animation_keyframe_index", "count"), &ProceduralAnimation::find_similar_source_frames);
+
+	ClassDB::bind_method(D_METHOD("get_prune_unreachable_on_save"), &ProceduralAnimation::get_prune_unreachable_on_save);
+	ClassDB::bind_method(D_METHOD("set_prune_unreachable_on_save", "value"), &ProceduralAnimation::set_prune_unreachable_on_save);
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "prune_unreachable_on_save"), "set_prune_unreachable_on_save", "get_prune_unreachable_on_save");
+
+	ClassDB::bind_method(D_METHOD("get_graph_analysis"), &ProceduralAnimation::get_graph_analysis);
+	ClassDB::bind_method(D_METHOD("is_keyframe_reachable", "keyframe_index"), &ProceduralAnimation::is_keyframe_reachable);
+	ClassDB::bind_method(D_METHOD("prune_unreachable_keyframes"), &ProceduralAnimation::prune_unreachable_keyframes);
+
+	ClassDB::bind_method(D_METHOD("strip_editor_data", "strip_keyframe_graph"), &ProceduralAnimation::strip_editor_data);
+	ClassDB::bind_method(D_METHOD("is_editor_data_stripped"), &ProceduralAnimation::is_editor_data_stripped);
+
+	ClassDB::bind_method(D_METHOD("get_memory_usage"), &ProceduralAnimation::get_memory_usage);
+	ClassDB::bind_method(D_METHOD("get_module_memory_usage"), &ProceduralAnimation::get_module_memory_usage);
 }
\ No newline at end of file
@@ -26,13 +26,23 @@ SOFTWARE.
 #include "core/version.h"
 
 #if VERSION_MAJOR > 3
+#include "core/templates/set.h"
+#include "core/templates/list.h"
 #include "core/templates/vector.h"
 #include "core/templates/map.h"
 #else
+#include "core/set.h"
+#include "core/list.h"
 #include "core/vector.h"
 #include "core/map.h"
 #endif
 
+#include "core/os/mutex.h"
+
+#if VERSION_MAJOR < 4
+#include "core/io/resource_loader.h"
+#endif
+
 #include "scene/resources/animation.h"
 #include "core/math/vector2.h"
 #include "scene/resources/animation.h"
@@ -45,26 +55,112 @@ SOFTWARE.
 #else
 #define PoolVector Vector
 #define REAL FLOAT
+#define POOL_STRING_ARRAY PACKED_STRING_ARRAY
+#define POOL_REAL_ARRAY PACKED_FLOAT32_ARRAY
+#define POOL_VECTOR3_ARRAY PACKED_VECTOR3_ARRAY
+#define POOL_BYTE_ARRAY PACKED_BYTE_ARRAY
 #endif
 
+class ProceduralAnimationPoseIndex;
+class Thread;
+
 class ProceduralAnimation : public Animation {
 	GDCLASS(ProceduralAnimation, Animation);
 
+public:
+	//Math::ease() precomputed for one transition value, linearly interpolated when sampled.
+	//A keyframe's transition is fixed for its whole segment, so runtime evaluation can use this
+	//instead of calling pow() for every sample.
+	struct EaseTable {
+		enum {
+			SIZE = 64,
+		};
+
+		float transition;
+		float values[SIZE + 1];
+
+		void build(const float p_transition);
+
+		_FORCE_INLINE_ float sample(const float c) const {
+			float f = CLAMP(c, 0, 1) * SIZE;
+			int i = MIN(static_cast<int>(f), SIZE - 1);
+
+			return values[i] + (values[i + 1] - values[i]) * (f - i);
+		}
+
+		EaseTable() {
+			build(1.0);
+		}
+	};
+
+	//One entry of the compiled keyframe chain, in play order.
+	struct Segment {
+		float start_time;
+		float duration;
+		int keyframe;
+		int source_frame;
+		int blend_source_frame;
+		float blend_weight;
+		int ease_table;
+		StringName method;
+
+		Segment() {
+			start_time = 0;
+			duration = 0;
+			keyframe = -1;
+			source_frame = 0;
+			blend_source_frame = -1;
+			blend_weight = 0;
+			ease_table = 0;
+		}
+	};
+
+	//A method call of the compiled graph, sorted by time.
+	struct MethodEvent {
+		float time;
+		int segment;
+		StringName method;
+		Vector<Variant> args;
+
+		MethodEvent() {
+			time = 0;
+			segment = -1;
+		}
+	};
+
+	enum {
+		MAX_METHOD_ARGS = 8,
+		MAX_SAMPLED_POSES = 4,
+	};
+
+	//location xyz, rotation xyzw, scale xyz
+	enum {
+		RESAMPLED_CHANNEL_COUNT = 10,
+	};
+
 protected:
 	struct AnimationKeyFrame {
 		String name;
 		int animation_keyframe_index;
+		int blend_animation_keyframe_index;
+		float blend_weight;
 		int next_keyframe;
 		float transition;
 		float time;
 		String method_name;
+		Array method_args;
 		Vector2 position;
 
+		int ease_table;
+
 		AnimationKeyFrame() {
 			animation_keyframe_index = 0;
+			blend_animation_keyframe_index = -1;
+			blend_weight = 0;
 			transition = 1.0;
 			next_keyframe = -1;
 			time = 1;
+			ease_table = 0;
 		}
 
 		~AnimationKeyFrame() {
@@ -75,6 +171,18 @@ public:
 	Ref<Animation> get_animation() const;
 	void set_animation(const Ref<Animation> &value);
 
+	//Deferred source loading
+	bool get_deferred_source_loading() const;
+	void set_deferred_source_loading(const bool value);
+
+	String get_source_animation_path() const;
+	void set_source_animation_path(const String &value);
+
+	bool is_source_loaded() const;
+	bool is_source_loading() const;
+	void load_source();
+	void load_source_async();
+
 	int get_animation_fps() const;
 	void set_animation_fps(const int index);
 
@@ -89,6 +197,35 @@ public:
 	int get_start_frame_index() const;
 	void set_start_frame_index(const int value);
 
+	//Track filter
+	PoolVector<String> get_track_filter_include() const;
+	void set_track_filter_include(const PoolVector<String> &value);
+
+	PoolVector<String> get_track_filter_exclude() const;
+	void set_track_filter_exclude(const PoolVector<String> &value);
+
+	PoolVector<String> get_bone_filter() const;
+	void set_bone_filter(const PoolVector<String> &value);
+
+	bool is_track_path_allowed(const NodePath &path, const Animation::TrackType type) const;
+
+	//Headless mode
+	enum HeadlessMode {
+		HEADLESS_MODE_DISABLED = 0,
+		HEADLESS_MODE_SERVER,
+		HEADLESS_MODE_ALWAYS,
+	};
+
+	static const char *HEADLESS_MODE_SETTING;
+	static const char *HEADLESS_TRACKS_SETTING;
+
+	static void register_settings();
+	static bool is_headless();
+	static bool is_headless_track(const NodePath &path);
+
+	bool is_headless_mode_active() const;
+	void strip_headless_tracks();
+
 	//Keyframes
 	PoolVector<int> get_keyframe_indices() const;
 	int add_keyframe();
@@ -101,6 +238,13 @@ public:
 	int get_keyframe_animation_keyframe_index(const int keyframe_index) const;
 	void set_keyframe_animation_keyframe_index(const int keyframe_index, const int value);
 
+	//Pose blending, the keyframe's pose is blended from animation_keyframe_index towards this frame by blend_weight
+	int get_keyframe_blend_animation_keyframe_index(const int keyframe_index) const;
+	void set_keyframe_blend_animation_keyframe_index(const int keyframe_index, const int value);
+
+	float get_keyframe_blend_weight(const int keyframe_index) const;
+	void set_keyframe_blend_weight(const int keyframe_index, const float value);
+
 	int get_keyframe_next_keyframe_index(const int keyframe_index) const;
 	void set_keyframe_next_keyframe_index(const int keyframe_index, const int value);
 
@@ -113,23 +257,163 @@ public:
 	String get_method_name(const int keyframe_index) const;
 	void set_method_name(const int keyframe_index, const String &value);
 
+	Array get_keyframe_method_args(const int keyframe_index) const;
+	void set_keyframe_method_args(const int keyframe_index, const Array &value);
+
 	Vector2 get_keyframe_node_position(const int keyframe_index) const;
 	void set_keyframe_node_position(const int keyframe_index, const Vector2 &value);
 
+	//Bulk access, every field is a packed array, indexed the same way as "indices"
+	Dictionary get_keyframe_data() const;
+	Dictionary get_keyframe_data_for(const PoolVector<int> &keyframe_indices) const;
+	void set_keyframe_data(const Dictionary &data);
+	void update_keyframe_data(const Dictionary &data);
+
+	bool get_bake_tracks() const;
+	void set_bake_tracks(const bool value);
+
+	//Root motion
+	NodePath get_root_motion_track() const;
+	void set_root_motion_track(const NodePath &value);
+
+	PoolVector<Vector3> get_root_motion_positions() const;
+	void set_root_motion_positions(const PoolVector<Vector3> &value);
+
+	PoolVector<real_t> get_root_motion_rotations() const;
+	void set_root_motion_rotations(const PoolVector<real_t> &value);
+
+	bool has_root_motion() const;
+	Vector3 get_root_motion_position(const float time) const;
+	Quat get_root_motion_rotation(const float time) const;
+	Transform get_root_motion(const float from_time, const float to_time) const;
+
 	void process_animation_data();
 
+	int find_source_key(const int source_track, const int animation_keyframe_index) const;
+	static Variant blend_key_values(const Variant &a, const Variant &b, const float weight);
+	PoolVector<int> get_keyframe_chain() const;
+
+	//Runtime sampling straight from the graph, without the baked tracks
+	float get_graph_length() const;
+	bool sample_graph(const float time, int *r_from_frame, int *r_to_frame, float *r_weight, int *r_cursor = NULL) const;
+	int sample_graph_poses(const float time, int *r_frames, float *r_weights, int *r_cursor = NULL) const;
+	bool has_track_filter() const;
+
+	const EaseTable &get_keyframe_ease_table(const int keyframe_index) const;
+	const EaseTable &get_ease_table(const int index) const;
+
+	//Compact output, see ProceduralAnimationCompact
+	bool get_bake_compact() const;
+	void set_bake_compact(const bool value);
+
+	bool get_strip_compacted_tracks() const;
+	void set_strip_compacted_tracks(const bool value);
+
+	PoolVector<uint8_t> get_compact_data() const;
+	void set_compact_data(const PoolVector<uint8_t> &value);
+
+	bool has_compact_data() const;
+	const uint8_t *get_compact_data_ptr() const;
+	int get_compact_track_count() const;
+	NodePath get_compact_track_path(const int track) const;
+	int find_compact_track(const NodePath &path) const;
+	bool sample_compact(const int track, const float time, Vector3 *r_loc, Quat *r_rot, Vector3 *r_scale) const;
+	Transform sample_compact_transform(const int track, const float time) const;
+
+	//Resampled output, the baked transform tracks sampled at a fixed rate, so a sample is an index lookup
+	int get_resample_fps() const;
+	void set_resample_fps(const int value);
+
+	bool get_resample_quantized() const;
+	void set_resample_quantized(const bool value);
+
+	void resample();
+	int get_resampled_track_count() const;
+	NodePath get_resampled_track_path(const int track) const;
+	int find_resampled_track(const NodePath &path) const;
+	int get_resampled_frame_count() const;
+	void get_resampled_frame(const int track, const int frame, float *r_channels) const;
+	void sample_resampled(const int track, const float time, Vector3 *r_loc, Quat *r_rot, Vector3 *r_scale) const;
+	Transform sample_resampled_transform(const int track, const float time) const;
+
+	//Segments
+	void compile_graph();
+	int get_segment_count() const;
+	const Segment &get_segment(const int index) const;
+	int find_segment(const float time) const;
+	int find_segment_cursor(const float time, const int cursor) const;
+	Dictionary get_segment_data() const;
+
+	//Method events
+	int get_method_event_count() const;
+	float get_method_event_time(const int index) const;
+	StringName get_method_event_method(const int index) const;
+	Array get_method_event_args(const int index) const;
+	int call_method_events(Object *target, const float from_time, const float to_time) const;
+
+	uint32_t get_graph_hash() const;
+
+	//Pose index of the source, see ProceduralAnimationPoseIndex
+	Ref<ProceduralAnimationPoseIndex> get_source_pose_index() const;
+	PoolVector<int> find_similar_source_frames(const int animation_keyframe_index, const int count) const;
+
+	//Graph analysis
+	//Unreachable keyframes are pruned from a copy when saved, see ResourceFormatSaverProceduralAnimation
+	bool get_prune_unreachable_on_save() const;
+	void set_prune_unreachable_on_save(const bool value);
+
+	Dictionary get_graph_analysis() const;
+	bool is_keyframe_reachable(const int keyframe_index) const;
+	int prune_unreachable_keyframes();
+
+	//Export
+	void strip_editor_data(const bool strip_keyframe_graph);
+	bool is_editor_data_stripped() const;
+
+	//Memory
+	Dictionary get_memory_usage() const;
+	uint64_t get_module_memory_usage() const;
+
+	static uint64_t get_total_memory_usage();
+	static uint64_t get_instance_count();
+	static uint64_t get_animation_memory_usage(const Animation *animation);
+
 	ProceduralAnimation();
 	~ProceduralAnimation();
 
 protected:
+	void _graph_changed();
+	bool _apply_keyframe_data(const Dictionary &data, const bool replace);
+	void _set_source(const Ref<Animation> &source);
+	void _on_source_changed();
+	void _process_pending_rebake();
+	bool _is_source_deferred() const;
+#if VERSION_MAJOR > 3
+	void _poll_source_loading();
+#else
+	static void _source_thread_func(void *p_userdata);
+	void _source_thread_finished(const Ref<Animation> &source);
+#endif
+	void _finish_source_loading(const Ref<Animation> &source);
+	void _validate_property(PropertyInfo &property) const;
+	void _bake_root_motion();
+	void _compile_graph() const;
+	void _resample() const;
+	void _analyze_graph() const;
+	void _resolve_method_events(const Object *target) const;
+	int _call_method_events(Object *target, const float from_time, const float to_time) const;
+
 	bool _set(const StringName &p_name, const Variant &p_value);
 	bool _get(const StringName &p_name, Variant &r_ret) const;
 	void _get_property_list(List<PropertyInfo> *p_list) const;
+	static void _update_headless_settings();
 	static void _bind_methods();
 
 private:
 	bool _initialized;
+	bool _editor_data_stripped;
 	int _animation_fps;
+	bool _bake_tracks;
 
 	String _editor_add_category_name;
 	String _add_editor_category_animation_name;
@@ -140,6 +424,70 @@ private:
 
 	Ref<Animation> _animation;
 	Map<int, String> _keyframe_names;
+
+	bool _deferred_source_loading;
+	String _source_animation_path;
+	bool _source_loading;
+	bool _rebake_pending;
+
+#if VERSION_MAJOR < 4
+	Thread *_source_thread;
+	String _source_thread_path;
+#endif
+
+	PoolVector<String> _track_filter_include;
+	PoolVector<String> _track_filter_exclude;
+	PoolVector<String> _bone_filter;
+
+	//Accumulated root translation and rotation (x, y, z, w) at the start of every segment,
+	//plus one entry for the end of the graph
+	NodePath _root_motion_track;
+	PoolVector<Vector3> _root_motion_positions;
+	PoolVector<real_t> _root_motion_rotations;
+
+	//Compact output, baked with the tracks, and saved
+	bool _bake_compact;
+	bool _strip_compacted_tracks;
+	Vector<uint8_t> _compact_data;
+
+	//Resampled output, rebuilt lazily after a bake
+	//[(track * _resampled_frame_count + frame) * RESAMPLED_CHANNEL_COUNT + channel], either as floats,
+	//or quantized to 16 bits. Quantized locations and scales are relative to the range of their track,
+	//[track * 12]: location min, location extent, scale min, scale extent.
+	int _resample_fps;
+	bool _resample_quantized;
+	mutable Vector<NodePath> _resampled_track_paths;
+	mutable int _resampled_frame_count;
+	mutable Vector<float> _resampled_data;
+	mutable Vector<uint16_t> _resampled_quantized_data;
+	mutable Vector<float> _resampled_ranges;
+	mutable bool _resampled_dirty;
+
+	//Compiled from the keyframes, rebuilt lazily after the graph changes
+	mutable Vector<Segment> _segments;
+	mutable Vector<EaseTable> _ease_tables;
+	mutable Vector<MethodEvent> _method_events;
+	mutable float _graph_length;
+	mutable bool _graph_dirty;
+
+	bool _prune_unreachable_on_save;
+	mutable Set<int> _reachable_keyframes;
+	mutable Dictionary _analysis;
+	mutable bool _analysis_dirty;
+
+	//MethodBinds of _method_events, resolved for the class of the last script-less target
+	mutable StringName _method_bind_class;
+	mutable Vector<MethodBind *> _method_binds;
+
+	//Every live instance, for the module wide memory total
+	List<ProceduralAnimation *>::Element *_instance_element;
+
+	static List<ProceduralAnimation *> _instances;
+	static Mutex _instances_mutex;
+
+	//-1 until the project settings are read
+	static int _headless_state;
+	static PoolVector<String> _headless_tracks;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,423 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "procedural_animation_baker.h"
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/config/project_settings.h"
+#include "core/templates/thread_work_pool.h"
+#else
+#include "core/os/thread.h"
+#include "core/project_settings.h"
+#include "core/safe_refcount.h"
+#endif
+
+#include "core/io/config_file.h"
+#include "core/io/resource_loader.h"
+#include "core/io/resource_saver.h"
+#include "core/os/dir_access.h"
+#include "core/os/file_access.h"
+#include "core/os/os.h"
+
+#include "procedural_animation_library.h"
+
+const char *ProceduralAnimationBaker::COMMAND_LINE_FLAG = "--bake-procedural-animations";
+
+int ProceduralAnimationBaker::get_thread_count() const {
+	return _thread_count;
+}
+void ProceduralAnimationBaker::set_thread_count(const int value) {
+	_thread_count = value;
+}
+
+bool ProceduralAnimationBaker::get_use_cache() const {
+	return _use_cache;
+}
+void ProceduralAnimationBaker::set_use_cache(const bool value) {
+	_use_cache = value;
+}
+
+String ProceduralAnimationBaker::get_cache_path() const {
+	return _cache_path;
+}
+void ProceduralAnimationBaker::set_cache_path(const String &value) {
+	_cache_path = value;
+}
+
+int ProceduralAnimationBaker::bake_directory(const String &path, const bool recursive) {
+	Vector<String> paths;
+	bool found = _find_resources(path, recursive, &paths);
+
+	PoolVector<String> pv;
+	pv.resize(paths.size());
+
+	for (int i = 0; i < paths.size(); ++i) {
+		pv.set(i, paths[i]);
+	}
+
+	int baked = bake_files(pv);
+
+	if (!found) {
+		++_failed_count;
+	}
+
+	return baked;
+}
+
+int ProceduralAnimationBaker::bake_files(const PoolVector<String> &paths) {
+	_failed_count = 0;
+
+	Ref<ConfigFile> cache;
+	cache.instance();
+
+	if (_use_cache && FileAccess::exists(_cache_path)) {
+		cache->load(_cache_path);
+	}
+
+	//Loading and saving stays on this thread, only process_animation_data() runs in parallel.
+	Vector<BakeJob> jobs;
+
+	for (int i = 0; i < paths.size(); ++i) {
+		String path = paths[i];
+
+		Ref<ProceduralAnimation> animation = ResourceLoader::load(path, "ProceduralAnimation");
+
+		if (!animation.is_valid()) {
+			ERR_PRINT("ProceduralAnimationBaker: Could not load " + path);
+			++_failed_count;
+			continue;
+		}
+
+		//The bake needs the source, even if it's usually loaded in the background
+		animation->load_source();
+
+		BakeJob job;
+		job.path = path;
+		job.key = get_bake_key(animation);
+		job.animation = animation;
+
+		if (_use_cache && cache->get_value("bake_keys", path.md5_text(), "") == job.key) {
+			continue;
+		}
+
+		jobs.push_back(job);
+	}
+
+	if (jobs.size() == 0) {
+		return 0;
+	}
+
+	int thread_count = _thread_count;
+
+	if (thread_count <= 0) {
+		thread_count = OS::get_singleton()->get_processor_count();
+	}
+
+	thread_count = CLAMP(thread_count, 1, jobs.size());
+
+#if VERSION_MAJOR > 3
+	ThreadWorkPool pool;
+	pool.init(thread_count);
+	pool.do_work(jobs.size(), this, &ProceduralAnimationBaker::_bake_job, &jobs);
+	pool.finish();
+#else
+	_current_jobs = &jobs;
+	_next_job = 0;
+
+	Vector<Thread *> threads;
+
+	for (int i = 0; i < thread_count; ++i) {
+		threads.push_back(Thread::create(_bake_thread_func, this));
+	}
+
+	for (int i = 0; i < threads.size(); ++i) {
+		Thread::wait_to_finish(threads[i]);
+		memdelete(threads[i]);
+	}
+
+	_current_jobs = NULL;
+#endif
+
+	int baked = 0;
+
+	for (int i = 0; i < jobs.size(); ++i) {
+		const BakeJob &job = jobs[i];
+
+		Error err = ResourceSaver::save(job.path, job.animation);
+
+		if (err != OK) {
+			ERR_PRINT("ProceduralAnimationBaker: Could not save " + job.path);
+			++_failed_count;
+			continue;
+		}
+
+		cache->set_value("bake_keys", job.path.md5_text(), job.key);
+		++baked;
+	}
+
+	if (_use_cache) {
+		DirAccessRef da = DirAccess::create(DirAccess::ACCESS_RESOURCES);
+		da->make_dir_recursive(_cache_path.get_base_dir());
+
+		cache->save(_cache_path);
+	}
+
+	return baked;
+}
+
+//Writes every ProceduralAnimation under path into one ProceduralAnimationLibrary file, named by their resource paths.
+//Bake them first, the library only contains baked data. The library is still written if some resources
+//could not be loaded, but then ERR_CANT_OPEN is returned.
+Error ProceduralAnimationBaker::pack_directory(const String &path, const String &library_path, const bool recursive) {
+	_failed_count = 0;
+
+	Vector<String> paths;
+
+	if (!_find_resources(path, recursive, &paths)) {
+		++_failed_count;
+	}
+
+	Dictionary animations;
+
+	for (int i = 0; i < paths.size(); ++i) {
+		Ref<ProceduralAnimation> animation = ResourceLoader::load(paths[i], "ProceduralAnimation");
+
+		if (!animation.is_valid()) {
+			ERR_PRINT("ProceduralAnimationBaker: Could not load " + paths[i]);
+			++_failed_count;
+			continue;
+		}
+
+		animations[paths[i]] = animation;
+	}
+
+	Ref<ProceduralAnimationLibrary> library;
+	library.instance();
+
+	Error err = library->save_library(library_path, animations);
+
+	if (err != OK) {
+		return err;
+	}
+
+	return _failed_count > 0 ? ERR_CANT_OPEN : OK;
+}
+
+int ProceduralAnimationBaker::get_failed_count() const {
+	return _failed_count;
+}
+
+//The key changes when either the graph, or the source animation's file changes.
+String ProceduralAnimationBaker::get_bake_key(const Ref<ProceduralAnimation> &animation) const {
+	ERR_FAIL_COND_V(!animation.is_valid(), "");
+
+	String key = String::num_int64(animation->get_graph_hash(), 16);
+
+	Ref<Animation> source = animation->get_animation();
+
+	if (source.is_valid()) {
+		String source_path = source->get_path();
+
+		//Built-in sources are saved into the resource itself, so the graph hash already covers them.
+		if (source_path != "" && source_path.find("::") == -1) {
+			key += ":" + FileAccess::get_md5(source_path);
+		}
+	}
+
+	return key;
+}
+
+String ProceduralAnimationBaker::get_default_cache_path() {
+#if VERSION_MAJOR > 3
+	return "res://.godot/procedural_animations/bake_cache.cfg";
+#else
+	return "res://.import/procedural_animations/bake_cache.cfg";
+#endif
+}
+
+//Returns false if path, or one of its subdirectories could not be opened.
+bool ProceduralAnimationBaker::_find_resources(const String &path, const bool recursive, Vector<String> *r_paths) const {
+	DirAccessRef da = DirAccess::open(path);
+
+	ERR_FAIL_COND_V_MSG(!da, false, "ProceduralAnimationBaker: Could not open directory " + path);
+
+	da->list_dir_begin();
+
+	String file = da->get_next();
+	Vector<String> subdirs;
+
+	while (file != "") {
+		if (file == "." || file == ".." || file.begins_with(".")) {
+			file = da->get_next();
+			continue;
+		}
+
+		String file_path = path.plus_file(file);
+
+		if (da->current_is_dir()) {
+			if (recursive) {
+				subdirs.push_back(file_path);
+			}
+		} else {
+			String ext = file.get_extension().to_lower();
+
+			if (ext == "tres" || ext == "res") {
+				String type = ResourceLoader::get_resource_type(file_path);
+
+				if (type != "" && ClassDB::is_parent_class(type, "ProceduralAnimation")) {
+					r_paths->push_back(file_path);
+				}
+			}
+		}
+
+		file = da->get_next();
+	}
+
+	da->list_dir_end();
+
+	bool ok = true;
+
+	for (int i = 0; i < subdirs.size(); ++i) {
+		if (!_find_resources(subdirs[i], recursive, r_paths)) {
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+void ProceduralAnimationBaker::_bake_job(uint32_t p_index, Vector<BakeJob> *p_jobs) {
+	(*p_jobs)[p_index].animation->process_animation_data();
+}
+
+void ProceduralAnimationBaker::_bake_thread_func(void *p_userdata) {
+#if VERSION_MAJOR < 4
+	ProceduralAnimationBaker *self = static_cast<ProceduralAnimationBaker *>(p_userdata);
+
+	while (true) {
+		uint32_t index = atomic_increment(&self->_next_job) - 1;
+
+		if (index >= static_cast<uint32_t>(self->_current_jobs->size())) {
+			break;
+		}
+
+		self->_bake_job(index, self->_current_jobs);
+	}
+#endif
+}
+
+ProceduralAnimationBaker::ProceduralAnimationBaker() {
+	_thread_count = 0;
+	_use_cache = true;
+	_cache_path = get_default_cache_path();
+	_failed_count = 0;
+
+	_current_jobs = NULL;
+	_next_job = 0;
+}
+
+ProceduralAnimationBaker::~ProceduralAnimationBaker() {
+}
+
+void ProceduralAnimationBaker::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_thread_count"), &ProceduralAnimationBaker::get_thread_count);
+	ClassDB::bind_method(D_METHOD("set_thread_count", "value"), &ProceduralAnimationBaker::set_thread_count);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "thread_count"), "set_thread_count", "get_thread_count");
+
+	ClassDB::bind_method(D_METHOD("get_use_cache"), &ProceduralAnimationBaker::get_use_cache);
+	ClassDB::bind_method(D_METHOD("set_use_cache", "value"), &ProceduralAnimationBaker::set_use_cache);
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_cache"), "set_use_cache", "get_use_cache");
+
+	ClassDB::bind_method(D_METHOD("get_cache_path"), &ProceduralAnimationBaker::get_cache_path);
+	ClassDB::bind_method(D_METHOD("set_cache_path", "value"), &ProceduralAnimationBaker::set_cache_path);
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "cache_path"), "set_cache_path", "get_cache_path");
+
+	ClassDB::bind_method(D_METHOD("bake_directory", "path", "recursive"), &ProceduralAnimationBaker::bake_directory, DEFVAL(true));
+	ClassDB::bind_method(D_METHOD("bake_files", "paths"), &ProceduralAnimationBaker::bake_files);
+	ClassDB::bind_method(D_METHOD("pack_directory", "path", "library_path", "recursive"), &ProceduralAnimationBaker::pack_directory, DEFVAL(true));
+	ClassDB::bind_method(D_METHOD("get_failed_count"), &ProceduralAnimationBaker::get_failed_count);
+
+	ClassDB::bind_method(D_METHOD("get_bake_key", "animation"), &ProceduralAnimationBaker::get_bake_key);
+}
+
+// S  --------        ProceduralAnimationBakeMainLoop        --------
+
+#if VERSION_MAJOR > 3
+void ProceduralAnimationBakeMainLoop::initialize() {
+	MainLoop::initialize();
+#else
+void ProceduralAnimationBakeMainLoop::init() {
+	MainLoop::init();
+#endif
+
+	List<String> args = OS::get_singleton()->get_cmdline_args();
+
+	String path = "res://";
+
+	for (List<String>::Element *E = args.front(); E; E = E->next()) {
+		if (E->get() == ProceduralAnimationBaker::COMMAND_LINE_FLAG && E->next() && !E->next()->get().begins_with("-")) {
+			path = E->next()->get();
+		}
+	}
+
+	Ref<ProceduralAnimationBaker> baker;
+	baker.instance();
+
+	uint64_t start = OS::get_singleton()->get_ticks_msec();
+	int baked = baker->bake_directory(path);
+
+	print_line("ProceduralAnimationBaker: Baked " + itos(baked) + " resource(s) in " + itos(OS::get_singleton()->get_ticks_msec() - start) + " ms.");
+
+	int failed = baker->get_failed_count();
+
+	if (failed > 0) {
+		ERR_PRINT("ProceduralAnimationBaker: " + itos(failed) + " resource(s) or directories failed.");
+		OS::get_singleton()->set_exit_code(1);
+	}
+}
+
+#if VERSION_MAJOR > 3
+bool ProceduralAnimationBakeMainLoop::process(float p_time) {
+#else
+bool ProceduralAnimationBakeMainLoop::idle(float p_time) {
+#endif
+	return true;
+}
+
+bool ProceduralAnimationBakeMainLoop::requested_from_command_line() {
+	List<String> args = OS::get_singleton()->get_cmdline_args();
+
+	return args.find(ProceduralAnimationBaker::COMMAND_LINE_FLAG) != NULL;
+}
+
+ProceduralAnimationBakeMainLoop::ProceduralAnimationBakeMainLoop() {
+}
+
+ProceduralAnimationBakeMainLoop::~ProceduralAnimationBakeMainLoop() {
+}
+
+void ProceduralAnimationBakeMainLoop::_bind_methods() {
+}
+
+// E  --------        ProceduralAnimationBakeMainLoop        --------
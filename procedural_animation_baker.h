@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef PROCEDURAL_ANIMATION_BAKER_H
+#define PROCEDURAL_ANIMATION_BAKER_H
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/object/reference.h"
+#include "core/templates/vector.h"
+#else
+#include "core/reference.h"
+#include "core/vector.h"
+#endif
+
+#include "core/os/main_loop.h"
+
+#include "procedural_animation.h"
+
+//Rebakes every ProceduralAnimation under a directory. Bakes run in parallel, and the results are
+//saved back into the resources. A cache file remembers the graph + source hash of every baked
+//resource, so unchanged resources are skipped on the next run.
+class ProceduralAnimationBaker : public Reference {
+	GDCLASS(ProceduralAnimationBaker, Reference);
+
+public:
+	static const char *COMMAND_LINE_FLAG;
+
+	int get_thread_count() const;
+	void set_thread_count(const int value);
+
+	bool get_use_cache() const;
+	void set_use_cache(const bool value);
+
+	String get_cache_path() const;
+	void set_cache_path(const String &value);
+
+	int bake_directory(const String &path, const bool recursive = true);
+	int bake_files(const PoolVector<String> &paths);
+
+	Error pack_directory(const String &path, const String &library_path, const bool recursive = true);
+
+	//The number of resources (or directories) that could not be loaded or saved by the last bake / pack call
+	int get_failed_count() const;
+
+	String get_bake_key(const Ref<ProceduralAnimation> &animation) const;
+
+	static String get_default_cache_path();
+
+	ProceduralAnimationBaker();
+	~ProceduralAnimationBaker();
+
+protected:
+	struct BakeJob {
+		String path;
+		String key;
+		Ref<ProceduralAnimation> animation;
+	};
+
+	bool _find_resources(const String &path, const bool recursive, Vector<String> *r_paths) const;
+
+	void _bake_job(uint32_t p_index, Vector<BakeJob> *p_jobs);
+	static void _bake_thread_func(void *p_userdata);
+
+	static void _bind_methods();
+
+private:
+	int _thread_count;
+	bool _use_cache;
+	String _cache_path;
+	int _failed_count;
+
+	Vector<BakeJob> *_current_jobs;
+	uint32_t _next_job;
+};
+
+//Used as the main loop when the engine is started with --bake-procedural-animations [path].
+//Bakes, then quits with a non-zero exit code if anything failed.
+class ProceduralAnimationBakeMainLoop : public MainLoop {
+	GDCLASS(ProceduralAnimationBakeMainLoop, MainLoop);
+
+public:
+#if VERSION_MAJOR > 3
+	virtual void initialize();
+	virtual bool process(float p_time);
+#else
+	virtual void init();
+	virtual bool idle(float p_time);
+#endif
+
+	static bool requested_from_command_line();
+
+	ProceduralAnimationBakeMainLoop();
+	~ProceduralAnimationBakeMainLoop();
+
+protected:
+	static void _bind_methods();
+};
+
+#endif
@@ -0,0 +1,532 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "procedural_animation_compact.h"
+
+#include "core/math/math_funcs.h"
+
+namespace {
+
+struct CompactTrackPath {
+	CharString path;
+	int track;
+
+	bool operator<(const CompactTrackPath &other) const {
+		return strcmp(path.get_data(), other.path.get_data()) < 0;
+	}
+};
+
+_FORCE_INLINE_ uint32_t compact_align(const uint32_t offset) {
+	return (offset + 3) & ~static_cast<uint32_t>(3);
+}
+
+_FORCE_INLINE_ uint16_t compact_quantize(const float value, const float min, const float extent) {
+	float n = extent > CMP_EPSILON ? (value - min) / extent : 0;
+
+	return static_cast<uint16_t>(CLAMP(n, 0, 1) * 65535.0 + 0.5);
+}
+
+_FORCE_INLINE_ float compact_dequantize(const uint16_t value, const float min, const float extent) {
+	return min + value * (1.0 / 65535.0) * extent;
+}
+
+//strcmp, but p_b is not zero terminated
+int compact_compare(const char *a, const char *b, const uint32_t b_length) {
+	for (uint32_t i = 0; i < b_length; ++i) {
+		if (a[i] == 0 || a[i] != b[i])
+			return static_cast<unsigned char>(a[i]) - static_cast<unsigned char>(b[i]);
+	}
+
+	return a[b_length] == 0 ? 0 : 1;
+}
+
+} // namespace
+
+//Samples every transform track of animation at the union of their key times.
+//The transition of a key time is taken from the first track that has a key exactly there.
+Vector<uint8_t> ProceduralAnimationCompact::build(const Animation *animation) {
+	Vector<uint8_t> data;
+
+	ERR_FAIL_COND_V(!animation, data);
+
+	Vector<CompactTrackPath> tracks;
+	Vector<float> times;
+
+	for (int i = 0; i < animation->get_track_count(); ++i) {
+		if (animation->track_get_type(i) != Animation::TYPE_TRANSFORM)
+			continue;
+
+		CompactTrackPath tp;
+		tp.path = String(animation->track_get_path(i)).utf8();
+		tp.track = i;
+		tracks.push_back(tp);
+
+		for (int k = 0; k < animation->track_get_key_count(i); ++k) {
+			times.push_back(animation->track_get_key_time(i, k));
+		}
+	}
+
+	tracks.sort();
+	times.sort();
+
+	Vector<float> key_times;
+
+	for (int i = 0; i < times.size(); ++i) {
+		if (key_times.size() == 0 || times[i] - key_times[key_times.size() - 1] > CMP_EPSILON)
+			key_times.push_back(times[i]);
+	}
+
+	uint32_t track_count = tracks.size();
+	uint32_t key_count = key_times.size();
+
+	uint32_t offset = sizeof(Header);
+
+	//One easing table per distinct transition, usually there are only a few
+	Vector<float> transitions;
+	Vector<uint32_t> eases;
+	eases.resize(key_count);
+
+	for (uint32_t k = 0; k < key_count; ++k) {
+		float transition = 1.0;
+
+		for (uint32_t i = 0; i < track_count; ++i) {
+			int key = animation->track_find_key(tracks[i].track, key_times[k], true);
+
+			if (key != -1) {
+				transition = animation->track_get_key_transition(tracks[i].track, key);
+				break;
+			}
+		}
+
+		int index = transitions.find(transition);
+
+		if (index == -1) {
+			index = transitions.size();
+			transitions.push_back(transition);
+		}
+
+		eases.write[k] = index;
+	}
+
+	uint32_t ease_table_count = transitions.size();
+
+	uint32_t times_offset = offset;
+	offset += key_count * sizeof(float);
+
+	uint32_t eases_offset = offset;
+	offset += key_count * sizeof(uint32_t);
+
+	uint32_t ease_tables_offset = offset;
+	offset += ease_table_count * sizeof(ProceduralAnimation::EaseTable);
+
+	uint32_t tracks_offset = offset;
+	offset += track_count * sizeof(Track);
+
+	uint32_t keys_offset = offset;
+	uint32_t keys_size = compact_align(key_count * KEY_SIZE * sizeof(uint16_t));
+	offset += track_count * keys_size;
+
+	uint32_t strings_offset = offset;
+	uint32_t strings_size = 0;
+
+	for (uint32_t i = 0; i < track_count; ++i) {
+		strings_size += tracks[i].path.length() + 1;
+	}
+
+	offset += compact_align(strings_size);
+
+	data.resize(offset);
+	uint8_t *w = data.ptrw();
+	memset(w, 0, offset);
+
+	Header *header = reinterpret_cast<Header *>(w);
+	header->magic = MAGIC;
+	header->version = VERSION;
+	header->size = offset;
+	header->flags = animation->has_loop() ? FLAG_LOOP : 0;
+	header->length = animation->get_length();
+	header->track_count = track_count;
+	header->key_count = key_count;
+	header->times_offset = times_offset;
+	header->eases_offset = eases_offset;
+	header->ease_tables_offset = ease_tables_offset;
+	header->ease_table_count = ease_table_count;
+	header->tracks_offset = tracks_offset;
+	header->strings_offset = strings_offset;
+	header->strings_size = strings_size;
+
+	float *wtimes = reinterpret_cast<float *>(w + times_offset);
+	uint32_t *weases = reinterpret_cast<uint32_t *>(w + eases_offset);
+
+	for (uint32_t k = 0; k < key_count; ++k) {
+		wtimes[k] = key_times[k];
+		weases[k] = eases[k];
+	}
+
+	for (uint32_t i = 0; i < ease_table_count; ++i) {
+		ProceduralAnimation::EaseTable table;
+		table.build(transitions[i]);
+
+		memcpy(w + ease_tables_offset + i * sizeof(ProceduralAnimation::EaseTable), &table, sizeof(ProceduralAnimation::EaseTable));
+	}
+
+	Vector<Vector3> locations;
+	Vector<Quat> rotations;
+	Vector<Vector3> scales;
+	locations.resize(key_count);
+	rotations.resize(key_count);
+	scales.resize(key_count);
+
+	uint32_t path_offset = 0;
+
+	for (uint32_t i = 0; i < track_count; ++i) {
+		Track *track = reinterpret_cast<Track *>(w + tracks_offset) + i;
+
+		track->path_offset = path_offset;
+		track->path_length = tracks[i].path.length();
+		track->keys_offset = keys_offset + i * keys_size;
+
+		memcpy(w + strings_offset + path_offset, tracks[i].path.get_data(), track->path_length);
+		path_offset += track->path_length + 1;
+
+		Vector3 lmin;
+		Vector3 lmax;
+		Vector3 smin;
+		Vector3 smax;
+
+		for (uint32_t k = 0; k < key_count; ++k) {
+			Vector3 loc;
+			Quat rot;
+			Vector3 scale(1, 1, 1);
+
+			animation->transform_track_interpolate(tracks[i].track, key_times[k], &loc, &rot, &scale);
+
+			locations.write[k] = loc;
+			rotations.write[k] = rot;
+			scales.write[k] = scale;
+
+			if (k == 0) {
+				lmin = lmax = loc;
+				smin = smax = scale;
+			} else {
+				for (int c = 0; c < 3; ++c) {
+					lmin[c] = MIN(lmin[c], loc[c]);
+					lmax[c] = MAX(lmax[c], loc[c]);
+					smin[c] = MIN(smin[c], scale[c]);
+					smax[c] = MAX(smax[c], scale[c]);
+				}
+			}
+		}
+
+		for (int c = 0; c < 3; ++c) {
+			track->location_min[c] = lmin[c];
+			track->location_extent[c] = lmax[c] - lmin[c];
+			track->scale_min[c] = smin[c];
+			track->scale_extent[c] = smax[c] - smin[c];
+		}
+
+		uint16_t *keys = reinterpret_cast<uint16_t *>(w + track->keys_offset);
+
+		for (uint32_t k = 0; k < key_count; ++k) {
+			uint16_t *key = keys + k * KEY_SIZE;
+
+			for (int c = 0; c < 3; ++c) {
+				key[c] = compact_quantize(locations[k][c], track->location_min[c], track->location_extent[c]);
+				key[6 + c] = compact_quantize(scales[k][c], track->scale_min[c], track->scale_extent[c]);
+			}
+
+			encode_rotation(rotations[k], key + 3);
+		}
+	}
+
+	return data;
+}
+
+//Checks that every offset of the blob points inside of it. Data that comes from a file should be
+//validated once before any of the other methods are used on it.
+bool ProceduralAnimationCompact::validate(const uint8_t *data, const uint32_t size) {
+	ERR_FAIL_COND_V(!data, false);
+	ERR_FAIL_COND_V_MSG(size < sizeof(Header), false, "ProceduralAnimationCompact: data is too small.");
+
+	const Header *header = reinterpret_cast<const Header *>(data);
+
+	ERR_FAIL_COND_V_MSG(header->magic != MAGIC, false, "ProceduralAnimationCompact: invalid data.");
+	ERR_FAIL_COND_V_MSG(header->version != VERSION, false, "ProceduralAnimationCompact: unsupported version, the animation needs to be baked again.");
+	ERR_FAIL_COND_V(header->size > size, false);
+
+	uint64_t key_count = header->key_count;
+	uint64_t track_count = header->track_count;
+
+	ERR_FAIL_COND_V(header->times_offset + key_count * sizeof(float) > header->size, false);
+	ERR_FAIL_COND_V(header->eases_offset + key_count * sizeof(uint32_t) > header->size, false);
+	ERR_FAIL_COND_V(header->ease_tables_offset + static_cast<uint64_t>(header->ease_table_count) * sizeof(ProceduralAnimation::EaseTable) > header->size, false);
+	ERR_FAIL_COND_V(header->tracks_offset + track_count * sizeof(Track) > header->size, false);
+	ERR_FAIL_COND_V(static_cast<uint64_t>(header->strings_offset) + header->strings_size > header->size, false);
+	ERR_FAIL_COND_V((header->times_offset | header->eases_offset | header->ease_tables_offset | header->tracks_offset) & 3, false);
+
+	const uint32_t *eases = reinterpret_cast<const uint32_t *>(data + header->eases_offset);
+
+	for (uint32_t k = 0; k < header->key_count; ++k) {
+		ERR_FAIL_COND_V(eases[k] >= header->ease_table_count, false);
+	}
+
+	for (uint32_t i = 0; i < header->track_count; ++i) {
+		const Track *track = get_track(data, i);
+
+		ERR_FAIL_COND_V(static_cast<uint64_t>(track->path_offset) + track->path_length >= header->strings_size, false);
+		ERR_FAIL_COND_V(track->keys_offset + key_count * KEY_SIZE * sizeof(uint16_t) > header->size, false);
+		ERR_FAIL_COND_V(track->keys_offset & 1, false);
+	}
+
+	return true;
+}
+
+const ProceduralAnimationCompact::Header *ProceduralAnimationCompact::get_header(const uint8_t *data) {
+	return reinterpret_cast<const Header *>(data);
+}
+
+const ProceduralAnimationCompact::Track *ProceduralAnimationCompact::get_track(const uint8_t *data, const int track) {
+	return reinterpret_cast<const Track *>(data + get_header(data)->tracks_offset) + track;
+}
+
+String ProceduralAnimationCompact::get_track_path(const uint8_t *data, const int track) {
+	const Header *header = get_header(data);
+
+	ERR_FAIL_INDEX_V(track, static_cast<int>(header->track_count), String());
+
+	const Track *t = get_track(data, track);
+
+	String path;
+	path.parse_utf8(reinterpret_cast<const char *>(data + header->strings_offset + t->path_offset), t->path_length);
+
+	return path;
+}
+
+int ProceduralAnimationCompact::find_track(const uint8_t *data, const String &path) {
+	const Header *header = get_header(data);
+	const char *strings = reinterpret_cast<const char *>(data + header->strings_offset);
+
+	CharString cs = path.utf8();
+	const char *p = cs.get_data();
+
+	int lo = 0;
+	int hi = static_cast<int>(header->track_count) - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) >> 1;
+		const Track *t = get_track(data, mid);
+
+		int c = compact_compare(p, strings + t->path_offset, t->path_length);
+
+		if (c == 0)
+			return mid;
+
+		if (c < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+
+	return -1;
+}
+
+//Same rules as the baked tracks: after the last key it moves towards the first one when looping,
+//otherwise it holds the last key.
+bool ProceduralAnimationCompact::find_keys(const uint8_t *data, const float time, int *r_key, int *r_next, float *r_weight) {
+	const Header *header = get_header(data);
+
+	int key_count = header->key_count;
+
+	if (key_count == 0)
+		return false;
+
+	const float *times = reinterpret_cast<const float *>(data + header->times_offset);
+	const uint32_t *eases = reinterpret_cast<const uint32_t *>(data + header->eases_offset);
+	const ProceduralAnimation::EaseTable *ease_tables = reinterpret_cast<const ProceduralAnimation::EaseTable *>(data + header->ease_tables_offset);
+
+	bool loop = (header->flags & FLAG_LOOP) != 0;
+	float length = header->length;
+
+	float t = time;
+
+	if (loop && length > 0)
+		t = Math::fposmod(t, length);
+	else
+		t = CLAMP(t, 0, length);
+
+	int last = key_count - 1;
+
+	if (t < times[0]) {
+		if (!loop) {
+			*r_key = 0;
+			*r_next = 0;
+			*r_weight = 0;
+			return true;
+		}
+
+		float delta = length - times[last] + times[0];
+
+		*r_key = last;
+		*r_next = 0;
+		*r_weight = delta > CMP_EPSILON ? ease_tables[eases[last]].sample((t + length - times[last]) / delta) : 0;
+		return true;
+	}
+
+	int lo = 0;
+	int hi = last;
+
+	while (lo < hi) {
+		int mid = (lo + hi + 1) >> 1;
+
+		if (times[mid] <= t)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	*r_key = lo;
+
+	if (lo == last) {
+		float delta = length - times[last] + times[0];
+
+		if (!loop || delta <= CMP_EPSILON) {
+			*r_next = lo;
+			*r_weight = 0;
+			return true;
+		}
+
+		*r_next = 0;
+		*r_weight = ease_tables[eases[last]].sample((t - times[last]) / delta);
+		return true;
+	}
+
+	float delta = times[lo + 1] - times[lo];
+
+	*r_next = lo + 1;
+	*r_weight = delta > CMP_EPSILON ? ease_tables[eases[lo]].sample((t - times[lo]) / delta) : 0;
+
+	return true;
+}
+
+void ProceduralAnimationCompact::sample_track(const uint8_t *data, const int track, const int key, const int next, const float weight, Vector3 *r_loc, Quat *r_rot, Vector3 *r_scale) {
+	const Track *t = get_track(data, track);
+	const uint16_t *keys = reinterpret_cast<const uint16_t *>(data + t->keys_offset);
+
+	const uint16_t *a = keys + key * KEY_SIZE;
+	const uint16_t *b = keys + next * KEY_SIZE;
+
+	if (r_loc) {
+		for (int c = 0; c < 3; ++c) {
+			float va = compact_dequantize(a[c], t->location_min[c], t->location_extent[c]);
+			float vb = compact_dequantize(b[c], t->location_min[c], t->location_extent[c]);
+
+			(*r_loc)[c] = va + (vb - va) * weight;
+		}
+	}
+
+	if (r_rot) {
+		Quat ra = decode_rotation(a + 3);
+
+		if (key == next || weight <= 0)
+			*r_rot = ra;
+		else
+			*r_rot = ra.slerp(decode_rotation(b + 3), weight);
+	}
+
+	if (r_scale) {
+		for (int c = 0; c < 3; ++c) {
+			float va = compact_dequantize(a[6 + c], t->scale_min[c], t->scale_extent[c]);
+			float vb = compact_dequantize(b[6 + c], t->scale_min[c], t->scale_extent[c]);
+
+			(*r_scale)[c] = va + (vb - va) * weight;
+		}
+	}
+}
+
+bool ProceduralAnimationCompact::sample(const uint8_t *data, const int track, const float time, Vector3 *r_loc, Quat *r_rot, Vector3 *r_scale) {
+	ERR_FAIL_INDEX_V(track, static_cast<int>(get_header(data)->track_count), false);
+
+	int key;
+	int next;
+	float weight;
+
+	if (!find_keys(data, time, &key, &next, &weight))
+		return false;
+
+	sample_track(data, track, key, next, weight, r_loc, r_rot, r_scale);
+
+	return true;
+}
+
+//Smallest three: the largest component is left out, and recomputed from the other three, which are
+//all in [-1/sqrt(2), 1/sqrt(2)]. They get 15 bits each, the index of the left out component 2 more.
+void ProceduralAnimationCompact::encode_rotation(const Quat &rotation, uint16_t *r_values) {
+	Quat q = rotation.normalized();
+	float c[4] = { q.x, q.y, q.z, q.w };
+
+	int largest = 0;
+
+	for (int i = 1; i < 4; ++i) {
+		if (Math::abs(c[i]) > Math::abs(c[largest]))
+			largest = i;
+	}
+
+	//q and -q are the same rotation, the left out component is always made positive
+	float sign = c[largest] < 0 ? -1 : 1;
+
+	int j = 0;
+
+	for (int i = 0; i < 4; ++i) {
+		if (i == largest)
+			continue;
+
+		float n = CLAMP(c[i] * sign * Math_SQRT2 * 0.5 + 0.5, 0, 1);
+
+		r_values[j++] = static_cast<uint16_t>(n * 32767.0 + 0.5);
+	}
+
+	r_values[0] |= (largest & 1) << 15;
+	r_values[1] |= (largest >> 1) << 15;
+}
+
+Quat ProceduralAnimationCompact::decode_rotation(const uint16_t *values) {
+	int largest = (values[0] >> 15) | ((values[1] >> 15) << 1);
+
+	float c[4];
+	float sum = 0;
+	int j = 0;
+
+	for (int i = 0; i < 4; ++i) {
+		if (i == largest)
+			continue;
+
+		float n = (values[j++] & 0x7FFF) * (1.0 / 32767.0);
+
+		c[i] = (n * 2.0 - 1.0) * Math_SQRT12;
+		sum += c[i] * c[i];
+	}
+
+	c[largest] = Math::sqrt(MAX(0, 1.0 - sum));
+
+	return Quat(c[0], c[1], c[2], c[3]);
+}
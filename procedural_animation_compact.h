@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef PROCEDURAL_ANIMATION_COMPACT_H
+#define PROCEDURAL_ANIMATION_COMPACT_H
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/templates/vector.h"
+#else
+#include "core/vector.h"
+#endif
+
+#include "core/math/quat.h"
+#include "core/math/vector3.h"
+#include "scene/resources/animation.h"
+
+#include "procedural_animation.h"
+
+//Compact runtime format of the baked transform tracks, one contiguous blob that only uses offsets
+//relative to its start, so it can be saved, loaded, or mapped as it is.
+//Every track has a key at every key time, so finding the keys for a time is one binary search for all tracks.
+//A key is 9 16 bit values: location xyz and scale xyz relative to the range of the track,
+//and the rotation as the smallest three components of the quaternion, the index of the largest
+//one is stored in the top bits of the first two.
+//Every key time points to one of the easing tables stored in the blob (ProceduralAnimation::EaseTable),
+//so sampling doesn't need pow().
+//The blob is written in native byte order.
+class ProceduralAnimationCompact {
+public:
+	enum {
+		MAGIC = 0x43415050, //PPAC
+		VERSION = 2,
+		KEY_SIZE = 9,
+	};
+
+	enum Flags {
+		FLAG_LOOP = 1,
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t size;
+		uint32_t flags;
+		float length;
+		uint32_t track_count;
+		uint32_t key_count;
+		uint32_t times_offset;
+		uint32_t eases_offset;
+		uint32_t ease_tables_offset;
+		uint32_t ease_table_count;
+		uint32_t tracks_offset;
+		uint32_t strings_offset;
+		uint32_t strings_size;
+	};
+
+	//Tracks are sorted by path, so find_track() can use a binary search.
+	//path_offset is relative to strings_offset, keys_offset to the start of the blob.
+	struct Track {
+		uint32_t path_offset;
+		uint32_t path_length;
+		uint32_t keys_offset;
+		float location_min[3];
+		float location_extent[3];
+		float scale_min[3];
+		float scale_extent[3];
+	};
+
+	static Vector<uint8_t> build(const Animation *animation);
+	static bool validate(const uint8_t *data, const uint32_t size);
+
+	static const Header *get_header(const uint8_t *data);
+	static const Track *get_track(const uint8_t *data, const int track);
+	static String get_track_path(const uint8_t *data, const int track);
+	static int find_track(const uint8_t *data, const String &path);
+
+	//The key pair and the eased weight for time, shared by every track.
+	static bool find_keys(const uint8_t *data, const float time, int *r_key, int *r_next, float *r_weight);
+	static void sample_track(const uint8_t *data, const int track, const int key, const int next, const float weight, Vector3 *r_loc, Quat *r_rot, Vector3 *r_scale);
+	static bool sample(const uint8_t *data, const int track, const float time, Vector3 *r_loc, Quat *r_rot, Vector3 *r_scale);
+
+	static void encode_rotation(const Quat &rotation, uint16_t *r_values);
+	static Quat decode_rotation(const uint16_t *values);
+};
+
+#endif
@@ -0,0 +1,910 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "procedural_animation_crowd_evaluator.h"
+
+Ref<ProceduralAnimation> ProceduralAnimationCrowdEvaluator::get_procedural_animation() const {
+	return _procedural_animation;
+}
+void ProceduralAnimationCrowdEvaluator::set_procedural_animation(const Ref<ProceduralAnimation> &value) {
+	_procedural_animation = value;
+
+	update_data();
+}
+
+int ProceduralAnimationCrowdEvaluator::get_track_count() const {
+	return _track_paths.size();
+}
+NodePath ProceduralAnimationCrowdEvaluator::get_track_path(const int track) const {
+	ERR_FAIL_INDEX_V(track, _track_paths.size(), NodePath());
+
+	return _track_paths[track];
+}
+int ProceduralAnimationCrowdEvaluator::find_track(const NodePath &path) const {
+	return _track_paths.find(path);
+}
+
+int ProceduralAnimationCrowdEvaluator::get_instance_count() const {
+	return _instance_count;
+}
+
+int ProceduralAnimationCrowdEvaluator::get_lod_count() const {
+	return _lod_levels.size();
+}
+void ProceduralAnimationCrowdEvaluator::set_lod_count(const int value) {
+	//Levels are resolved into uint8_t per instance in evaluate()
+	ERR_FAIL_COND(value < 0 || value > 256);
+
+	_lod_levels.resize(value);
+
+	_update_lod_masks();
+}
+
+PoolVector<String> ProceduralAnimationCrowdEvaluator::get_lod_track_filter(const int lod) const {
+	ERR_FAIL_INDEX_V(lod, _lod_levels.size(), PoolVector<String>());
+
+	return _lod_levels[lod].track_filter;
+}
+void ProceduralAnimationCrowdEvaluator::set_lod_track_filter(const int lod, const PoolVector<String> &value) {
+	ERR_FAIL_INDEX(lod, _lod_levels.size());
+
+	_lod_levels.write[lod].track_filter = value;
+
+	_update_lod_masks();
+}
+
+float ProceduralAnimationCrowdEvaluator::get_lod_update_interval(const int lod) const {
+	ERR_FAIL_INDEX_V(lod, _lod_levels.size(), 0);
+
+	return _lod_levels[lod].update_interval;
+}
+void ProceduralAnimationCrowdEvaluator::set_lod_update_interval(const int lod, const float value) {
+	ERR_FAIL_INDEX(lod, _lod_levels.size());
+
+	_lod_levels.write[lod].update_interval = value;
+}
+
+float ProceduralAnimationCrowdEvaluator::get_lod_min_segment_duration(const int lod) const {
+	ERR_FAIL_INDEX_V(lod, _lod_levels.size(), 0);
+
+	return _lod_levels[lod].min_segment_duration;
+}
+void ProceduralAnimationCrowdEvaluator::set_lod_min_segment_duration(const int lod, const float value) {
+	ERR_FAIL_INDEX(lod, _lod_levels.size());
+
+	_lod_levels.write[lod].min_segment_duration = value;
+}
+
+PoolVector<int> ProceduralAnimationCrowdEvaluator::get_instance_lods() const {
+	return _instance_lods;
+}
+void ProceduralAnimationCrowdEvaluator::set_instance_lods(const PoolVector<int> &value) {
+	_instance_lods = value;
+}
+
+//Caches the source pose of every chain key for every transform track.
+//Has to be called again if the ProceduralAnimation changes.
+void ProceduralAnimationCrowdEvaluator::update_data() {
+	if (_instance_count > 0) {
+		_last_track_paths = _track_paths;
+		_last_instance_count = _instance_count;
+
+		for (int c = 0; c < CHANNEL_COUNT; ++c) {
+			_last_channels[c] = _output_channels[c];
+		}
+	}
+
+	_track_paths.clear();
+	_key_times.clear();
+	_key_durations.clear();
+	_key_ease.clear();
+	_ease_tables.clear();
+	_key_count = 0;
+	_length = 0;
+	_loop = false;
+
+	for (int c = 0; c < CHANNEL_COUNT; ++c) {
+		_key_channels[c].clear();
+	}
+
+	//forces the output buffers to be resized on the next evaluate()
+	_instance_count = 0;
+
+	if (!_procedural_animation.is_valid())
+		return;
+
+	Ref<Animation> source = _procedural_animation->get_animation();
+
+	if (!source.is_valid())
+		return;
+
+	_key_count = _procedural_animation->get_segment_count();
+	_loop = _procedural_animation->has_loop();
+
+	Vector<int> source_tracks;
+
+	for (int i = 0; i < source->get_track_count(); ++i) {
+		if (source->track_get_type(i) != Animation::TYPE_TRANSFORM)
+			continue;
+
+		NodePath path = source->track_get_path(i);
+
+		if (!_procedural_animation->is_track_path_allowed(path, Animation::TYPE_TRANSFORM))
+			continue;
+
+		source_tracks.push_back(i);
+		_track_paths.push_back(path);
+	}
+
+	//Pose blending is resolved here, so evaluate() still only interpolates between two poses per key
+	Vector<int> frames;
+	Vector<int> blend_frames;
+	Vector<float> blend_weights;
+	frames.resize(_key_count);
+	blend_frames.resize(_key_count);
+	blend_weights.resize(_key_count);
+	_key_times.resize(_key_count);
+	_key_durations.resize(_key_count);
+	_key_ease.resize(_key_count);
+
+	for (int k = 0; k < _key_count; ++k) {
+		const ProceduralAnimation::Segment &segment = _procedural_animation->get_segment(k);
+
+		frames.write[k] = segment.source_frame;
+		blend_frames.write[k] = segment.blend_source_frame;
+		blend_weights.write[k] = segment.blend_weight;
+		_key_times.write[k] = segment.start_time;
+		_key_durations.write[k] = segment.duration;
+		_key_ease.write[k] = _find_or_add_ease_table(_procedural_animation->get_ease_table(segment.ease_table));
+	}
+
+	_length = _procedural_animation->get_graph_length();
+
+	int track_count = source_tracks.size();
+
+	for (int c = 0; c < CHANNEL_COUNT; ++c) {
+		_key_channels[c].resize(track_count * _key_count);
+	}
+
+	for (int t = 0; t < track_count; ++t) {
+		int source_track = source_tracks[t];
+
+		Vector3 loc;
+		Quat rot;
+		Vector3 scale(1, 1, 1);
+
+		for (int k = 0; k < _key_count; ++k) {
+			int key = _procedural_animation->find_source_key(source_track, frames[k]);
+
+			//The baked track just doesn't get a key here, the closest thing to that is holding the previous pose.
+			if (key != -1) {
+				source->transform_track_get_key(source_track, key, &loc, &rot, &scale);
+
+				int blend_key = -1;
+
+				if (blend_frames[k] != -1)
+					blend_key = _procedural_animation->find_source_key(source_track, blend_frames[k]);
+
+				if (blend_key != -1) {
+					Vector3 blend_loc;
+					Quat blend_rot;
+					Vector3 blend_scale;
+
+					source->transform_track_get_key(source_track, blend_key, &blend_loc, &blend_rot, &blend_scale);
+
+					loc = loc.linear_interpolate(blend_loc, blend_weights[k]);
+					rot = rot.slerp(blend_rot, blend_weights[k]);
+					scale = scale.linear_interpolate(blend_scale, blend_weights[k]);
+				}
+			}
+
+			int idx = t * _key_count + k;
+
+			_key_channels[CHANNEL_LOCATION_X].write[idx] = loc.x;
+			_key_channels[CHANNEL_LOCATION_Y].write[idx] = loc.y;
+			_key_channels[CHANNEL_LOCATION_Z].write[idx] = loc.z;
+			_key_channels[CHANNEL_ROTATION_X].write[idx] = rot.x;
+			_key_channels[CHANNEL_ROTATION_Y].write[idx] = rot.y;
+			_key_channels[CHANNEL_ROTATION_Z].write[idx] = rot.z;
+			_key_channels[CHANNEL_ROTATION_W].write[idx] = rot.w;
+			_key_channels[CHANNEL_SCALE_X].write[idx] = scale.x;
+			_key_channels[CHANNEL_SCALE_Y].write[idx] = scale.y;
+			_key_channels[CHANNEL_SCALE_Z].write[idx] = scale.z;
+		}
+	}
+
+	_update_lod_masks();
+}
+
+void ProceduralAnimationCrowdEvaluator::evaluate(const PoolVector<real_t> &times) {
+	int instance_count = times.size();
+	int track_count = _track_paths.size();
+
+	if (instance_count != _instance_count)
+		_resize_instances(instance_count);
+
+	if (_key_count == 0 || instance_count == 0)
+		return;
+
+#if VERSION_MAJOR > 3
+	const real_t *tp = times.ptr();
+#else
+	PoolVector<real_t>::Read tr = times.read();
+	const real_t *tp = tr.ptr();
+#endif
+
+	_resolve_instance_lods(instance_count);
+	const uint8_t *instance_lods = _resolved_lods.ptr();
+
+	int *eval_instance = _eval_instance.ptrw();
+	float *eval_time = _eval_time.ptrw();
+	uint8_t *eval_to_target = _eval_to_target.ptrw();
+	int *interp_instance = _interp_instance.ptrw();
+	float *interp_alpha = _interp_alpha.ptrw();
+	float *last_update = _instance_last_update.ptrw();
+
+	_eval_count = 0;
+	_interp_count = 0;
+
+	//Sort instances into the ones that need a real evaluation, and the ones that only interpolate.
+	//eval_to_target: 0 -> output, 1 -> target, 2 -> first update, target and start
+	for (int i = 0; i < instance_count; ++i) {
+		float time = _wrap_time(tp[i]);
+		int lod = instance_lods[i];
+		float interval = lod < _lod_levels.size() ? _lod_levels[lod].update_interval : 0;
+
+		if (interval <= 0) {
+			eval_instance[_eval_count] = i;
+			eval_time[_eval_count] = time;
+			eval_to_target[_eval_count] = 0;
+			++_eval_count;
+
+			last_update[i] = -1;
+			continue;
+		}
+
+		float since = time - last_update[i];
+
+		if (last_update[i] < 0 || since < 0 || since >= interval) {
+			eval_instance[_eval_count] = i;
+			eval_time[_eval_count] = _wrap_time(time + interval);
+			eval_to_target[_eval_count] = last_update[i] < 0 ? 2 : 1;
+			++_eval_count;
+
+			last_update[i] = time;
+			since = 0;
+		}
+
+		interp_instance[_interp_count] = i;
+		interp_alpha[_interp_count] = since / interval;
+		++_interp_count;
+	}
+
+	const float *key_times = _key_times.ptr();
+	const float *key_durations = _key_durations.ptr();
+	const int *key_ease = _key_ease.ptr();
+	const ProceduralAnimation::EaseTable *ease_tables = _ease_tables.ptr();
+
+	int *from = _eval_from.ptrw();
+	int *to = _eval_to.ptrw();
+	float *weight = _eval_weight.ptrw();
+
+	//Segment lookup, once per evaluated instance, shared by every track
+	for (int j = 0; j < _eval_count; ++j) {
+		float time = eval_time[j];
+		int lod = instance_lods[eval_instance[j]];
+
+		int k = _find_key(time);
+		int next = k + 1;
+
+		if (next >= _key_count)
+			next = _loop ? 0 : k;
+
+		//Short segments are skipped on this level, the instance is already at the next key's pose.
+		if (lod < _lod_levels.size() && key_durations[k] < _lod_levels[lod].min_segment_duration) {
+			from[j] = next;
+			to[j] = next;
+			weight[j] = 0;
+			continue;
+		}
+
+		float c = 0;
+
+		if (key_durations[k] > CMP_EPSILON)
+			c = CLAMP((time - key_times[k]) / key_durations[k], 0, 1);
+
+		from[j] = k;
+		to[j] = next;
+		weight[j] = ease_tables[key_ease[k]].sample(c);
+	}
+
+	static const Channel linear_channels[6] = {
+		CHANNEL_LOCATION_X, CHANNEL_LOCATION_Y, CHANNEL_LOCATION_Z,
+		CHANNEL_SCALE_X, CHANNEL_SCALE_Y, CHANNEL_SCALE_Z
+	};
+
+	float *ga[4];
+	float *gb[4];
+	float *gr[4];
+
+	for (int j = 0; j < 4; ++j) {
+		ga[j] = _gather_a[j].ptrw();
+		gb[j] = _gather_b[j].ptrw();
+		gr[j] = _gather_r[j].ptrw();
+	}
+
+	float *output[CHANNEL_COUNT];
+	float *start[CHANNEL_COUNT];
+	float *target[CHANNEL_COUNT];
+	float *evaluated[CHANNEL_COUNT];
+
+	for (int c = 0; c < CHANNEL_COUNT; ++c) {
+		output[c] = _output_channels[c].ptrw();
+		start[c] = _start_channels[c].ptrw();
+		target[c] = _target_channels[c].ptrw();
+		evaluated[c] = _eval_channels[c].ptrw();
+	}
+
+	//Which LOD levels are used this frame, a track that none of them evaluates is skipped entirely.
+	int lod_count = MAX(_lod_levels.size(), 1);
+	_lods_used.resize(lod_count * 2);
+	uint8_t *eval_lods = _lods_used.ptrw();
+	uint8_t *interp_lods = eval_lods + lod_count;
+
+	for (int l = 0; l < lod_count; ++l) {
+		eval_lods[l] = 0;
+		interp_lods[l] = 0;
+	}
+
+	for (int j = 0; j < _eval_count; ++j) {
+		eval_lods[instance_lods[eval_instance[j]]] = 1;
+	}
+
+	for (int j = 0; j < _interp_count; ++j) {
+		interp_lods[instance_lods[interp_instance[j]]] = 1;
+	}
+
+	for (int t = 0; t < track_count; ++t) {
+		bool eval_needed = false;
+		bool interp_needed = false;
+
+		for (int l = 0; l < lod_count; ++l) {
+			if (_is_track_active(l, t)) {
+				eval_needed = eval_needed || eval_lods[l];
+				interp_needed = interp_needed || interp_lods[l];
+			}
+		}
+
+		//Evaluate the keyframe segments of the instances that need it
+		if (eval_needed) {
+			int key_offset = t * _key_count;
+			int eval_offset = t * _eval_count;
+
+			for (int c = 0; c < 6; ++c) {
+				Channel channel = linear_channels[c];
+				const float *kc = _key_channels[channel].ptr() + key_offset;
+
+				for (int j = 0; j < _eval_count; ++j) {
+					ga[0][j] = kc[from[j]];
+					gb[0][j] = kc[to[j]];
+				}
+
+				_lerp_kernel(ga[0], gb[0], weight, evaluated[channel] + eval_offset, _eval_count);
+			}
+
+			float *r[4];
+
+			for (int q = 0; q < 4; ++q) {
+				const float *kc = _key_channels[CHANNEL_ROTATION_X + q].ptr() + key_offset;
+
+				for (int j = 0; j < _eval_count; ++j) {
+					ga[q][j] = kc[from[j]];
+					gb[q][j] = kc[to[j]];
+				}
+
+				r[q] = evaluated[CHANNEL_ROTATION_X + q] + eval_offset;
+			}
+
+			_nlerp_kernel(ga, gb, weight, r, _eval_count);
+
+			for (int j = 0; j < _eval_count; ++j) {
+				int i = eval_instance[j];
+
+				if (!_is_track_active(instance_lods[i], t))
+					continue;
+
+				int src = eval_offset + j;
+				int dst = t * instance_count + i;
+
+				if (eval_to_target[j] == 0) {
+					for (int c = 0; c < CHANNEL_COUNT; ++c) {
+						output[c][dst] = evaluated[c][src];
+					}
+				} else {
+					for (int c = 0; c < CHANNEL_COUNT; ++c) {
+						start[c][dst] = eval_to_target[j] == 2 ? evaluated[c][src] : output[c][dst];
+						target[c][dst] = evaluated[c][src];
+					}
+				}
+			}
+		}
+
+		//Interpolate the instances that are between two updates
+		if (interp_needed) {
+			int offset = t * instance_count;
+
+			for (int c = 0; c < 6; ++c) {
+				Channel channel = linear_channels[c];
+
+				for (int j = 0; j < _interp_count; ++j) {
+					ga[0][j] = start[channel][offset + interp_instance[j]];
+					gb[0][j] = target[channel][offset + interp_instance[j]];
+				}
+
+				_lerp_kernel(ga[0], gb[0], interp_alpha, gr[0], _interp_count);
+
+				for (int j = 0; j < _interp_count; ++j) {
+					int i = interp_instance[j];
+
+					if (_is_track_active(instance_lods[i], t))
+						output[channel][offset + i] = gr[0][j];
+				}
+			}
+
+			for (int q = 0; q < 4; ++q) {
+				for (int j = 0; j < _interp_count; ++j) {
+					ga[q][j] = start[CHANNEL_ROTATION_X + q][offset + interp_instance[j]];
+					gb[q][j] = target[CHANNEL_ROTATION_X + q][offset + interp_instance[j]];
+				}
+			}
+
+			_nlerp_kernel(ga, gb, interp_alpha, gr, _interp_count);
+
+			for (int j = 0; j < _interp_count; ++j) {
+				int i = interp_instance[j];
+
+				if (!_is_track_active(instance_lods[i], t))
+					continue;
+
+				for (int q = 0; q < 4; ++q) {
+					output[CHANNEL_ROTATION_X + q][offset + i] = gr[q][j];
+				}
+			}
+		}
+	}
+
+	if (_fading)
+		_apply_crossfade(tp, instance_count);
+}
+
+//Switches to animation, and blends from the current pose of every instance to the new animation's pose
+//over duration. The times passed to evaluate() are the new animation's, so they should restart from 0,
+//and they are also the clock of the fade. Only the source poses are used, no transition has to be baked.
+void ProceduralAnimationCrowdEvaluator::crossfade_to(const Ref<ProceduralAnimation> &animation, const float duration) {
+	stop_crossfade();
+
+	//update_data() keeps the last evaluated pose, even if it was already called since the last evaluate()
+	set_procedural_animation(animation);
+
+	const Vector<NodePath> &from_paths = _last_track_paths;
+	int from_instance_count = _last_instance_count;
+	const Vector<float> *from_channels = _last_channels;
+
+	if (duration <= 0)
+		return;
+
+	if (from_instance_count == 0) {
+		WARN_PRINT("ProceduralAnimationCrowdEvaluator: crossfade_to() was called before anything was evaluated, switching without a cross-fade.");
+		return;
+	}
+
+	int track_count = _track_paths.size();
+
+	_fade_track_valid.resize(track_count);
+
+	for (int c = 0; c < CHANNEL_COUNT; ++c) {
+		_fade_channels[c].resize(track_count * from_instance_count);
+	}
+
+	for (int t = 0; t < track_count; ++t) {
+		int from_track = from_paths.find(_track_paths[t]);
+
+		//Tracks that are new start at the new animation's pose
+		_fade_track_valid.write[t] = from_track != -1 ? 1 : 0;
+
+		if (from_track == -1)
+			continue;
+
+		for (int c = 0; c < CHANNEL_COUNT; ++c) {
+			const float *src = from_channels[c].ptr() + from_track * from_instance_count;
+			float *dst = _fade_channels[c].ptrw() + t * from_instance_count;
+
+			for (int i = 0; i < from_instance_count; ++i) {
+				dst[i] = src[i];
+			}
+		}
+	}
+
+	_fading = true;
+	_fade_duration = duration;
+	_fade_instance_count = from_instance_count;
+}
+
+void ProceduralAnimationCrowdEvaluator::stop_crossfade() {
+	_fading = false;
+	_fade_duration = 0;
+	_fade_instance_count = 0;
+	_fade_track_valid.clear();
+	_fade_weights.clear();
+
+	for (int c = 0; c < CHANNEL_COUNT; ++c) {
+		_fade_channels[c].clear();
+	}
+}
+
+bool ProceduralAnimationCrowdEvaluator::is_crossfading() const {
+	return _fading;
+}
+
+float ProceduralAnimationCrowdEvaluator::get_crossfade_duration() const {
+	return _fade_duration;
+}
+
+void ProceduralAnimationCrowdEvaluator::_apply_crossfade(const real_t *times, const int instance_count) {
+	//The crowd changed size, there is no from pose for the new instances
+	if (instance_count != _fade_instance_count) {
+		stop_crossfade();
+		return;
+	}
+
+	_fade_weights.resize(instance_count);
+	float *weights = _fade_weights.ptrw();
+
+	float inv_duration = 1.0 / _fade_duration;
+	bool done = true;
+
+	for (int i = 0; i < instance_count; ++i) {
+		float w = CLAMP(times[i] * inv_duration, 0, 1);
+
+		weights[i] = w;
+		done = done && w >= 1;
+	}
+
+	if (done) {
+		stop_crossfade();
+		return;
+	}
+
+	for (int t = 0; t < _track_paths.size(); ++t) {
+		if (!_fade_track_valid[t])
+			continue;
+
+		int offset = t * instance_count;
+
+		for (int c = 0; c < CHANNEL_COUNT; ++c) {
+			if (c >= CHANNEL_ROTATION_X && c <= CHANNEL_ROTATION_W)
+				continue;
+
+			float *output = _output_channels[c].ptrw() + offset;
+
+			_lerp_kernel(_fade_channels[c].ptr() + offset, output, weights, output, instance_count);
+		}
+
+		const float *a[4];
+		float *r[4];
+
+		for (int q = 0; q < 4; ++q) {
+			a[q] = _fade_channels[CHANNEL_ROTATION_X + q].ptr() + offset;
+			r[q] = _output_channels[CHANNEL_ROTATION_X + q].ptrw() + offset;
+		}
+
+		//r is both the target and the result, the kernel reads every element before writing it
+		_nlerp_kernel(a, r, weights, r, instance_count);
+	}
+}
+
+Transform ProceduralAnimationCrowdEvaluator::get_transform(const int instance, const int track) const {
+	ERR_FAIL_INDEX_V(instance, _instance_count, Transform());
+	ERR_FAIL_INDEX_V(track, _track_paths.size(), Transform());
+
+	int idx = track * _instance_count + instance;
+
+	const Vector<float> *o = _output_channels;
+
+	Quat rot(o[CHANNEL_ROTATION_X][idx], o[CHANNEL_ROTATION_Y][idx], o[CHANNEL_ROTATION_Z][idx], o[CHANNEL_ROTATION_W][idx]);
+	Vector3 scale(o[CHANNEL_SCALE_X][idx], o[CHANNEL_SCALE_Y][idx], o[CHANNEL_SCALE_Z][idx]);
+
+	Transform transform;
+	transform.basis.set_quat_scale(rot, scale);
+	transform.origin = Vector3(o[CHANNEL_LOCATION_X][idx], o[CHANNEL_LOCATION_Y][idx], o[CHANNEL_LOCATION_Z][idx]);
+
+	return transform;
+}
+
+Array ProceduralAnimationCrowdEvaluator::get_track_transforms(const int track) const {
+	ERR_FAIL_INDEX_V(track, _track_paths.size(), Array());
+
+	Array arr;
+	arr.resize(_instance_count);
+
+	for (int i = 0; i < _instance_count; ++i) {
+		arr[i] = get_transform(i, track);
+	}
+
+	return arr;
+}
+
+//track * get_instance_count() + instance indexed, for engine side consumers.
+const float *ProceduralAnimationCrowdEvaluator::get_output_channel(const Channel channel) const {
+	ERR_FAIL_INDEX_V(channel, CHANNEL_COUNT, NULL);
+
+	return _output_channels[channel].ptr();
+}
+
+int ProceduralAnimationCrowdEvaluator::_find_or_add_ease_table(const ProceduralAnimation::EaseTable &table) {
+	for (int i = 0; i < _ease_tables.size(); ++i) {
+		if (_ease_tables[i].transition == table.transition)
+			return i;
+	}
+
+	_ease_tables.push_back(table);
+
+	return _ease_tables.size() - 1;
+}
+
+void ProceduralAnimationCrowdEvaluator::_update_lod_masks() {
+	int track_count = _track_paths.size();
+
+	_lod_track_active.resize(_lod_levels.size() * track_count);
+
+	for (int l = 0; l < _lod_levels.size(); ++l) {
+		const PoolVector<String> &filter = _lod_levels[l].track_filter;
+
+		for (int t = 0; t < track_count; ++t) {
+			bool active = filter.size() == 0;
+			String path = _track_paths[t];
+
+			for (int i = 0; i < filter.size() && !active; ++i) {
+				active = path.match(filter[i]);
+			}
+
+			_lod_track_active.write[l * track_count + t] = active ? 1 : 0;
+		}
+	}
+}
+
+void ProceduralAnimationCrowdEvaluator::_resize_instances(const int instance_count) {
+	int track_count = _track_paths.size();
+	int size = track_count * instance_count;
+
+	_instance_count = instance_count;
+
+	//The crossfade (if any) already copied what it needs
+	_last_track_paths.clear();
+	_last_instance_count = 0;
+
+	for (int c = 0; c < CHANNEL_COUNT; ++c) {
+		_last_channels[c].clear();
+	}
+
+	_instance_last_update.resize(instance_count);
+
+	for (int i = 0; i < instance_count; ++i) {
+		_instance_last_update.write[i] = -1;
+	}
+
+	//Everything starts from the identity transform, so tracks that a LOD level never evaluates stay sane.
+	for (int c = 0; c < CHANNEL_COUNT; ++c) {
+		float value = 0;
+
+		if (c == CHANNEL_ROTATION_W || c == CHANNEL_SCALE_X || c == CHANNEL_SCALE_Y || c == CHANNEL_SCALE_Z)
+			value = 1;
+
+		_output_channels[c].resize(size);
+		_start_channels[c].resize(size);
+		_target_channels[c].resize(size);
+		_eval_channels[c].resize(size);
+
+		float *o = _output_channels[c].ptrw();
+
+		for (int i = 0; i < size; ++i) {
+			o[i] = value;
+		}
+	}
+
+	_eval_instance.resize(instance_count);
+	_eval_time.resize(instance_count);
+	_eval_to_target.resize(instance_count);
+	_eval_from.resize(instance_count);
+	_eval_to.resize(instance_count);
+	_eval_weight.resize(instance_count);
+
+	_interp_instance.resize(instance_count);
+	_interp_alpha.resize(instance_count);
+
+	for (int i = 0; i < 4; ++i) {
+		_gather_a[i].resize(instance_count);
+		_gather_b[i].resize(instance_count);
+		_gather_r[i].resize(instance_count);
+	}
+}
+
+//Clamped LOD level of every instance, resolved with a single read so the loops in evaluate() only index a plain array.
+void ProceduralAnimationCrowdEvaluator::_resolve_instance_lods(const int instance_count) {
+	_resolved_lods.resize(instance_count);
+	uint8_t *r = _resolved_lods.ptrw();
+
+	int set_count = MIN(_instance_lods.size(), instance_count);
+
+	if (_lod_levels.size() == 0)
+		set_count = 0;
+
+	if (set_count > 0) {
+		int max_lod = _lod_levels.size() - 1;
+
+#if VERSION_MAJOR > 3
+		const int *lods = _instance_lods.ptr();
+#else
+		PoolVector<int>::Read lr = _instance_lods.read();
+		const int *lods = lr.ptr();
+#endif
+
+		for (int i = 0; i < set_count; ++i) {
+			r[i] = CLAMP(lods[i], 0, max_lod);
+		}
+	}
+
+	for (int i = set_count; i < instance_count; ++i) {
+		r[i] = 0;
+	}
+}
+
+bool ProceduralAnimationCrowdEvaluator::_is_track_active(const int lod, const int track) const {
+	if (_lod_levels.size() == 0)
+		return true;
+
+	return _lod_track_active[lod * _track_paths.size() + track] != 0;
+}
+
+float ProceduralAnimationCrowdEvaluator::_wrap_time(const float time) const {
+	if (_loop && _length > 0)
+		return Math::fposmod(time, _length);
+
+	return CLAMP(time, 0, _length);
+}
+
+//The last key that starts at, or before time.
+int ProceduralAnimationCrowdEvaluator::_find_key(const float time) const {
+	const float *key_times = _key_times.ptr();
+
+	int lo = 0;
+	int hi = _key_count - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi + 1) >> 1;
+
+		if (key_times[mid] <= time)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+//The kernels only work on contiguous float arrays, and have no branches in their loops,
+//so that the compiler can vectorize them.
+void ProceduralAnimationCrowdEvaluator::_lerp_kernel(const float *a, const float *b, const float *w, float *r, const int count) {
+	for (int i = 0; i < count; ++i) {
+		r[i] = a[i] + (b[i] - a[i]) * w[i];
+	}
+}
+
+//Normalized lerp along the shortest arc. Between neighbouring keyframes it is visually
+//the same as slerp, but has no trigonometry, and no branches.
+void ProceduralAnimationCrowdEvaluator::_nlerp_kernel(const float *const *a, const float *const *b, const float *w, float *const *r, const int count) {
+	const float *ax = a[0];
+	const float *ay = a[1];
+	const float *az = a[2];
+	const float *aw = a[3];
+	const float *bx = b[0];
+	const float *by = b[1];
+	const float *bz = b[2];
+	const float *bw = b[3];
+	float *rx = r[0];
+	float *ry = r[1];
+	float *rz = r[2];
+	float *rw = r[3];
+
+	for (int i = 0; i < count; ++i) {
+		float d = ax[i] * bx[i] + ay[i] * by[i] + az[i] * bz[i] + aw[i] * bw[i];
+		float s = d < 0 ? -1.0f : 1.0f;
+
+		float x = ax[i] + (s * bx[i] - ax[i]) * w[i];
+		float y = ay[i] + (s * by[i] - ay[i]) * w[i];
+		float z = az[i] + (s * bz[i] - az[i]) * w[i];
+		float q = aw[i] + (s * bw[i] - aw[i]) * w[i];
+
+		float inv_len = 1.0f / Math::sqrt(x * x + y * y + z * z + q * q);
+
+		rx[i] = x * inv_len;
+		ry[i] = y * inv_len;
+		rz[i] = z * inv_len;
+		rw[i] = q * inv_len;
+	}
+}
+
+ProceduralAnimationCrowdEvaluator::ProceduralAnimationCrowdEvaluator() {
+	_key_count = 0;
+	_loop = false;
+	_length = 0;
+	_instance_count = 0;
+	_last_instance_count = 0;
+	_eval_count = 0;
+	_interp_count = 0;
+	_fading = false;
+	_fade_duration = 0;
+	_fade_instance_count = 0;
+}
+
+ProceduralAnimationCrowdEvaluator::~ProceduralAnimationCrowdEvaluator() {
+	_procedural_animation.unref();
+}
+
+void ProceduralAnimationCrowdEvaluator::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_procedural_animation"), &ProceduralAnimationCrowdEvaluator::get_procedural_animation);
+	ClassDB::bind_method(D_METHOD("set_procedural_animation", "value"), &ProceduralAnimationCrowdEvaluator::set_procedural_animation);
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "procedural_animation", PROPERTY_HINT_RESOURCE_TYPE, "ProceduralAnimation"), "set_procedural_animation", "get_procedural_animation");
+
+	ClassDB::bind_method(D_METHOD("get_track_count"), &ProceduralAnimationCrowdEvaluator::get_track_count);
+	ClassDB::bind_method(D_METHOD("get_track_path", "track"), &ProceduralAnimationCrowdEvaluator::get_track_path);
+	ClassDB::bind_method(D_METHOD("find_track", "path"), &ProceduralAnimationCrowdEvaluator::find_track);
+
+	ClassDB::bind_method(D_METHOD("get_instance_count"), &ProceduralAnimationCrowdEvaluator::get_instance_count);
+
+	ClassDB::bind_method(D_METHOD("get_lod_count"), &ProceduralAnimationCrowdEvaluator::get_lod_count);
+	ClassDB::bind_method(D_METHOD("set_lod_count", "value"), &ProceduralAnimationCrowdEvaluator::set_lod_count);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_count"), "set_lod_count", "get_lod_count");
+
+	ClassDB::bind_method(D_METHOD("get_lod_track_filter", "lod"), &ProceduralAnimationCrowdEvaluator::get_lod_track_filter);
+	ClassDB::bind_method(D_METHOD("set_lod_track_filter", "lod", "value"), &ProceduralAnimationCrowdEvaluator::set_lod_track_filter);
+
+	ClassDB::bind_method(D_METHOD("get_lod_update_interval", "lod"), &ProceduralAnimationCrowdEvaluator::get_lod_update_interval);
+	ClassDB::bind_method(D_METHOD("set_lod_update_interval", "lod", "value"), &ProceduralAnimationCrowdEvaluator::set_lod_update_interval);
+
+	ClassDB::bind_method(D_METHOD("get_lod_min_segment_duration", "lod"), &ProceduralAnimationCrowdEvaluator::get_lod_min_segment_duration);
+	ClassDB::bind_method(D_METHOD("set_lod_min_segment_duration", "lod", "value"), &ProceduralAnimationCrowdEvaluator::set_lod_min_segment_duration);
+
+	ClassDB::bind_method(D_METHOD("get_instance_lods"), &ProceduralAnimationCrowdEvaluator::get_instance_lods);
+	ClassDB::bind_method(D_METHOD("set_instance_lods", "value"), &ProceduralAnimationCrowdEvaluator::set_instance_lods);
+
+	ClassDB::bind_method(D_METHOD("update_data"), &ProceduralAnimationCrowdEvaluator::update_data);
+	ClassDB::bind_method(D_METHOD("evaluate", "times"), &ProceduralAnimationCrowdEvaluator::evaluate);
+
+	ClassDB::bind_method(D_METHOD("crossfade_to", "animation", "duration"), &ProceduralAnimationCrowdEvaluator::crossfade_to);
+	ClassDB::bind_method(D_METHOD("stop_crossfade"), &ProceduralAnimationCrowdEvaluator::stop_crossfade);
+	ClassDB::bind_method(D_METHOD("is_crossfading"), &ProceduralAnimationCrowdEvaluator::is_crossfading);
+	ClassDB::bind_method(D_METHOD("get_crossfade_duration"), &ProceduralAnimationCrowdEvaluator::get_crossfade_duration);
+
+	ClassDB::bind_method(D_METHOD("get_transform", "instance", "track"), &ProceduralAnimationCrowdEvaluator::get_transform);
+	ClassDB::bind_method(D_METHOD("get_track_transforms", "track"), &ProceduralAnimationCrowdEvaluator::get_track_transforms);
+}
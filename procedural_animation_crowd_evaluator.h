@@ -0,0 +1,209 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef PROCEDURAL_ANIMATION_CROWD_EVALUATOR_H
+#define PROCEDURAL_ANIMATION_CROWD_EVALUATOR_H
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/object/reference.h"
+#include "core/templates/vector.h"
+#else
+#include "core/reference.h"
+#include "core/vector.h"
+#endif
+
+#include "core/math/transform.h"
+
+#include "procedural_animation.h"
+
+//Evaluates the transform tracks of one ProceduralAnimation for many instances at once.
+//The source poses of the keyframe chain are cached in structure of arrays form, every channel
+//(location x, location y, ..., scale z) in its own array, and evaluate() runs each channel
+//of every track for all instances in one tight loop.
+class ProceduralAnimationCrowdEvaluator : public Reference {
+	GDCLASS(ProceduralAnimationCrowdEvaluator, Reference);
+
+public:
+	enum Channel {
+		CHANNEL_LOCATION_X = 0,
+		CHANNEL_LOCATION_Y,
+		CHANNEL_LOCATION_Z,
+		CHANNEL_ROTATION_X,
+		CHANNEL_ROTATION_Y,
+		CHANNEL_ROTATION_Z,
+		CHANNEL_ROTATION_W,
+		CHANNEL_SCALE_X,
+		CHANNEL_SCALE_Y,
+		CHANNEL_SCALE_Z,
+		CHANNEL_COUNT,
+	};
+
+	Ref<ProceduralAnimation> get_procedural_animation() const;
+	void set_procedural_animation(const Ref<ProceduralAnimation> &value);
+
+	int get_track_count() const;
+	NodePath get_track_path(const int track) const;
+	int find_track(const NodePath &path) const;
+
+	int get_instance_count() const;
+
+	//LOD levels. Instances use level 0 unless set otherwise with set_instance_lods().
+	int get_lod_count() const;
+	void set_lod_count(const int value);
+
+	PoolVector<String> get_lod_track_filter(const int lod) const;
+	void set_lod_track_filter(const int lod, const PoolVector<String> &value);
+
+	float get_lod_update_interval(const int lod) const;
+	void set_lod_update_interval(const int lod, const float value);
+
+	float get_lod_min_segment_duration(const int lod) const;
+	void set_lod_min_segment_duration(const int lod, const float value);
+
+	PoolVector<int> get_instance_lods() const;
+	void set_instance_lods(const PoolVector<int> &value);
+
+	void update_data();
+	void evaluate(const PoolVector<real_t> &times);
+
+	//Cross-fade
+	void crossfade_to(const Ref<ProceduralAnimation> &animation, const float duration);
+	void stop_crossfade();
+	bool is_crossfading() const;
+	float get_crossfade_duration() const;
+
+	Transform get_transform(const int instance, const int track) const;
+	Array get_track_transforms(const int track) const;
+
+	const float *get_output_channel(const Channel channel) const;
+
+	ProceduralAnimationCrowdEvaluator();
+	~ProceduralAnimationCrowdEvaluator();
+
+protected:
+	struct LodLevel {
+		PoolVector<String> track_filter;
+		float update_interval;
+		float min_segment_duration;
+
+		LodLevel() {
+			update_interval = 0;
+			min_segment_duration = 0;
+		}
+	};
+
+	int _find_or_add_ease_table(const ProceduralAnimation::EaseTable &table);
+	void _update_lod_masks();
+	void _resize_instances(const int instance_count);
+	void _resolve_instance_lods(const int instance_count);
+	bool _is_track_active(const int lod, const int track) const;
+	void _apply_crossfade(const real_t *times, const int instance_count);
+	float _wrap_time(const float time) const;
+	int _find_key(const float time) const;
+
+	static void _lerp_kernel(const float *a, const float *b, const float *w, float *r, const int count);
+	static void _nlerp_kernel(const float *const *a, const float *const *b, const float *w, float *const *r, const int count);
+
+	static void _bind_methods();
+
+private:
+	Ref<ProceduralAnimation> _procedural_animation;
+
+	//per track
+	Vector<NodePath> _track_paths;
+
+	//per chain key
+	Vector<float> _key_times;
+	Vector<float> _key_durations;
+	Vector<int> _key_ease;
+	Vector<ProceduralAnimation::EaseTable> _ease_tables;
+	int _key_count;
+	bool _loop;
+	float _length;
+
+	//[channel][track * _key_count + key]
+	Vector<float> _key_channels[CHANNEL_COUNT];
+
+	//[lod * track count + track], 1 if the track is evaluated on that level
+	Vector<LodLevel> _lod_levels;
+	Vector<uint8_t> _lod_track_active;
+
+	//per instance
+	int _instance_count;
+	PoolVector<int> _instance_lods;
+	//_instance_lods clamped to the level count, filled at the start of every evaluate()
+	Vector<uint8_t> _resolved_lods;
+	Vector<float> _instance_last_update;
+
+	//[channel][track * _instance_count + instance]
+	Vector<float> _output_channels[CHANNEL_COUNT];
+
+	//The last evaluated pose, kept by update_data() until the next evaluate(), so crossfade_to() still has
+	//a pose to fade from when it's called right after update_data().
+	//[channel][track * _last_instance_count + instance]
+	Vector<NodePath> _last_track_paths;
+	int _last_instance_count;
+	Vector<float> _last_channels[CHANNEL_COUNT];
+
+	//Instances on a level with an update interval interpolate from the pose they had at their
+	//last update (start) to the pose they should have at their next update (target).
+	Vector<float> _start_channels[CHANNEL_COUNT];
+	Vector<float> _target_channels[CHANNEL_COUNT];
+
+	//Instances that need a real evaluation this frame
+	int _eval_count;
+	Vector<int> _eval_instance;
+	Vector<float> _eval_time;
+	Vector<uint8_t> _eval_to_target;
+	Vector<int> _eval_from;
+	Vector<int> _eval_to;
+	Vector<float> _eval_weight;
+
+	//[channel][track * _eval_count + eval index]
+	Vector<float> _eval_channels[CHANNEL_COUNT];
+
+	//Instances that only interpolate between their start and target pose this frame
+	int _interp_count;
+	Vector<int> _interp_instance;
+	Vector<float> _interp_alpha;
+
+	//[lod] for eval, then [lod] for interp, 1 if any instance uses that level this frame
+	Vector<uint8_t> _lods_used;
+
+	//Cross-fade, the pose every instance had when crossfade_to() was called, in the new track layout
+	//[channel][track * _fade_instance_count + instance]
+	bool _fading;
+	float _fade_duration;
+	int _fade_instance_count;
+	Vector<float> _fade_channels[CHANNEL_COUNT];
+	Vector<uint8_t> _fade_track_valid;
+	Vector<float> _fade_weights;
+
+	//gather buffers, _instance_count long
+	Vector<float> _gather_a[4];
+	Vector<float> _gather_b[4];
+	Vector<float> _gather_r[4];
+};
+
+#endif
@@ -26,16 +26,22 @@ SOFTWARE.
 
 #if VERSION_MAJOR > 3
 #include "core/object/object.h"
+#include "core/object/undo_redo.h"
 #else
 #include "core/object.h"
+#include "core/undo_redo.h"
 #endif
 
+#include "editor/editor_node.h"
 #include "editor/editor_properties.h"
 
 #include "editor/editor_scale.h"
 
 #include "scene/animation/animation_player.h"
 
+#include "procedural_animation_export_plugin.h"
+#include "procedural_animation_key_pose_extractor.h"
+
 // S  --------        ProceduralAnimationEditor        --------
 
 void ProceduralAnimationEditor::edit(const Ref<ProceduralAnimation> &animation) {
@@ -46,7 +52,17 @@ void ProceduralAnimationEditor::edit(const Ref<ProceduralAnimation> &animation)
 	if (animation.is_valid())
 		load_animation();
 
+	update_animation_settings();
+}
+
+//Refreshes the top bar from the resource. The fps and loop handlers return early when the value
+//is unchanged, so setting the controls here doesn't create new actions.
+void ProceduralAnimationEditor::update_animation_settings() {
 	_animation_target_animation_property->update_property();
+
+	if (!_animation.is_valid())
+		return;
+
 	_animation_fps_spinbox->set_value(_animation->get_animation_fps());
 	_loop_checkbox->set_pressed(_animation->has_loop());
 }
@@ -62,9 +78,18 @@ void ProceduralAnimationEditor::load_animation() {
 	_start_node->set_offset(_animation->get_start_node_position());
 #endif
 
-	const PoolVector<String> &animation_names = _animation->get_animation_keyframe_names();
+	Dictionary data = _animation->get_keyframe_data();
 
-	PoolVector<int> kfind = _animation->get_keyframe_indices();
+	PoolVector<int> kfind = data["indices"];
+	PoolVector<String> names = data["names"];
+	PoolVector<int> animation_keyframe_indices = data["animation_keyframe_indices"];
+	PoolVector<int> blend_animation_keyframe_indices = data["blend_animation_keyframe_indices"];
+	PoolVector<real_t> blend_weights = data["blend_weights"];
+	PoolVector<int> next_keyframes = data["next_keyframes"];
+	PoolVector<real_t> transitions = data["transitions"];
+	PoolVector<real_t> times = data["times"];
+	PoolVector<String> method_names = data["method_names"];
+	PoolVector<Vector2> positions = data["positions"];
 
 	for (int i = 0; i < kfind.size(); ++i) {
 		int id = kfind[i];
@@ -73,22 +98,10 @@ void ProceduralAnimationEditor::load_animation() {
 		_graph_edit->add_child(gn);
 		gn->set_name(String::num(id));
 		gn->set_id(id);
-		gn->set_animation(_animation);
+		gn->load_keyframe(_animation, names[i], animation_keyframe_indices[i], blend_animation_keyframe_indices[i], blend_weights[i], next_keyframes[i], transitions[i], times[i], method_names[i], positions[i]);
 	}
 
-	for (int i = 0; i < kfind.size(); ++i) {
-		int id = kfind[i];
-
-		int ni = _animation->get_keyframe_next_keyframe_index(id);
-
-		if (ni != -1)
-			_graph_edit->connect_node(String::num(id), 0, String::num(ni), 0);
-	}
-
-	int st = _animation->get_start_frame_index();
-
-	if (st != -1)
-		_graph_edit->connect_node("Start", 0, String::num(st), 0);
+	update_connections();
 }
 
 void ProceduralAnimationEditor::clear_keyframe_nodes() {
@@ -112,6 +125,28 @@ void ProceduralAnimationEditor::clear_keyframe_nodes() {
 	}
 }
 
+void ProceduralAnimationEditor::update_connections() {
+	_graph_edit->clear_connections();
+
+	ERR_FAIL_COND(!_animation.is_valid());
+
+	PoolVector<int> kfind = _animation->get_keyframe_indices();
+
+	for (int i = 0; i < kfind.size(); ++i) {
+		int id = kfind[i];
+
+		int ni = _animation->get_keyframe_next_keyframe_index(id);
+
+		if (ni != -1)
+			_graph_edit->connect_node(String::num(id), 0, String::num(ni), 0);
+	}
+
+	int st = _animation->get_start_frame_index();
+
+	if (st != -1)
+		_graph_edit->connect_node("Start", 0, String::num(st), 0);
+}
+
 void ProceduralAnimationEditor::on_delete_popup_confirmed() {
 	switch (_delete_popup_action) {
 		case DELETE_POPUP_KEYFRAME:
@@ -142,28 +177,16 @@ void ProceduralAnimationEditor::on_connection_request(const String &from, const
 	ProceduralAnimationEditorGraphNode *gn = Object::cast_to<ProceduralAnimationEditorGraphNode>(f);
 
 	if (gn != NULL) {
-		int ni = _animation->get_keyframe_next_keyframe_index(gn->get_id());
-
-		if (ni != -1) {
-			_graph_edit->disconnect_node(from, from_slot, String::num(ni), 0);
-		}
+		change_keyframe_field(gn->get_id(), "next_keyframes", to.to_int(), TTR("Connect Keyframes"));
+	} else if (f == _start_node) {
+		Dictionary do_data;
+		do_data["start_frame_index"] = to.to_int();
 
-		_animation->set_keyframe_next_keyframe_index(gn->get_id(), to.to_int());
-	} else {
-		GraphNode *g = Object::cast_to<GraphNode>(f);
-
-		if (g != NULL) {
-			int st = _animation->get_start_frame_index();
+		Dictionary undo_data;
+		undo_data["start_frame_index"] = _animation->get_start_frame_index();
 
-			if (st != -1) {
-				_graph_edit->disconnect_node("Start", 0, String::num(st), 0);
-			}
-
-			_animation->set_start_frame_index(to.to_int());
-		}
+		commit_keyframe_change(TTR("Connect Keyframes"), do_data, undo_data);
 	}
-
-	_graph_edit->connect_node(from, from_slot, to, to_slot);
 }
 void ProceduralAnimationEditor::on_disconnection_request(const String &from, const int from_slot, const String &to, const int to_slot) {
 	Node *f = _graph_edit->get_node_or_null(from);
@@ -171,55 +194,79 @@ void ProceduralAnimationEditor::on_disconnection_request(const String &from, con
 	ProceduralAnimationEditorGraphNode *gn = Object::cast_to<ProceduralAnimationEditorGraphNode>(f);
 
 	if (gn != NULL) {
-		_animation->set_keyframe_next_keyframe_index(gn->get_id(), -1);
-	} else {
-		GraphNode *g = Object::cast_to<GraphNode>(f);
+		change_keyframe_field(gn->get_id(), "next_keyframes", -1, TTR("Disconnect Keyframes"));
+	} else if (f == _start_node) {
+		Dictionary do_data;
+		do_data["start_frame_index"] = -1;
 
-		if (g != NULL) {
-			_animation->set_start_frame_index(-1);
-		}
-	}
+		Dictionary undo_data;
+		undo_data["start_frame_index"] = _animation->get_start_frame_index();
 
-	_graph_edit->disconnect_node(from, from_slot, to, to_slot);
+		commit_keyframe_change(TTR("Disconnect Keyframes"), do_data, undo_data);
+	}
 }
 
 void ProceduralAnimationEditor::on_delete_nodes_request() {
-	List<StringName> to_erase;
+	PoolVector<int> to_erase;
 
 	for (int i = 0; i < _graph_edit->get_child_count(); i++) {
-		GraphNode *gn = Object::cast_to<GraphNode>(_graph_edit->get_child(i));
+		ProceduralAnimationEditorGraphNode *gn = Object::cast_to<ProceduralAnimationEditorGraphNode>(_graph_edit->get_child(i));
 		if (gn) {
 			if (gn->is_selected() && gn->is_close_button_visible()) {
-				to_erase.push_back(gn->get_name());
+				to_erase.push_back(gn->get_id());
 			}
 		}
 	}
 
-#if VERSION_MAJOR > 3
-	if (to_erase.is_empty())
-		return;
-#else
-	if (to_erase.empty())
+	if (to_erase.size() == 0)
 		return;
-#endif
 
-	//undo_redo->create_action(TTR("Delete Node(s)"));
+	delete_keyframes(to_erase);
+}
 
-	for (List<StringName>::Element *F = to_erase.front(); F; F = F->next()) {
-		_delete_request(F->get());
-	}
+void ProceduralAnimationEditor::add_frame_button_pressed() {
+	ERR_FAIL_COND(!_animation.is_valid());
 
-	//undo_redo->commit_action();
+	//Same id add_keyframe() would pick, so redo recreates the same keyframe
+	PoolVector<int> kfind = _animation->get_keyframe_indices();
+
+	int id = 0;
+	if (kfind.size() > 0)
+		id = kfind[kfind.size() - 1] + 1;
+
+	PoolVector<int> ids;
+	ids.push_back(id);
+
+	Dictionary do_data;
+	do_data["indices"] = ids;
+
+	Dictionary undo_data;
+	undo_data["removed"] = ids;
+
+	commit_keyframe_change(TTR("Add Keyframe"), do_data, undo_data);
 }
 
-void ProceduralAnimationEditor::add_frame_button_pressed() {
-	int id = _animation->add_keyframe();
+void ProceduralAnimationEditor::generate_key_poses_button_pressed() {
+	ERR_FAIL_COND(!_animation.is_valid());
+
+	Ref<ProceduralAnimationKeyPoseExtractor> extractor;
+	extractor.instance();
+	Dictionary data = extractor->generate_keyframe_data(_animation);
+
+	if (!data.has("indices"))
+		return;
 
-	ProceduralAnimationEditorGraphNode *gn = memnew(ProceduralAnimationEditorGraphNode(this));
-	_graph_edit->add_child(gn);
-	gn->set_name(String::num(id));
-	gn->set_id(id);
-	gn->set_animation(_animation);
+	//The whole graph is replaced, so the action stores all of it. The diffs that are already in the history
+	//only stay valid if they are undone on top of exactly the graph they were recorded on.
+	if (!_undo_redo) {
+		_replace_keyframe_data(_animation, data);
+		return;
+	}
+
+	_undo_redo->create_action(TTR("Generate Key Poses"));
+	_undo_redo->add_do_method(this, "_replace_keyframe_data", _animation, data);
+	_undo_redo->add_undo_method(this, "_replace_keyframe_data", _animation, _animation->get_keyframe_data());
+	_undo_redo->commit_action();
 }
 
 Ref<Animation> ProceduralAnimationEditor::get_animation_target_animation() {
@@ -232,7 +279,10 @@ void ProceduralAnimationEditor::set_animation_target_animation(const Ref<Animati
 	if (!_animation.is_valid())
 		return;
 
-	_animation->set_animation(animation);
+	if (_animation->get_animation() == animation)
+		return;
+
+	commit_animation_setting(TTR("Set Source Animation"), "set_animation", animation, _animation->get_animation());
 }
 
 void ProceduralAnimationEditor::on_animation_fps_changed(const float value) {
@@ -242,7 +292,7 @@ void ProceduralAnimationEditor::on_animation_fps_changed(const float value) {
 	if (_animation->get_animation_fps() == value)
 		return;
 
-	_animation->set_animation_fps(value);
+	commit_animation_setting(TTR("Set Animation FPS"), "set_animation_fps", static_cast<int>(value), _animation->get_animation_fps());
 }
 
 void ProceduralAnimationEditor::on_loop_checkbox_toggled(const bool value) {
@@ -252,7 +302,24 @@ void ProceduralAnimationEditor::on_loop_checkbox_toggled(const bool value) {
 	if (_animation->has_loop() == value)
 		return;
 
-	_animation->set_loop(value);
+	commit_animation_setting(TTR("Set Animation Loop"), "set_loop", value, _animation->has_loop());
+}
+
+void ProceduralAnimationEditor::commit_animation_setting(const String &action_name, const StringName &setter, const Variant &value, const Variant &old_value) {
+	ERR_FAIL_COND(!_animation.is_valid());
+
+	if (!_undo_redo) {
+		_animation->call(setter, value);
+		update_animation_settings();
+		return;
+	}
+
+	_undo_redo->create_action(action_name);
+	_undo_redo->add_do_method(_animation.ptr(), setter, value);
+	_undo_redo->add_undo_method(_animation.ptr(), setter, old_value);
+	_undo_redo->add_do_method(this, "update_animation_settings");
+	_undo_redo->add_undo_method(this, "update_animation_settings");
+	_undo_redo->commit_action();
 }
 
 void ProceduralAnimationEditor::_delete_request(const StringName &name) {
@@ -266,34 +333,406 @@ void ProceduralAnimationEditor::_delete_request(const StringName &name) {
 	if (g == NULL)
 		return;
 
-	List<GraphEdit::Connection> conns;
-	_graph_edit->get_connection_list(&conns);
+	PoolVector<int> ids;
+	ids.push_back(g->get_id());
 
-	for (List<GraphEdit::Connection>::Element *E = conns.front(); E; E = E->next()) {
-		GraphEdit::Connection c = E->get();
+	delete_keyframes(ids);
+}
 
-		if (c.to == name) {
-			if (c.from == "Start") {
-				_animation->set_start_frame_index(-1);
-			} else {
-				Node *fn = _graph_edit->get_node_or_null(NodePath(c.from));
+void ProceduralAnimationEditor::change_keyframe_field(const int id, const String &field, const Variant &value, const String &action_name) {
+	ERR_FAIL_COND(!_animation.is_valid());
+	ERR_FAIL_COND(!_animation->has_keyframe(id));
 
-				ProceduralAnimationEditorGraphNode *fg = Object::cast_to<ProceduralAnimationEditorGraphNode>(fn);
+	PoolVector<int> ids;
+	ids.push_back(id);
 
-				if (fg != NULL) {
-					_animation->set_keyframe_next_keyframe_index(fg->get_id(), -1);
-				}
-			}
+	Dictionary old_data = _animation->get_keyframe_data_for(ids);
+
+	Array values;
+	values.push_back(value);
+
+	Dictionary do_data;
+	do_data["indices"] = ids;
+	do_data[field] = values;
+
+	Dictionary undo_data;
+	undo_data["indices"] = ids;
+	undo_data[field] = old_data[field];
+
+	//Merged, so dragging a spinbox is one action
+	commit_keyframe_change(action_name + " " + String::num(id), do_data, undo_data, true);
+}
+
+void ProceduralAnimationEditor::delete_keyframes(const PoolVector<int> &ids) {
+	ERR_FAIL_COND(!_animation.is_valid());
+
+	//Keyframes pointing into the deleted ones get disconnected, their old state goes into the undo diff too
+	Set<int> erased;
+	for (int i = 0; i < ids.size(); ++i)
+		erased.insert(ids[i]);
+
+	PoolVector<int> kfind = _animation->get_keyframe_indices();
+	PoolVector<int> incoming;
+	PoolVector<int> incoming_next;
+
+	for (int i = 0; i < kfind.size(); ++i) {
+		int id = kfind[i];
+
+		if (erased.has(id))
+			continue;
 
-			_graph_edit->disconnect_node(c.from, c.from_port, c.to, c.to_port);
-		} else if (c.from == name) {
-			_graph_edit->disconnect_node(c.from, c.from_port, c.to, c.to_port);
+		if (erased.has(_animation->get_keyframe_next_keyframe_index(id))) {
+			incoming.push_back(id);
+			incoming_next.push_back(-1);
 		}
 	}
 
-	_animation->remove_keyframe(g->get_id());
-	g->set_name("r" + g->get_name());
-	g->queue_delete();
+	PoolVector<int> saved = ids;
+	for (int i = 0; i < incoming.size(); ++i)
+		saved.push_back(incoming[i]);
+
+	Dictionary undo_data = _animation->get_keyframe_data_for(saved);
+
+	Dictionary do_data;
+	do_data["removed"] = ids;
+	do_data["indices"] = incoming;
+	do_data["next_keyframes"] = incoming_next;
+
+	if (erased.has(_animation->get_start_frame_index()))
+		do_data["start_frame_index"] = -1;
+
+	commit_keyframe_change(ids.size() == 1 ? TTR("Delete Keyframe") : TTR("Delete Keyframes"), do_data, undo_data);
+}
+
+void ProceduralAnimationEditor::commit_keyframe_change(const String &action_name, const Dictionary &do_data, const Dictionary &undo_data, const bool merge) {
+	ERR_FAIL_COND(!_animation.is_valid());
+
+	if (!_undo_redo) {
+		_apply_keyframe_diff(_animation, do_data);
+		return;
+	}
+
+	_undo_redo->create_action(action_name, merge ? UndoRedo::MERGE_ENDS : UndoRedo::MERGE_DISABLE);
+	_undo_redo->add_do_method(this, "_apply_keyframe_diff", _animation, do_data);
+	_undo_redo->add_undo_method(this, "_apply_keyframe_diff", _animation, undo_data);
+	_undo_redo->commit_action();
+}
+
+void ProceduralAnimationEditor::_apply_keyframe_diff(const Ref<ProceduralAnimation> &animation, const Dictionary &data) {
+	ERR_FAIL_COND(!animation.is_valid());
+
+	animation->update_keyframe_data(data);
+
+	//The action can belong to an animation that is not open anymore
+	if (animation != _animation)
+		return;
+
+	PoolVector<int> removed = data.get("removed", PoolVector<int>());
+
+	for (int i = 0; i < removed.size(); ++i) {
+		Node *n = _graph_edit->get_node_or_null(NodePath(String::num(removed[i])));
+
+		ProceduralAnimationEditorGraphNode *gn = Object::cast_to<ProceduralAnimationEditorGraphNode>(n);
+
+		if (gn == NULL)
+			continue;
+
+		gn->set_name("r" + gn->get_name());
+		gn->queue_delete();
+	}
+
+	PoolVector<int> indices = data.get("indices", PoolVector<int>());
+
+	bool edges_changed = removed.size() > 0 || data.has("next_keyframes") || data.has("start_frame_index");
+
+	for (int i = 0; i < indices.size(); ++i) {
+		int id = indices[i];
+
+		Node *n = _graph_edit->get_node_or_null(NodePath(String::num(id)));
+
+		ProceduralAnimationEditorGraphNode *gn = Object::cast_to<ProceduralAnimationEditorGraphNode>(n);
+
+		if (gn == NULL) {
+			gn = memnew(ProceduralAnimationEditorGraphNode(this));
+			_graph_edit->add_child(gn);
+			gn->set_name(String::num(id));
+			gn->set_id(id);
+
+			edges_changed = true;
+		}
+
+		gn->set_animation(_animation);
+	}
+
+	//Node moves happen on every mouse motion, those leave the connections alone
+	if (edges_changed)
+		update_connections();
+}
+
+void ProceduralAnimationEditor::_replace_keyframe_data(const Ref<ProceduralAnimation> &animation, const Dictionary &data) {
+	ERR_FAIL_COND(!animation.is_valid());
+
+	animation->set_keyframe_data(data);
+
+	if (animation == _animation)
+		load_animation();
+}
+
+//A drag is recorded as one action when it ends. The positions the dragged nodes had when it started
+//are the undo side, the graph node offsets at the end are the do side.
+void ProceduralAnimationEditor::on_begin_node_move() {
+	_node_move_undo_data.clear();
+
+	if (!_animation.is_valid())
+		return;
+
+	Dictionary old_data = _animation->get_keyframe_data_for(get_selected_keyframes());
+
+	if (!old_data.has("indices"))
+		return;
+
+	_node_move_undo_data["indices"] = old_data["indices"];
+	_node_move_undo_data["positions"] = old_data["positions"];
+}
+
+void ProceduralAnimationEditor::on_end_node_move() {
+	if (!_animation.is_valid() || !_node_move_undo_data.has("indices")) {
+		_node_move_undo_data.clear();
+		return;
+	}
+
+	Dictionary undo_data = _node_move_undo_data;
+	_node_move_undo_data.clear();
+
+	PoolVector<int> ids = undo_data["indices"];
+	PoolVector<Vector2> old_positions = undo_data["positions"];
+
+	PoolVector<Vector2> positions;
+	positions.resize(ids.size());
+
+	bool moved = false;
+
+	for (int i = 0; i < ids.size(); ++i) {
+		Node *n = _graph_edit->get_node_or_null(NodePath(String::num(ids[i])));
+
+		GraphNode *gn = Object::cast_to<GraphNode>(n);
+
+		ERR_FAIL_COND(gn == NULL);
+
+#if VERSION_MAJOR > 3
+		Vector2 position = gn->get_position_offset();
+#else
+		Vector2 position = gn->get_offset();
+#endif
+
+		positions.set(i, position);
+
+		if (i >= old_positions.size() || old_positions[i] != position)
+			moved = true;
+	}
+
+	if (!moved)
+		return;
+
+	Dictionary do_data;
+	do_data["indices"] = ids;
+	do_data["positions"] = positions;
+
+	commit_keyframe_change(TTR("Move Keyframes"), do_data, undo_data);
+}
+
+PoolVector<int> ProceduralAnimationEditor::get_selected_keyframes() const {
+	PoolVector<int> ids;
+
+	for (int i = 0; i < _graph_edit->get_child_count(); i++) {
+		ProceduralAnimationEditorGraphNode *gn = Object::cast_to<ProceduralAnimationEditorGraphNode>(_graph_edit->get_child(i));
+
+		if (gn && gn->is_selected() && !gn->is_queued_for_deletion()) {
+			ids.push_back(gn->get_id());
+		}
+	}
+
+	return ids;
+}
+
+void ProceduralAnimationEditor::on_selection_menu_id_pressed(const int id) {
+	if (!_animation.is_valid())
+		return;
+
+	_bulk_action = static_cast<SelectionMenuOptions>(id);
+
+	switch (_bulk_action) {
+		case SELECTION_MENU_SCALE_TIMES:
+			_bulk_popup->set_title(TTR("Scale Times"));
+			_bulk_popup_label->set_text(TTR("Multiply the time of the selected keyframes by:"));
+			_bulk_popup_spinbox->set_min(0);
+			_bulk_popup_spinbox->set_max(1000);
+			_bulk_popup_spinbox->set_step(0.01);
+			_bulk_popup_spinbox->set_value(1);
+			break;
+		case SELECTION_MENU_SET_EASING:
+			_bulk_popup->set_title(TTR("Set Easing"));
+			_bulk_popup_label->set_text(TTR("Easing of the selected keyframes:"));
+			_bulk_popup_spinbox->set_min(-1000);
+			_bulk_popup_spinbox->set_max(1000);
+			_bulk_popup_spinbox->set_step(0.01);
+			_bulk_popup_spinbox->set_value(1);
+			break;
+		case SELECTION_MENU_SHIFT_ANIMATION_KEYFRAME:
+			_bulk_popup->set_title(TTR("Shift Source Frames"));
+			_bulk_popup_label->set_text(TTR("Add to the source (and blend) frame of the selected keyframes:"));
+			_bulk_popup_spinbox->set_min(-999999999);
+			_bulk_popup_spinbox->set_max(999999999);
+			_bulk_popup_spinbox->set_step(1);
+			_bulk_popup_spinbox->set_value(0);
+			break;
+		case SELECTION_MENU_DUPLICATE:
+			duplicate_selected_keyframes();
+			return;
+	}
+
+	_bulk_popup->popup_centered();
+}
+
+void ProceduralAnimationEditor::on_bulk_popup_confirmed() {
+	if (!_animation.is_valid())
+		return;
+
+	PoolVector<int> ids = get_selected_keyframes();
+
+	if (ids.size() == 0)
+		return;
+
+	float value = _bulk_popup_spinbox->get_value();
+
+	Dictionary old_data = _animation->get_keyframe_data_for(ids);
+	ids = old_data["indices"];
+
+	Dictionary do_data;
+	do_data["indices"] = ids;
+
+	Dictionary undo_data;
+	undo_data["indices"] = ids;
+
+	switch (_bulk_action) {
+		case SELECTION_MENU_SCALE_TIMES: {
+			PoolVector<real_t> times = old_data["times"];
+			PoolVector<real_t> new_times;
+			new_times.resize(times.size());
+
+			for (int i = 0; i < times.size(); ++i)
+				new_times.set(i, times[i] * value);
+
+			do_data["times"] = new_times;
+			undo_data["times"] = times;
+
+			commit_keyframe_change(TTR("Scale Keyframe Times"), do_data, undo_data);
+		} break;
+		case SELECTION_MENU_SET_EASING: {
+			PoolVector<real_t> transitions = old_data["transitions"];
+			PoolVector<real_t> new_transitions;
+			new_transitions.resize(transitions.size());
+
+			for (int i = 0; i < transitions.size(); ++i)
+				new_transitions.set(i, value);
+
+			do_data["transitions"] = new_transitions;
+			undo_data["transitions"] = transitions;
+
+			commit_keyframe_change(TTR("Set Keyframe Easing"), do_data, undo_data);
+		} break;
+		case SELECTION_MENU_SHIFT_ANIMATION_KEYFRAME: {
+			int offset = static_cast<int>(value);
+
+			PoolVector<int> frames = old_data["animation_keyframe_indices"];
+			PoolVector<int> blend_frames = old_data["blend_animation_keyframe_indices"];
+			PoolVector<int> new_frames;
+			PoolVector<int> new_blend_frames;
+			new_frames.resize(frames.size());
+			new_blend_frames.resize(blend_frames.size());
+
+			for (int i = 0; i < frames.size(); ++i) {
+				new_frames.set(i, MAX(frames[i] + offset, 0));
+
+				//-1 means no blending, that stays as is
+				if (blend_frames[i] == -1)
+					new_blend_frames.set(i, -1);
+				else
+					new_blend_frames.set(i, MAX(blend_frames[i] + offset, 0));
+			}
+
+			do_data["animation_keyframe_indices"] = new_frames;
+			do_data["blend_animation_keyframe_indices"] = new_blend_frames;
+			undo_data["animation_keyframe_indices"] = frames;
+			undo_data["blend_animation_keyframe_indices"] = blend_frames;
+
+			commit_keyframe_change(TTR("Shift Keyframe Source Frames"), do_data, undo_data);
+		} break;
+		case SELECTION_MENU_DUPLICATE:
+			break;
+	}
+}
+
+//Copies the selected keyframes with new ids. Connections between selected keyframes are kept, so
+//a selected sub-chain becomes a new unconnected sub-chain.
+void ProceduralAnimationEditor::duplicate_selected_keyframes() {
+	if (!_animation.is_valid())
+		return;
+
+	PoolVector<int> ids = get_selected_keyframes();
+
+	if (ids.size() == 0)
+		return;
+
+	Dictionary data = _animation->get_keyframe_data_for(ids);
+	ids = data["indices"];
+
+	PoolVector<int> kfind = _animation->get_keyframe_indices();
+
+	int first_id = 0;
+	if (kfind.size() > 0)
+		first_id = kfind[kfind.size() - 1] + 1;
+
+	Map<int, int> id_map;
+	PoolVector<int> new_ids;
+	new_ids.resize(ids.size());
+
+	for (int i = 0; i < ids.size(); ++i) {
+		id_map[ids[i]] = first_id + i;
+		new_ids.set(i, first_id + i);
+	}
+
+	PoolVector<int> next_keyframes = data["next_keyframes"];
+	PoolVector<Vector2> positions = data["positions"];
+
+	for (int i = 0; i < ids.size(); ++i) {
+		Map<int, int>::Element *E = id_map.find(next_keyframes[i]);
+
+		next_keyframes.set(i, E ? E->get() : -1);
+		positions.set(i, positions[i] + Vector2(20, 20) * EDSCALE);
+	}
+
+	Array method_args = data["method_args"];
+
+	data.erase("start_frame_index");
+	data["indices"] = new_ids;
+	data["method_args"] = method_args.duplicate(true);
+	data["next_keyframes"] = next_keyframes;
+	data["positions"] = positions;
+
+	Dictionary undo_data;
+	undo_data["removed"] = new_ids;
+
+	commit_keyframe_change(TTR("Duplicate Keyframes"), data, undo_data);
+
+	//Select the copies, so they can be moved right away
+	for (int i = 0; i < _graph_edit->get_child_count(); i++) {
+		ProceduralAnimationEditorGraphNode *gn = Object::cast_to<ProceduralAnimationEditorGraphNode>(_graph_edit->get_child(i));
+
+		if (gn && !gn->is_queued_for_deletion()) {
+			gn->set_selected(gn->get_id() >= first_id);
+		}
+	}
 }
 
 void ProceduralAnimationEditor::_notification(int p_what) {
@@ -312,10 +751,20 @@ void ProceduralAnimationEditor::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("on_delete_popup_confirmed"), &ProceduralAnimationEditor::on_delete_popup_confirmed);
 
 	ClassDB::bind_method(D_METHOD("add_frame_button_pressed"), &ProceduralAnimationEditor::add_frame_button_pressed);
+	ClassDB::bind_method(D_METHOD("generate_key_poses_button_pressed"), &ProceduralAnimationEditor::generate_key_poses_button_pressed);
 
 	ClassDB::bind_method(D_METHOD("on_connection_request", "from", "from_slot", "to", "to_slot"), &ProceduralAnimationEditor::on_connection_request);
 	ClassDB::bind_method(D_METHOD("on_disconnection_request", "from", "from_slot", "to", "to_slot"), &ProceduralAnimationEditor::on_disconnection_request);
 	ClassDB::bind_method(D_METHOD("on_delete_nodes_request"), &ProceduralAnimationEditor::on_delete_nodes_request);
+	ClassDB::bind_method(D_METHOD("on_begin_node_move"), &ProceduralAnimationEditor::on_begin_node_move);
+	ClassDB::bind_method(D_METHOD("on_end_node_move"), &ProceduralAnimationEditor::on_end_node_move);
+
+	ClassDB::bind_method(D_METHOD("_apply_keyframe_diff", "animation", "data"), &ProceduralAnimationEditor::_apply_keyframe_diff);
+	ClassDB::bind_method(D_METHOD("_replace_keyframe_data", "animation", "data"), &ProceduralAnimationEditor::_replace_keyframe_data);
+
+	ClassDB::bind_method(D_METHOD("on_selection_menu_id_pressed", "id"), &ProceduralAnimationEditor::on_selection_menu_id_pressed);
+	ClassDB::bind_method(D_METHOD("on_bulk_popup_confirmed"), &ProceduralAnimationEditor::on_bulk_popup_confirmed);
+	ClassDB::bind_method(D_METHOD("duplicate_selected_keyframes"), &ProceduralAnimationEditor::duplicate_selected_keyframes);
 
 	ClassDB::bind_method(D_METHOD("get_animation_target_animation"), &ProceduralAnimationEditor::get_animation_target_animation);
 	ClassDB::bind_method(D_METHOD("set_animation_target_animation", "animation"), &ProceduralAnimationEditor::set_animation_target_animation);
@@ -323,12 +772,18 @@ void ProceduralAnimationEditor::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD("on_animation_fps_changed", "value"), &ProceduralAnimationEditor::on_animation_fps_changed);
 	ClassDB::bind_method(D_METHOD("on_loop_checkbox_toggled", "value"), &ProceduralAnimationEditor::on_loop_checkbox_toggled);
+	ClassDB::bind_method(D_METHOD("update_animation_settings"), &ProceduralAnimationEditor::update_animation_settings);
 }
 
 ProceduralAnimationEditor::ProceduralAnimationEditor() {
+	_undo_redo = NULL;
+	_bulk_action = SELECTION_MENU_SCALE_TIMES;
 }
 
 ProceduralAnimationEditor::ProceduralAnimationEditor(EditorNode *p_editor) {
+	_undo_redo = p_editor->get_undo_redo();
+	_bulk_action = SELECTION_MENU_SCALE_TIMES;
+
 	set_h_size_flags(SIZE_EXPAND_FILL);
 
 	//top bar
@@ -390,6 +845,34 @@ ProceduralAnimationEditor::ProceduralAnimationEditor(EditorNode *p_editor) {
 
 	hbc->add_child(aafb);
 
+	Button *gkpb = memnew(Button);
+	gkpb->set_text("generate key poses");
+	gkpb->set_tooltip(TTR("Replaces the keyframes with a chain through the key poses of the source animation."));
+
+#if VERSION_MAJOR < 4
+	gkpb->connect("pressed", this, "generate_key_poses_button_pressed");
+#else
+	gkpb->connect("pressed", callable_mp(this, &ProceduralAnimationEditor::generate_key_poses_button_pressed));
+#endif
+
+	hbc->add_child(gkpb);
+
+	_selection_menu = memnew(MenuButton);
+	_selection_menu->set_text(TTR("Selection"));
+	_selection_menu->set_tooltip(TTR("Bulk edit the selected keyframes, every edit is one undo action and one rebake."));
+	_selection_menu->get_popup()->add_item(TTR("Scale Times..."), SELECTION_MENU_SCALE_TIMES);
+	_selection_menu->get_popup()->add_item(TTR("Set Easing..."), SELECTION_MENU_SET_EASING);
+	_selection_menu->get_popup()->add_item(TTR("Shift Source Frames..."), SELECTION_MENU_SHIFT_ANIMATION_KEYFRAME);
+	_selection_menu->get_popup()->add_item(TTR("Duplicate"), SELECTION_MENU_DUPLICATE);
+
+#if VERSION_MAJOR < 4
+	_selection_menu->get_popup()->connect("id_pressed", this, "on_selection_menu_id_pressed");
+#else
+	_selection_menu->get_popup()->connect("id_pressed", callable_mp(this, &ProceduralAnimationEditor::on_selection_menu_id_pressed));
+#endif
+
+	hbc->add_child(_selection_menu);
+
 	_pin = memnew(ToolButton);
 	_pin->set_toggle_mode(true);
 	_pin->set_tooltip(TTR("Pin"));
@@ -406,10 +889,16 @@ ProceduralAnimationEditor::ProceduralAnimationEditor(EditorNode *p_editor) {
 	_graph_edit->connect("connection_request", this, "on_connection_request");
 	_graph_edit->connect("disconnection_request", this, "on_disconnection_request");
 	_graph_edit->connect("delete_nodes_request", this, "on_delete_nodes_request");
+	_graph_edit->connect("duplicate_nodes_request", this, "duplicate_selected_keyframes");
+	_graph_edit->connect("_begin_node_move", this, "on_begin_node_move");
+	_graph_edit->connect("_end_node_move", this, "on_end_node_move");
 #else
 	_graph_edit->connect("connection_request", callable_mp(this, &ProceduralAnimationEditor::on_connection_request));
 	_graph_edit->connect("disconnection_request", callable_mp(this, &ProceduralAnimationEditor::on_disconnection_request));
 	_graph_edit->connect("delete_nodes_request", callable_mp(this, &ProceduralAnimationEditor::on_delete_nodes_request));
+	_graph_edit->connect("duplicate_nodes_request", callable_mp(this, &ProceduralAnimationEditor::duplicate_selected_keyframes));
+	_graph_edit->connect("begin_node_move", callable_mp(this, &ProceduralAnimationEditor::on_begin_node_move));
+	_graph_edit->connect("end_node_move", callable_mp(this, &ProceduralAnimationEditor::on_end_node_move));
 #endif
 
 	add_child(_graph_edit);
@@ -444,6 +933,26 @@ ProceduralAnimationEditor::ProceduralAnimationEditor(EditorNode *p_editor) {
 	dellabel->set_text("Delete?");
 	_delete_popuop->add_child(dellabel);
 
+	//bulk edit popup
+	_bulk_popup = memnew(ConfirmationDialog);
+
+#if VERSION_MAJOR < 4
+	_bulk_popup->connect("confirmed", this, "on_bulk_popup_confirmed");
+#else
+	_bulk_popup->connect("confirmed", callable_mp(this, &ProceduralAnimationEditor::on_bulk_popup_confirmed));
+#endif
+
+	popups->add_child(_bulk_popup);
+
+	VBoxContainer *bulk_popup_container = memnew(VBoxContainer);
+	_bulk_popup->add_child(bulk_popup_container);
+
+	_bulk_popup_label = memnew(Label);
+	bulk_popup_container->add_child(_bulk_popup_label);
+
+	_bulk_popup_spinbox = memnew(SpinBox);
+	bulk_popup_container->add_child(_bulk_popup_spinbox);
+
 	//name popup
 	_name_popuop = memnew(ConfirmationDialog);
 	//_name_popuop->connect("confirmed", this, "on_name_popup_confirmed");
@@ -483,7 +992,7 @@ void ProceduralAnimationEditorGraphNode::set_keyframe_name(const String &value)
 	if (!_animation.is_valid())
 		return;
 
-	_animation->set_keyframe_name(_id, value);
+	_editor->change_keyframe_field(_id, "names", value, TTR("Rename Keyframe"));
 
 	changed();
 }
@@ -505,7 +1014,44 @@ void ProceduralAnimationEditorGraphNode::set_animation_keyframe_index(const int
 	if (!_animation.is_valid())
 		return;
 
-	_animation->set_keyframe_animation_keyframe_index(_id, value);
+	_editor->change_keyframe_field(_id, "animation_keyframe_indices", value, TTR("Change Keyframe Source Frame"));
+
+	changed();
+}
+
+int ProceduralAnimationEditorGraphNode::get_blend_animation_keyframe_index() const {
+	return _blend_animation_keyframe_index;
+}
+void ProceduralAnimationEditorGraphNode::set_blend_animation_keyframe_index(const int value) {
+	if (_blend_animation_keyframe_index == value)
+		return;
+
+	_blend_keyframe_spinbox->set_value(value);
+
+	_blend_animation_keyframe_index = value;
+
+	if (!_animation.is_valid())
+		return;
+
+	_editor->change_keyframe_field(_id, "blend_animation_keyframe_indices", value, TTR("Change Keyframe Blend Frame"));
+
+	changed();
+}
+
+float ProceduralAnimationEditorGraphNode::get_blend_weight() const {
+	return _blend_weight;
+}
+void ProceduralAnimationEditorGraphNode::set_blend_weight(const float value) {
+	if (Math::is_equal_approx(value, _blend_weight))
+		return;
+
+	_blend_weight = value;
+	_blend_weight_spinbox->set_value(value);
+
+	if (!_animation.is_valid())
+		return;
+
+	_editor->change_keyframe_field(_id, "blend_weights", value, TTR("Change Keyframe Blend Weight"));
 
 	changed();
 }
@@ -519,7 +1065,7 @@ void ProceduralAnimationEditorGraphNode::set_next_keyframe(const int value) {
 	if (!_animation.is_valid())
 		return;
 
-	_animation->set_keyframe_next_keyframe_index(_id, value);
+	_editor->change_keyframe_field(_id, "next_keyframes", value, TTR("Connect Keyframes"));
 
 	changed();
 }
@@ -533,7 +1079,7 @@ void ProceduralAnimationEditorGraphNode::set_transition(const float value) {
 	if (!_animation.is_valid())
 		return;
 
-	_animation->set_keyframe_transition(_id, value);
+	_editor->change_keyframe_field(_id, "transitions", value, TTR("Change Keyframe Easing"));
 
 	changed();
 }
@@ -551,7 +1097,7 @@ void ProceduralAnimationEditorGraphNode::set_time(const float value) {
 	if (!_animation.is_valid())
 		return;
 
-	_animation->set_keyframe_time(_id, value);
+	_editor->change_keyframe_field(_id, "times", value, TTR("Change Keyframe Time"));
 
 	changed();
 }
@@ -565,7 +1111,7 @@ void ProceduralAnimationEditorGraphNode::set_method_name(const String &value) {
 	if (!_animation.is_valid())
 		return;
 
-	_animation->set_method_name(_id, value);
+	_editor->change_keyframe_field(_id, "method_names", value, TTR("Change Keyframe Method"));
 
 	changed();
 }
@@ -577,23 +1123,40 @@ Ref<ProceduralAnimation> ProceduralAnimationEditorGraphNode::get_animation() {
 	return _animation;
 }
 void ProceduralAnimationEditorGraphNode::set_animation(const Ref<ProceduralAnimation> &animation) {
-	_animation.unref();
-
-	if (!animation.is_valid())
+	if (!animation.is_valid()) {
+		_animation.unref();
 		return;
+	}
+
+	load_keyframe(animation,
+			animation->get_keyframe_name(_id),
+			animation->get_keyframe_animation_keyframe_index(_id),
+			animation->get_keyframe_blend_animation_keyframe_index(_id),
+			animation->get_keyframe_blend_weight(_id),
+			animation->get_keyframe_next_keyframe_index(_id),
+			animation->get_keyframe_transition(_id),
+			animation->get_keyframe_time(_id),
+			animation->get_method_name(_id),
+			animation->get_keyframe_node_position(_id));
+}
+void ProceduralAnimationEditorGraphNode::load_keyframe(const Ref<ProceduralAnimation> &animation, const String &name, const int animation_keyframe_index, const int blend_animation_keyframe_index, const float blend_weight, const int next_keyframe, const float transition, const float time, const String &method_name, const Vector2 &position) {
+	//Unset while loading, so the setters below don't write the values back into the resource
+	_animation.unref();
 
 #if VERSION_MAJOR > 3
-	set_position_offset(animation->get_keyframe_node_position(_id));
+	set_position_offset(position);
 #else
-	set_offset(animation->get_keyframe_node_position(_id));
+	set_offset(position);
 #endif
 
-	set_keyframe_name(animation->get_keyframe_name(_id));
-	set_next_keyframe(animation->get_keyframe_next_keyframe_index(_id));
-	set_transition(animation->get_keyframe_transition(_id));
-	set_animation_keyframe_index(animation->get_keyframe_animation_keyframe_index(_id));
-	set_time(animation->get_keyframe_time(_id));
-	set_method_name(animation->get_method_name(_id));
+	set_keyframe_name(name);
+	set_next_keyframe(next_keyframe);
+	set_transition(transition);
+	set_animation_keyframe_index(animation_keyframe_index);
+	set_blend_animation_keyframe_index(blend_animation_keyframe_index);
+	set_blend_weight(blend_weight);
+	set_time(time);
+	set_method_name(method_name);
 
 	_animation = animation;
 }
@@ -604,6 +1167,8 @@ ProceduralAnimationEditorGraphNode::ProceduralAnimationEditorGraphNode(Procedura
 	_id = 0;
 
 	_animation_keyframe_index = 0;
+	_blend_animation_keyframe_index = -1;
+	_blend_weight = 0;
 	_next_keyframe = -1;
 	_time = 1;
 	_transition = 1.0;
@@ -639,6 +1204,42 @@ ProceduralAnimationEditorGraphNode::ProceduralAnimationEditorGraphNode(Procedura
 
 	add_child(_animation_keyframe_spinbox);
 
+	Label *lb = memnew(Label);
+	lb->set_text("Blend Keyframe");
+	add_child(lb);
+
+	_blend_keyframe_spinbox = memnew(SpinBox);
+	_blend_keyframe_spinbox->set_min(-1);
+	_blend_keyframe_spinbox->set_max(999999999);
+	_blend_keyframe_spinbox->set_value(-1);
+	_blend_keyframe_spinbox->set_h_size_flags(SIZE_EXPAND_FILL);
+
+#if VERSION_MAJOR < 4
+	_blend_keyframe_spinbox->connect("value_changed", this, "on_blend_keyframe_spinbox_value_changed");
+#else
+	_blend_keyframe_spinbox->connect("value_changed", callable_mp(this, &ProceduralAnimationEditorGraphNode::on_blend_keyframe_spinbox_value_changed));
+#endif
+
+	add_child(_blend_keyframe_spinbox);
+
+	Label *lbw = memnew(Label);
+	lbw->set_text("Blend Weight");
+	add_child(lbw);
+
+	_blend_weight_spinbox = memnew(SpinBox);
+	_blend_weight_spinbox->set_min(0);
+	_blend_weight_spinbox->set_max(1);
+	_blend_weight_spinbox->set_step(0.01);
+	_blend_weight_spinbox->set_h_size_flags(SIZE_EXPAND_FILL);
+
+#if VERSION_MAJOR < 4
+	_blend_weight_spinbox->connect("value_changed", this, "on_blend_weight_spinbox_value_changed");
+#else
+	_blend_weight_spinbox->connect("value_changed", callable_mp(this, &ProceduralAnimationEditorGraphNode::on_blend_weight_spinbox_value_changed));
+#endif
+
+	add_child(_blend_weight_spinbox);
+
 	Label *lt = memnew(Label);
 	lt->set_text("Time");
 	add_child(lt);
@@ -697,16 +1298,19 @@ void ProceduralAnimationEditorGraphNode::on_time_spinbox_value_changed(float val
 	set_time(value);
 }
 
+void ProceduralAnimationEditorGraphNode::on_blend_keyframe_spinbox_value_changed(float value) {
+	set_blend_animation_keyframe_index(value);
+}
+
+void ProceduralAnimationEditorGraphNode::on_blend_weight_spinbox_value_changed(float value) {
+	set_blend_weight(value);
+}
+
 void ProceduralAnimationEditorGraphNode::on_offset_changed() {
 	if (!_animation.is_valid())
 		return;
 
-#if VERSION_MAJOR > 3
-	_animation->set_keyframe_node_position(_id, get_position_offset());
-#else
-	_animation->set_keyframe_node_position(_id, get_offset());
-#endif
-
+	//The resource is updated once the drag ends, see ProceduralAnimationEditor::on_end_node_move()
 	changed();
 }
 
@@ -745,6 +1349,8 @@ void ProceduralAnimationEditorGraphNode::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("changed"), &ProceduralAnimationEditorGraphNode::changed);
 	ClassDB::bind_method(D_METHOD("on_animation_keyframe_spinbox_value_changed", "value"), &ProceduralAnimationEditorGraphNode::on_animation_keyframe_spinbox_value_changed);
 	ClassDB::bind_method(D_METHOD("on_time_spinbox_value_changed", "value"), &ProceduralAnimationEditorGraphNode::on_time_spinbox_value_changed);
+	ClassDB::bind_method(D_METHOD("on_blend_keyframe_spinbox_value_changed", "value"), &ProceduralAnimationEditorGraphNode::on_blend_keyframe_spinbox_value_changed);
+	ClassDB::bind_method(D_METHOD("on_blend_weight_spinbox_value_changed", "value"), &ProceduralAnimationEditorGraphNode::on_blend_weight_spinbox_value_changed);
 
 	ClassDB::bind_method(D_METHOD("on_offset_changed"), &ProceduralAnimationEditorGraphNode::on_offset_changed);
 
@@ -813,6 +1419,10 @@ ProceduralAnimationEditorPlugin::ProceduralAnimationEditorPlugin(EditorNode *p_n
 	animation_editor_button = add_control_to_bottom_panel(animation_editor, "Procedural Animations");
 
 	animation_editor->hide();
+
+	Ref<ProceduralAnimationExportPlugin> export_plugin;
+	export_plugin.instance();
+	add_export_plugin(export_plugin);
 }
 
 ProceduralAnimationEditorPlugin::~ProceduralAnimationEditorPlugin() {
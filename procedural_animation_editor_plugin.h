@@ -39,6 +39,7 @@ SOFTWARE.
 
 class EditorPropertyEasing;
 class EditorPropertyResource;
+class UndoRedo;
 
 class ProceduralAnimationEditor : public VBoxContainer {
 	GDCLASS(ProceduralAnimationEditor, VBoxContainer);
@@ -48,13 +49,22 @@ public:
 		DELETE_POPUP_KEYFRAME,
 	};
 
+	enum SelectionMenuOptions {
+		SELECTION_MENU_SCALE_TIMES = 0,
+		SELECTION_MENU_SET_EASING,
+		SELECTION_MENU_SHIFT_ANIMATION_KEYFRAME,
+		SELECTION_MENU_DUPLICATE,
+	};
+
 public:
 	void edit(const Ref<ProceduralAnimation> &animation);
 
 	void add_frame_button_pressed();
+	void generate_key_poses_button_pressed();
 
 	void load_animation();
 	void clear_keyframe_nodes();
+	void update_connections();
 
 	void on_keyframe_node_changed(Node *node);
 
@@ -66,6 +76,22 @@ public:
 
 	void _delete_request(const StringName &name);
 
+	//Undo/redo. Every action stores two keyframe diffs in the form ProceduralAnimation::update_keyframe_data() takes,
+	//so applying either side is one rebake, and only the touched graph nodes are refreshed.
+	void change_keyframe_field(const int id, const String &field, const Variant &value, const String &action_name);
+	void delete_keyframes(const PoolVector<int> &ids);
+	void commit_keyframe_change(const String &action_name, const Dictionary &do_data, const Dictionary &undo_data, const bool merge = false);
+	void _apply_keyframe_diff(const Ref<ProceduralAnimation> &animation, const Dictionary &data);
+	void _replace_keyframe_data(const Ref<ProceduralAnimation> &animation, const Dictionary &data);
+	void on_begin_node_move();
+	void on_end_node_move();
+
+	//Bulk operations on the selected graph nodes, each one is a single action
+	PoolVector<int> get_selected_keyframes() const;
+	void on_selection_menu_id_pressed(const int id);
+	void on_bulk_popup_confirmed();
+	void duplicate_selected_keyframes();
+
 	ProceduralAnimationEditor();
 	ProceduralAnimationEditor(EditorNode *p_editor);
 	~ProceduralAnimationEditor();
@@ -76,6 +102,8 @@ protected:
 
 	void on_animation_fps_changed(const float value);
 	void on_loop_checkbox_toggled(const bool value);
+	void commit_animation_setting(const String &action_name, const StringName &setter, const Variant &value, const Variant &old_value);
+	void update_animation_settings();
 
 	void _notification(int p_what);
 	static void _bind_methods();
@@ -97,6 +125,15 @@ private:
 	GraphEdit *_graph_edit;
 
 	ToolButton *_pin;
+
+	MenuButton *_selection_menu;
+	SelectionMenuOptions _bulk_action;
+	ConfirmationDialog *_bulk_popup;
+	Label *_bulk_popup_label;
+	SpinBox *_bulk_popup_spinbox;
+
+	UndoRedo *_undo_redo;
+	Dictionary _node_move_undo_data;
 };
 
 class ProceduralAnimationEditorGraphNode : public GraphNode {
@@ -113,6 +150,12 @@ public:
 	int get_animation_keyframe_index() const;
 	void set_animation_keyframe_index(const int value);
 
+	int get_blend_animation_keyframe_index() const;
+	void set_blend_animation_keyframe_index(const int value);
+
+	float get_blend_weight() const;
+	void set_blend_weight(const float value);
+
 	int get_next_keyframe() const;
 	void set_next_keyframe(const int value);
 
@@ -128,6 +171,7 @@ public:
 
 	Ref<ProceduralAnimation> get_animation();
 	void set_animation(const Ref<ProceduralAnimation> &animation);
+	void load_keyframe(const Ref<ProceduralAnimation> &animation, const String &name, const int animation_keyframe_index, const int blend_animation_keyframe_index, const float blend_weight, const int next_keyframe, const float transition, const float time, const String &method_name, const Vector2 &position);
 
 	ProceduralAnimationEditorGraphNode(ProceduralAnimationEditor *editor);
 	~ProceduralAnimationEditorGraphNode();
@@ -135,6 +179,8 @@ public:
 protected:
 	void on_animation_keyframe_spinbox_value_changed(float value);
 	void on_time_spinbox_value_changed(float value);
+	void on_blend_keyframe_spinbox_value_changed(float value);
+	void on_blend_weight_spinbox_value_changed(float value);
 
 	void on_offset_changed();
 
@@ -152,8 +198,12 @@ private:
 	LineEdit *_name;
 	SpinBox *_animation_keyframe_spinbox;
 	SpinBox *_time_spinbox;
+	SpinBox *_blend_keyframe_spinbox;
+	SpinBox *_blend_weight_spinbox;
 
 	int _animation_keyframe_index;
+	int _blend_animation_keyframe_index;
+	float _blend_weight;
 	int _next_keyframe;
 	EditorPropertyEasing *_transition_editor;
 	float _transition;
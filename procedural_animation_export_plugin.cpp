@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "procedural_animation_export_plugin.h"
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/config/project_settings.h"
+#else
+#include "core/project_settings.h"
+#endif
+
+#include "core/io/resource_loader.h"
+#include "core/io/resource_saver.h"
+#include "core/os/dir_access.h"
+#include "core/os/file_access.h"
+#include "editor/editor_settings.h"
+
+#include "procedural_animation.h"
+
+const char *ProceduralAnimationExportPlugin::STRIP_EDITOR_DATA_SETTING = "procedural_animations/export/strip_editor_data";
+const char *ProceduralAnimationExportPlugin::STRIP_KEYFRAME_GRAPH_SETTING = "procedural_animations/export/strip_keyframe_graph";
+
+void ProceduralAnimationExportPlugin::register_settings() {
+	GLOBAL_DEF(STRIP_EDITOR_DATA_SETTING, true);
+	GLOBAL_DEF(STRIP_KEYFRAME_GRAPH_SETTING, false);
+}
+
+//Only standalone resource files are handled, ProceduralAnimations that are embedded into scenes are exported as they are.
+void ProceduralAnimationExportPlugin::_export_file(const String &p_path, const String &p_type, const Set<String> &p_features) {
+	if (p_type != "ProceduralAnimation")
+		return;
+
+	bool strip_editor_data = GLOBAL_GET(STRIP_EDITOR_DATA_SETTING);
+	bool strip_keyframe_graph = GLOBAL_GET(STRIP_KEYFRAME_GRAPH_SETTING);
+
+	//Server exports only get the tracks headless mode evaluates
+	int headless_mode = GLOBAL_GET(ProceduralAnimation::HEADLESS_MODE_SETTING);
+	bool strip_headless = headless_mode != ProceduralAnimation::HEADLESS_MODE_DISABLED && (p_features.has("Server") || p_features.has("headless"));
+
+	if (!strip_editor_data && !strip_keyframe_graph && !strip_headless)
+		return;
+
+	Ref<ProceduralAnimation> animation = ResourceLoader::load(p_path);
+
+	ERR_FAIL_COND_MSG(!animation.is_valid(), "ProceduralAnimationExportPlugin: Could not load " + p_path);
+
+	//The loaded resource is the one the editor uses, only the copy can be stripped.
+	Ref<ProceduralAnimation> stripped = animation->duplicate();
+
+	ERR_FAIL_COND(!stripped.is_valid());
+
+	if (strip_editor_data || strip_keyframe_graph)
+		stripped->strip_editor_data(strip_keyframe_graph);
+
+	if (strip_headless)
+		stripped->strip_headless_tracks();
+
+	String tmp_path = EditorSettings::get_singleton()->get_cache_dir().plus_file("procedural_animation_export." + p_path.get_extension());
+
+	Error err = ResourceSaver::save(tmp_path, stripped);
+
+	ERR_FAIL_COND_MSG(err != OK, "ProceduralAnimationExportPlugin: Could not save the stripped copy of " + p_path);
+
+	Vector<uint8_t> data = FileAccess::get_file_as_array(tmp_path);
+
+	DirAccess *da = DirAccess::create(DirAccess::ACCESS_FILESYSTEM);
+	da->remove(tmp_path);
+	memdelete(da);
+
+	ERR_FAIL_COND_MSG(data.size() == 0, "ProceduralAnimationExportPlugin: Could not read the stripped copy of " + p_path);
+
+	add_file(p_path, data, false);
+	skip();
+}
+
+ProceduralAnimationExportPlugin::ProceduralAnimationExportPlugin() {
+}
+
+ProceduralAnimationExportPlugin::~ProceduralAnimationExportPlugin() {
+}
@@ -0,0 +1,47 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef PROCEDURAL_ANIMATION_EXPORT_PLUGIN_H
+#define PROCEDURAL_ANIMATION_EXPORT_PLUGIN_H
+
+#include "editor/editor_export.h"
+
+//Strips editor only data (graph node positions, keyframe names) from the exported ProceduralAnimation
+//resources, and optionally the whole keyframe graph, keeping only the baked tracks.
+//Controlled by the procedural_animations/export/* project settings.
+class ProceduralAnimationExportPlugin : public EditorExportPlugin {
+	GDCLASS(ProceduralAnimationExportPlugin, EditorExportPlugin);
+
+public:
+	static const char *STRIP_EDITOR_DATA_SETTING;
+	static const char *STRIP_KEYFRAME_GRAPH_SETTING;
+
+	static void register_settings();
+
+	ProceduralAnimationExportPlugin();
+	~ProceduralAnimationExportPlugin();
+
+protected:
+	virtual void _export_file(const String &p_path, const String &p_type, const Set<String> &p_features);
+};
+
+#endif
@@ -0,0 +1,453 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "procedural_animation_key_pose_extractor.h"
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/templates/thread_work_pool.h"
+#else
+#include "core/os/thread.h"
+#include "core/safe_refcount.h"
+#endif
+
+#include "core/os/os.h"
+
+int ProceduralAnimationKeyPoseExtractor::get_max_key_poses() const {
+	return _max_key_poses;
+}
+void ProceduralAnimationKeyPoseExtractor::set_max_key_poses(const int value) {
+	_max_key_poses = value;
+}
+
+int ProceduralAnimationKeyPoseExtractor::get_min_frame_distance() const {
+	return _min_frame_distance;
+}
+void ProceduralAnimationKeyPoseExtractor::set_min_frame_distance(const int value) {
+	_min_frame_distance = value;
+}
+
+float ProceduralAnimationKeyPoseExtractor::get_min_score() const {
+	return _min_score;
+}
+void ProceduralAnimationKeyPoseExtractor::set_min_score(const float value) {
+	_min_score = value;
+}
+
+float ProceduralAnimationKeyPoseExtractor::get_velocity_extremum_weight() const {
+	return _velocity_extremum_weight;
+}
+void ProceduralAnimationKeyPoseExtractor::set_velocity_extremum_weight(const float value) {
+	_velocity_extremum_weight = value;
+}
+
+int ProceduralAnimationKeyPoseExtractor::get_thread_count() const {
+	return _thread_count;
+}
+void ProceduralAnimationKeyPoseExtractor::set_thread_count(const int value) {
+	_thread_count = value;
+}
+
+//One score per frame. The first and the last frame always get the highest score.
+PoolVector<real_t> ProceduralAnimationKeyPoseExtractor::score_frames(const Ref<Animation> &source, const int fps) {
+	ERR_FAIL_COND_V(!source.is_valid(), PoolVector<real_t>());
+	ERR_FAIL_COND_V(fps <= 0, PoolVector<real_t>());
+
+	_source = source.ptr();
+	_key_step = 1.0 / static_cast<float>(fps);
+	_frame_count = static_cast<int>(Math::floor(source->get_length() * fps + CMP_EPSILON)) + 1;
+
+	_tracks.clear();
+
+	for (int i = 0; i < source->get_track_count(); ++i) {
+		if (source->track_get_type(i) == Animation::TYPE_TRANSFORM && source->track_is_enabled(i))
+			_tracks.push_back(i);
+	}
+
+	_features.resize(_frame_count * _tracks.size() * FEATURES_PER_TRACK);
+	_scores.resize(_frame_count);
+
+	//The jobs write through these, ptrw() is not safe to call from multiple threads
+	_features_ptr = _features.ptrw();
+	_scores_ptr = _scores.ptrw();
+
+	_run_pass(JOB_PASS_SAMPLE, _frame_count);
+
+	//Rotations are compared as vectors, so neighbouring frames have to be in the same hemisphere.
+	//Depends on the previous frame, so it stays on this thread.
+	int row = _tracks.size() * FEATURES_PER_TRACK;
+
+	for (int f = 1; f < _frame_count; ++f) {
+		for (int t = 0; t < _tracks.size(); ++t) {
+			const float *p = _features_ptr + (f - 1) * row + t * FEATURES_PER_TRACK + 3;
+			float *c = _features_ptr + f * row + t * FEATURES_PER_TRACK + 3;
+
+			if (p[0] * c[0] + p[1] * c[1] + p[2] * c[2] + p[3] * c[3] < 0) {
+				c[0] = -c[0];
+				c[1] = -c[1];
+				c[2] = -c[2];
+				c[3] = -c[3];
+			}
+		}
+	}
+
+	_run_pass(JOB_PASS_SCORE, _frame_count);
+
+	PoolVector<real_t> scores;
+	scores.resize(_frame_count);
+
+	for (int f = 0; f < _frame_count; ++f) {
+		scores.set(f, _scores[f]);
+	}
+
+	_source = NULL;
+	_features.clear();
+	_scores.clear();
+	_features_ptr = NULL;
+	_scores_ptr = NULL;
+
+	return scores;
+}
+
+//The selected frames in ascending order. Always contains the first and the last frame.
+PoolVector<int> ProceduralAnimationKeyPoseExtractor::extract_key_frames(const Ref<Animation> &source, const int fps) {
+	PoolVector<real_t> scores = score_frames(source, fps);
+
+	int frame_count = scores.size();
+
+	if (frame_count == 0)
+		return PoolVector<int>();
+
+	Vector<FrameScore> sorted;
+	float max_score = 0;
+
+	for (int f = 0; f < frame_count; ++f) {
+		FrameScore fs;
+		fs.frame = f;
+		fs.score = scores[f];
+		sorted.push_back(fs);
+
+		if (f != 0 && f != frame_count - 1)
+			max_score = MAX(max_score, fs.score);
+	}
+
+	sorted.sort();
+
+	Vector<int> selected;
+
+	for (int i = 0; i < sorted.size(); ++i) {
+		const FrameScore &fs = sorted[i];
+
+		bool endpoint = fs.frame == 0 || fs.frame == frame_count - 1;
+
+		if (!endpoint) {
+			if (_max_key_poses > 0 && selected.size() >= _max_key_poses)
+				break;
+
+			if (max_score <= CMP_EPSILON || fs.score < _min_score * max_score)
+				break;
+		}
+
+		bool too_close = false;
+
+		for (int j = 0; j < selected.size(); ++j) {
+			if (ABS(selected[j] - fs.frame) < _min_frame_distance) {
+				too_close = true;
+				break;
+			}
+		}
+
+		if (too_close && !endpoint)
+			continue;
+
+		if (selected.find(fs.frame) == -1)
+			selected.push_back(fs.frame);
+	}
+
+	selected.sort();
+
+	PoolVector<int> frames;
+	frames.resize(selected.size());
+
+	for (int i = 0; i < selected.size(); ++i) {
+		frames.set(i, selected[i]);
+	}
+
+	return frames;
+}
+
+//Replaces the keyframes of animation with a chain through the key poses of its source, then bakes once.
+//Returns the number of keyframes.
+int ProceduralAnimationKeyPoseExtractor::generate_keyframes(const Ref<ProceduralAnimation> &animation) {
+	Dictionary data = generate_keyframe_data(animation);
+
+	if (!data.has("indices"))
+		return 0;
+
+	animation->set_keyframe_data(data);
+
+	PoolVector<int> indices = data["indices"];
+
+	return indices.size();
+}
+
+//The keyframes generate_keyframes() would set, in the form ProceduralAnimation::set_keyframe_data() takes.
+//Returns an empty Dictionary on error.
+Dictionary ProceduralAnimationKeyPoseExtractor::generate_keyframe_data(const Ref<ProceduralAnimation> &animation) {
+	ERR_FAIL_COND_V(!animation.is_valid(), Dictionary());
+
+	Ref<Animation> source = animation->get_animation();
+
+	ERR_FAIL_COND_V_MSG(!source.is_valid(), Dictionary(), "ProceduralAnimationKeyPoseExtractor: The ProceduralAnimation doesn't have a source animation.");
+
+	int fps = animation->get_animation_fps();
+	PoolVector<int> frames = extract_key_frames(source, fps);
+
+	int size = frames.size();
+	float key_step = 1.0 / static_cast<float>(fps);
+
+	PoolVector<int> indices;
+	PoolVector<String> names;
+	PoolVector<int> next_keyframes;
+	PoolVector<real_t> times;
+	PoolVector<Vector2> positions;
+
+	indices.resize(size);
+	names.resize(size);
+	next_keyframes.resize(size);
+	times.resize(size);
+	positions.resize(size);
+
+	for (int i = 0; i < size; ++i) {
+		int next_frame = i + 1 < size ? frames[i + 1] : frames[i] + 1;
+
+		indices.set(i, i);
+		names.set(i, "Frame " + itos(frames[i]));
+		next_keyframes.set(i, i + 1 < size ? i + 1 : -1);
+		times.set(i, (next_frame - frames[i]) * key_step);
+		positions.set(i, animation->get_start_node_position() + Vector2(300 * (i + 1), 0));
+	}
+
+	Dictionary data;
+	data["start_frame_index"] = size > 0 ? 0 : -1;
+	data["indices"] = indices;
+	data["names"] = names;
+	data["animation_keyframe_indices"] = frames;
+	data["next_keyframes"] = next_keyframes;
+	data["times"] = times;
+	data["positions"] = positions;
+
+	return data;
+}
+
+ProceduralAnimationKeyPoseExtractor::ProceduralAnimationKeyPoseExtractor() {
+	_max_key_poses = 0;
+	_min_frame_distance = 2;
+	_min_score = 0.1;
+	_velocity_extremum_weight = 1;
+	_thread_count = 0;
+
+	_source = NULL;
+	_key_step = 0;
+	_frame_count = 0;
+	_features_ptr = NULL;
+	_scores_ptr = NULL;
+
+	_current_pass = JOB_PASS_SAMPLE;
+	_job_count = 0;
+	_next_job = 0;
+}
+
+ProceduralAnimationKeyPoseExtractor::~ProceduralAnimationKeyPoseExtractor() {
+}
+
+void ProceduralAnimationKeyPoseExtractor::_run_pass(const JobPass pass, const int count) {
+	if (count <= 0)
+		return;
+
+	int thread_count = _thread_count;
+
+	if (thread_count <= 0) {
+		thread_count = OS::get_singleton()->get_processor_count();
+	}
+
+	thread_count = CLAMP(thread_count, 1, count);
+
+#if VERSION_MAJOR > 3
+	ThreadWorkPool pool;
+	pool.init(thread_count);
+	pool.do_work(count, this, &ProceduralAnimationKeyPoseExtractor::_job, static_cast<int>(pass));
+	pool.finish();
+#else
+	_current_pass = pass;
+	_job_count = count;
+	_next_job = 0;
+
+	Vector<Thread *> threads;
+
+	for (int i = 0; i < thread_count; ++i) {
+		threads.push_back(Thread::create(_job_thread_func, this));
+	}
+
+	for (int i = 0; i < threads.size(); ++i) {
+		Thread::wait_to_finish(threads[i]);
+		memdelete(threads[i]);
+	}
+#endif
+}
+
+void ProceduralAnimationKeyPoseExtractor::_job(uint32_t p_index, int p_pass) {
+	if (p_pass == JOB_PASS_SAMPLE)
+		_sample_frame(p_index);
+	else
+		_score_frame(p_index);
+}
+
+void ProceduralAnimationKeyPoseExtractor::_sample_frame(const int frame) {
+	float time = MIN(frame * _key_step, _source->get_length());
+	float *row = _features_ptr + frame * _tracks.size() * FEATURES_PER_TRACK;
+
+	for (int t = 0; t < _tracks.size(); ++t) {
+		Vector3 loc;
+		Quat rot;
+		Vector3 scale(1, 1, 1);
+
+		_source->transform_track_interpolate(_tracks[t], time, &loc, &rot, &scale);
+
+		float *f = row + t * FEATURES_PER_TRACK;
+
+		f[0] = loc.x;
+		f[1] = loc.y;
+		f[2] = loc.z;
+		f[3] = rot.x;
+		f[4] = rot.y;
+		f[5] = rot.z;
+		f[6] = rot.w;
+		f[7] = scale.x;
+		f[8] = scale.y;
+		f[9] = scale.z;
+	}
+}
+
+//Curvature: the length of the second difference of the pose at the frame.
+//Velocity extrema: where the pose speed stops rising or falling, the change of the speed is added.
+void ProceduralAnimationKeyPoseExtractor::_score_frame(const int frame) {
+	if (frame == 0 || frame == _frame_count - 1) {
+		_scores_ptr[frame] = 1e20;
+		return;
+	}
+
+	int row = _tracks.size() * FEATURES_PER_TRACK;
+
+	const float *p = _features_ptr + (frame - 1) * row;
+	const float *c = _features_ptr + frame * row;
+	const float *n = _features_ptr + (frame + 1) * row;
+
+	float curvature = 0;
+
+	for (int i = 0; i < row; ++i) {
+		float d = n[i] - 2 * c[i] + p[i];
+		curvature += d * d;
+	}
+
+	float score = Math::sqrt(curvature);
+
+	float speed_prev = _speed(frame - 1);
+	float speed = _speed(frame);
+	float speed_next = _speed(frame + 1);
+
+	if ((speed >= speed_prev && speed >= speed_next) || (speed <= speed_prev && speed <= speed_next)) {
+		score += _velocity_extremum_weight * (ABS(speed - speed_prev) + ABS(speed - speed_next));
+	}
+
+	_scores_ptr[frame] = score;
+}
+
+float ProceduralAnimationKeyPoseExtractor::_distance(const int frame_a, const int frame_b) const {
+	int row = _tracks.size() * FEATURES_PER_TRACK;
+
+	const float *a = _features_ptr + frame_a * row;
+	const float *b = _features_ptr + frame_b * row;
+
+	float d = 0;
+
+	for (int i = 0; i < row; ++i) {
+		d += (b[i] - a[i]) * (b[i] - a[i]);
+	}
+
+	return Math::sqrt(d);
+}
+
+//Central difference, one sided at the ends
+float ProceduralAnimationKeyPoseExtractor::_speed(const int frame) const {
+	int prev = MAX(frame - 1, 0);
+	int next = MIN(frame + 1, _frame_count - 1);
+
+	if (next == prev)
+		return 0;
+
+	return _distance(prev, next) / (next - prev);
+}
+
+void ProceduralAnimationKeyPoseExtractor::_job_thread_func(void *p_userdata) {
+#if VERSION_MAJOR < 4
+	ProceduralAnimationKeyPoseExtractor *self = static_cast<ProceduralAnimationKeyPoseExtractor *>(p_userdata);
+
+	while (true) {
+		uint32_t index = atomic_increment(&self->_next_job) - 1;
+
+		if (index >= self->_job_count) {
+			break;
+		}
+
+		self->_job(index, self->_current_pass);
+	}
+#endif
+}
+
+void ProceduralAnimationKeyPoseExtractor::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_max_key_poses"), &ProceduralAnimationKeyPoseExtractor::get_max_key_poses);
+	ClassDB::bind_method(D_METHOD("set_max_key_poses", "value"), &ProceduralAnimationKeyPoseExtractor::set_max_key_poses);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_key_poses"), "set_max_key_poses", "get_max_key_poses");
+
+	ClassDB::bind_method(D_METHOD("get_min_frame_distance"), &ProceduralAnimationKeyPoseExtractor::get_min_frame_distance);
+	ClassDB::bind_method(D_METHOD("set_min_frame_distance", "value"), &ProceduralAnimationKeyPoseExtractor::set_min_frame_distance);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "min_frame_distance"), "set_min_frame_distance", "get_min_frame_distance");
+
+	ClassDB::bind_method(D_METHOD("get_min_score"), &ProceduralAnimationKeyPoseExtractor::get_min_score);
+	ClassDB::bind_method(D_METHOD("set_min_score", "value"), &ProceduralAnimationKeyPoseExtractor::set_min_score);
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "min_score"), "set_min_score", "get_min_score");
+
+	ClassDB::bind_method(D_METHOD("get_velocity_extremum_weight"), &ProceduralAnimationKeyPoseExtractor::get_velocity_extremum_weight);
+	ClassDB::bind_method(D_METHOD("set_velocity_extremum_weight", "value"), &ProceduralAnimationKeyPoseExtractor::set_velocity_extremum_weight);
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "velocity_extremum_weight"), "set_velocity_extremum_weight", "get_velocity_extremum_weight");
+
+	ClassDB::bind_method(D_METHOD("get_thread_count"), &ProceduralAnimationKeyPoseExtractor::get_thread_count);
+	ClassDB::bind_method(D_METHOD("set_thread_count", "value"), &ProceduralAnimationKeyPoseExtractor::set_thread_count);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "thread_count"), "set_thread_count", "get_thread_count");
+
+	ClassDB::bind_method(D_METHOD("score_frames", "source", "fps"), &ProceduralAnimationKeyPoseExtractor::score_frames);
+	ClassDB::bind_method(D_METHOD("extract_key_frames", "source", "fps"), &ProceduralAnimationKeyPoseExtractor::extract_key_frames);
+	ClassDB::bind_method(D_METHOD("generate_keyframes", "animation"), &ProceduralAnimationKeyPoseExtractor::generate_keyframes);
+	ClassDB::bind_method(D_METHOD("generate_keyframe_data", "animation"), &ProceduralAnimationKeyPoseExtractor::generate_keyframe_data);
+}
@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef PROCEDURAL_ANIMATION_KEY_POSE_EXTRACTOR_H
+#define PROCEDURAL_ANIMATION_KEY_POSE_EXTRACTOR_H
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/object/reference.h"
+#include "core/templates/vector.h"
+#else
+#include "core/reference.h"
+#include "core/vector.h"
+#endif
+
+#include "procedural_animation.h"
+
+//Picks the key poses of a source animation, and can build a keyframe chain from them.
+//Every frame (at the ProceduralAnimation's fps) is scored by how much the pose changes around it:
+//the curvature of every transform track channel, plus a bonus at the extrema of the pose velocity.
+//Sampling and scoring run in parallel, the selection is greedy, highest score first.
+class ProceduralAnimationKeyPoseExtractor : public Reference {
+	GDCLASS(ProceduralAnimationKeyPoseExtractor, Reference);
+
+public:
+	int get_max_key_poses() const;
+	void set_max_key_poses(const int value);
+
+	int get_min_frame_distance() const;
+	void set_min_frame_distance(const int value);
+
+	float get_min_score() const;
+	void set_min_score(const float value);
+
+	float get_velocity_extremum_weight() const;
+	void set_velocity_extremum_weight(const float value);
+
+	int get_thread_count() const;
+	void set_thread_count(const int value);
+
+	PoolVector<real_t> score_frames(const Ref<Animation> &source, const int fps);
+	PoolVector<int> extract_key_frames(const Ref<Animation> &source, const int fps);
+	int generate_keyframes(const Ref<ProceduralAnimation> &animation);
+	Dictionary generate_keyframe_data(const Ref<ProceduralAnimation> &animation);
+
+	ProceduralAnimationKeyPoseExtractor();
+	~ProceduralAnimationKeyPoseExtractor();
+
+protected:
+	enum {
+		//location xyz, rotation xyzw, scale xyz
+		FEATURES_PER_TRACK = 10,
+	};
+
+	enum JobPass {
+		JOB_PASS_SAMPLE = 0,
+		JOB_PASS_SCORE,
+	};
+
+	struct FrameScore {
+		int frame;
+		float score;
+
+		bool operator<(const FrameScore &other) const {
+			return score > other.score;
+		}
+	};
+
+	void _run_pass(const JobPass pass, const int count);
+	void _job(uint32_t p_index, int p_pass);
+	void _sample_frame(const int frame);
+	void _score_frame(const int frame);
+	float _distance(const int frame_a, const int frame_b) const;
+	float _speed(const int frame) const;
+
+	static void _job_thread_func(void *p_userdata);
+
+	static void _bind_methods();
+
+private:
+	int _max_key_poses;
+	int _min_frame_distance;
+	float _min_score;
+	float _velocity_extremum_weight;
+	int _thread_count;
+
+	//state of the current run
+	const Animation *_source;
+	float _key_step;
+	int _frame_count;
+	Vector<int> _tracks;
+	Vector<float> _features;
+	Vector<float> _scores;
+	float *_features_ptr;
+	float *_scores_ptr;
+
+	int _current_pass;
+	uint32_t _job_count;
+	uint32_t _next_job;
+};
+
+#endif
@@ -0,0 +1,435 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "procedural_animation_library.h"
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/config/project_settings.h"
+#else
+#include "core/project_settings.h"
+#endif
+
+#include "core/os/file_access.h"
+
+#include "procedural_animation_compact.h"
+
+#ifdef UNIX_ENABLED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct LibraryEntryName {
+	CharString name;
+	Vector<uint8_t> data;
+
+	bool operator<(const LibraryEntryName &other) const {
+		return strcmp(name.get_data(), other.name.get_data()) < 0;
+	}
+};
+
+_FORCE_INLINE_ uint64_t library_align(const uint64_t offset) {
+	return (offset + ProceduralAnimationLibrary::DATA_ALIGNMENT - 1) & ~static_cast<uint64_t>(ProceduralAnimationLibrary::DATA_ALIGNMENT - 1);
+}
+
+//strcmp, but b is not zero terminated
+int library_compare(const char *a, const char *b, const uint32_t b_length) {
+	for (uint32_t i = 0; i < b_length; ++i) {
+		if (a[i] == 0 || a[i] != b[i])
+			return static_cast<unsigned char>(a[i]) - static_cast<unsigned char>(b[i]);
+	}
+
+	return a[b_length] == 0 ? 0 : 1;
+}
+
+} // namespace
+
+Error ProceduralAnimationLibrary::open(const String &path) {
+	close();
+
+#ifdef UNIX_ENABLED
+	//Only works for real files, not for files inside of a pack, those fall back to FileAccess below.
+	String global_path = ProjectSettings::get_singleton()->globalize_path(path);
+
+	int fd = ::open(global_path.utf8().get_data(), O_RDONLY);
+
+	if (fd != -1) {
+		struct stat st;
+
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+			if (mapped != MAP_FAILED) {
+				_mapped = mapped;
+				_data = static_cast<const uint8_t *>(mapped);
+				_size = st.st_size;
+			}
+		}
+
+		::close(fd);
+	}
+#endif
+
+	if (!_data) {
+		FileAccessRef f = FileAccess::open(path, FileAccess::READ);
+
+		ERR_FAIL_COND_V_MSG(!f, ERR_CANT_OPEN, "ProceduralAnimationLibrary: Could not open " + path);
+
+		_buffer.resize(f->get_len());
+
+		if (_buffer.size() > 0)
+			f->get_buffer(_buffer.ptrw(), _buffer.size());
+
+		_data = _buffer.ptr();
+		_size = _buffer.size();
+	}
+
+	if (!_validate()) {
+		close();
+
+		ERR_FAIL_V_MSG(ERR_FILE_CORRUPT, "ProceduralAnimationLibrary: " + path + " is not a valid library.");
+	}
+
+	_path = path;
+
+	return OK;
+}
+
+void ProceduralAnimationLibrary::close() {
+#ifdef UNIX_ENABLED
+	if (_mapped) {
+		munmap(_mapped, _size);
+	}
+#endif
+
+	_mapped = NULL;
+	_buffer.clear();
+	_data = NULL;
+	_size = 0;
+	_path = "";
+}
+
+bool ProceduralAnimationLibrary::is_open() const {
+	return _data != NULL;
+}
+
+bool ProceduralAnimationLibrary::is_memory_mapped() const {
+	return _mapped != NULL;
+}
+
+String ProceduralAnimationLibrary::get_path() const {
+	return _path;
+}
+
+int ProceduralAnimationLibrary::get_animation_count() const {
+	if (!_data)
+		return 0;
+
+	return reinterpret_cast<const Header *>(_data)->entry_count;
+}
+
+String ProceduralAnimationLibrary::get_animation_name(const int index) const {
+	const Entry *entry = _get_entry(index);
+
+	ERR_FAIL_COND_V(!entry, String());
+
+	const Header *header = reinterpret_cast<const Header *>(_data);
+
+	String name;
+	name.parse_utf8(reinterpret_cast<const char *>(_data + header->names_offset + entry->name_offset), entry->name_length);
+
+	return name;
+}
+
+int ProceduralAnimationLibrary::find_animation(const String &name) const {
+	if (!_data)
+		return -1;
+
+	const Header *header = reinterpret_cast<const Header *>(_data);
+	const Entry *entries = reinterpret_cast<const Entry *>(_data + header->entries_offset);
+	const char *names = reinterpret_cast<const char *>(_data + header->names_offset);
+
+	CharString cs = name.utf8();
+	const char *n = cs.get_data();
+
+	int lo = 0;
+	int hi = static_cast<int>(header->entry_count) - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) >> 1;
+
+		int c = library_compare(n, names + entries[mid].name_offset, entries[mid].name_length);
+
+		if (c == 0)
+			return mid;
+
+		if (c < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+
+	return -1;
+}
+
+bool ProceduralAnimationLibrary::has_animation(const String &name) const {
+	return find_animation(name) != -1;
+}
+
+const uint8_t *ProceduralAnimationLibrary::get_animation_data(const int index) const {
+	const Entry *entry = _get_entry(index);
+
+	ERR_FAIL_COND_V(!entry, NULL);
+
+	return _data + entry->data_offset;
+}
+
+float ProceduralAnimationLibrary::get_animation_length(const int index) const {
+	const uint8_t *data = get_animation_data(index);
+
+	ERR_FAIL_COND_V(!data, 0);
+
+	return ProceduralAnimationCompact::get_header(data)->length;
+}
+
+int ProceduralAnimationLibrary::get_track_count(const int index) const {
+	const uint8_t *data = get_animation_data(index);
+
+	ERR_FAIL_COND_V(!data, 0);
+
+	return ProceduralAnimationCompact::get_header(data)->track_count;
+}
+
+int ProceduralAnimationLibrary::find_track(const int index, const NodePath &path) const {
+	const uint8_t *data = get_animation_data(index);
+
+	ERR_FAIL_COND_V(!data, -1);
+
+	return ProceduralAnimationCompact::find_track(data, path);
+}
+
+Transform ProceduralAnimationLibrary::sample_transform(const int index, const int track, const float time) const {
+	const uint8_t *data = get_animation_data(index);
+
+	ERR_FAIL_COND_V(!data, Transform());
+
+	Vector3 loc;
+	Quat rot;
+	Vector3 scale(1, 1, 1);
+
+	ProceduralAnimationCompact::sample(data, track, time, &loc, &rot, &scale);
+
+	Transform t;
+	t.basis.set_quat_scale(rot, scale);
+	t.origin = loc;
+
+	return t;
+}
+
+//animations: name -> ProceduralAnimation. Animations that were baked with bake_compact use their
+//compact data as it is, the others are compacted from their baked tracks.
+Error ProceduralAnimationLibrary::save_library(const String &path, const Dictionary &animations) {
+	Vector<LibraryEntryName> entries;
+
+	Array keys = animations.keys();
+
+	for (int i = 0; i < keys.size(); ++i) {
+		String name = keys[i];
+		Ref<ProceduralAnimation> animation = animations[keys[i]];
+
+		if (!animation.is_valid()) {
+			ERR_PRINT("ProceduralAnimationLibrary: " + name + " is not a ProceduralAnimation.");
+			continue;
+		}
+
+		LibraryEntryName entry;
+		entry.name = name.utf8();
+
+		const uint8_t *compact = animation->get_compact_data_ptr();
+
+		if (compact) {
+			uint32_t size = ProceduralAnimationCompact::get_header(compact)->size;
+
+			entry.data.resize(size);
+			memcpy(entry.data.ptrw(), compact, size);
+		} else {
+			if (animation->get_track_count() == 0) {
+				ERR_PRINT("ProceduralAnimationLibrary: " + name + " has no baked tracks.");
+				continue;
+			}
+
+			entry.data = ProceduralAnimationCompact::build(animation.ptr());
+		}
+
+		entries.push_back(entry);
+	}
+
+	entries.sort();
+
+	for (int i = 1; i < entries.size(); ++i) {
+		ERR_FAIL_COND_V_MSG(strcmp(entries[i - 1].name.get_data(), entries[i].name.get_data()) == 0, ERR_INVALID_PARAMETER, "ProceduralAnimationLibrary: duplicate name.");
+	}
+
+	uint32_t entry_count = entries.size();
+	uint32_t entries_offset = sizeof(Header);
+	uint32_t names_offset = entries_offset + entry_count * sizeof(Entry);
+	uint32_t names_size = 0;
+
+	for (uint32_t i = 0; i < entry_count; ++i) {
+		names_size += entries[i].name.length() + 1;
+	}
+
+	Vector<Entry> table;
+	table.resize(entry_count);
+
+	uint64_t offset = library_align(names_offset + names_size);
+	uint32_t name_offset = 0;
+
+	for (uint32_t i = 0; i < entry_count; ++i) {
+		Entry &e = table.write[i];
+
+		e.data_offset = offset;
+		e.data_size = entries[i].data.size();
+		e.name_offset = name_offset;
+		e.name_length = entries[i].name.length();
+		e.reserved = 0;
+
+		name_offset += e.name_length + 1;
+		offset = library_align(offset + e.data_size);
+	}
+
+	Header header;
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.size = offset;
+	header.entry_count = entry_count;
+	header.entries_offset = entries_offset;
+	header.names_offset = names_offset;
+	header.names_size = names_size;
+
+	Error err;
+	FileAccessRef f = FileAccess::open(path, FileAccess::WRITE, &err);
+
+	ERR_FAIL_COND_V_MSG(!f, err, "ProceduralAnimationLibrary: Could not write " + path);
+
+	f->store_buffer(reinterpret_cast<const uint8_t *>(&header), sizeof(Header));
+
+	if (entry_count > 0)
+		f->store_buffer(reinterpret_cast<const uint8_t *>(table.ptr()), entry_count * sizeof(Entry));
+
+	for (uint32_t i = 0; i < entry_count; ++i) {
+		f->store_buffer(reinterpret_cast<const uint8_t *>(entries[i].name.get_data()), entries[i].name.length() + 1);
+	}
+
+	for (uint32_t i = 0; i < entry_count; ++i) {
+		while (f->get_position() < table[i].data_offset) {
+			f->store_8(0);
+		}
+
+		f->store_buffer(entries[i].data.ptr(), entries[i].data.size());
+	}
+
+	while (f->get_position() < offset) {
+		f->store_8(0);
+	}
+
+	return OK;
+}
+
+//Everything is checked once here, so lookups and sampling don't need bounds checks on the file's offsets.
+bool ProceduralAnimationLibrary::_validate() const {
+	ERR_FAIL_COND_V(_size < sizeof(Header), false);
+
+	const Header *header = reinterpret_cast<const Header *>(_data);
+
+	ERR_FAIL_COND_V(header->magic != MAGIC, false);
+	ERR_FAIL_COND_V(header->version != VERSION, false);
+	ERR_FAIL_COND_V(header->size > _size, false);
+	ERR_FAIL_COND_V(header->entries_offset & 7, false);
+	ERR_FAIL_COND_V(header->entries_offset + static_cast<uint64_t>(header->entry_count) * sizeof(Entry) > header->size, false);
+	ERR_FAIL_COND_V(static_cast<uint64_t>(header->names_offset) + header->names_size > header->size, false);
+
+	const Entry *entries = reinterpret_cast<const Entry *>(_data + header->entries_offset);
+	const char *names = reinterpret_cast<const char *>(_data + header->names_offset);
+
+	for (uint32_t i = 0; i < header->entry_count; ++i) {
+		const Entry &e = entries[i];
+
+		ERR_FAIL_COND_V(static_cast<uint64_t>(e.name_offset) + e.name_length >= header->names_size, false);
+		ERR_FAIL_COND_V(names[e.name_offset + e.name_length] != 0, false);
+		ERR_FAIL_COND_V(e.data_offset & 3, false);
+		ERR_FAIL_COND_V(e.data_offset + e.data_size > header->size, false);
+
+		//find_animation() needs them sorted
+		if (i > 0)
+			ERR_FAIL_COND_V(strcmp(names + entries[i - 1].name_offset, names + e.name_offset) >= 0, false);
+
+		if (!ProceduralAnimationCompact::validate(_data + e.data_offset, e.data_size))
+			return false;
+	}
+
+	return true;
+}
+
+const ProceduralAnimationLibrary::Entry *ProceduralAnimationLibrary::_get_entry(const int index) const {
+	ERR_FAIL_COND_V(!_data, NULL);
+	ERR_FAIL_INDEX_V(index, static_cast<int>(reinterpret_cast<const Header *>(_data)->entry_count), NULL);
+
+	return reinterpret_cast<const Entry *>(_data + reinterpret_cast<const Header *>(_data)->entries_offset) + index;
+}
+
+ProceduralAnimationLibrary::ProceduralAnimationLibrary() {
+	_data = NULL;
+	_size = 0;
+	_mapped = NULL;
+}
+
+ProceduralAnimationLibrary::~ProceduralAnimationLibrary() {
+	close();
+}
+
+void ProceduralAnimationLibrary::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("open", "path"), &ProceduralAnimationLibrary::open);
+	ClassDB::bind_method(D_METHOD("close"), &ProceduralAnimationLibrary::close);
+
+	ClassDB::bind_method(D_METHOD("is_open"), &ProceduralAnimationLibrary::is_open);
+	ClassDB::bind_method(D_METHOD("is_memory_mapped"), &ProceduralAnimationLibrary::is_memory_mapped);
+	ClassDB::bind_method(D_METHOD("get_path"), &ProceduralAnimationLibrary::get_path);
+
+	ClassDB::bind_method(D_METHOD("get_animation_count"), &ProceduralAnimationLibrary::get_animation_count);
+	ClassDB::bind_method(D_METHOD("get_animation_name", "index"), &ProceduralAnimationLibrary::get_animation_name);
+	ClassDB::bind_method(D_METHOD("find_animation", "name"), &ProceduralAnimationLibrary::find_animation);
+	ClassDB::bind_method(D_METHOD("has_animation", "name"), &ProceduralAnimationLibrary::has_animation);
+
+	ClassDB::bind_method(D_METHOD("get_animation_length", "index"), &ProceduralAnimationLibrary::get_animation_length);
+	ClassDB::bind_method(D_METHOD("get_track_count", "index"), &ProceduralAnimationLibrary::get_track_count);
+	ClassDB::bind_method(D_METHOD("find_track", "index", "path"), &ProceduralAnimationLibrary::find_track);
+	ClassDB::bind_method(D_METHOD("sample_transform", "index", "track", "time"), &ProceduralAnimationLibrary::sample_transform);
+
+	ClassDB::bind_method(D_METHOD("save_library", "path", "animations"), &ProceduralAnimationLibrary::save_library);
+}
@@ -0,0 +1,115 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef PROCEDURAL_ANIMATION_LIBRARY_H
+#define PROCEDURAL_ANIMATION_LIBRARY_H
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/object/reference.h"
+#include "core/templates/vector.h"
+#else
+#include "core/reference.h"
+#include "core/vector.h"
+#endif
+
+#include "core/math/transform.h"
+
+#include "procedural_animation.h"
+
+//A read only file that packs the compact data (see ProceduralAnimationCompact) of many ProceduralAnimations.
+//Everything in it is addressed with offsets from the start of the file, so on unix it's memory mapped
+//as it is, and the pages are shared between every process that opens the same file.
+//Elsewhere, or if mapping fails, it's read into memory instead.
+//Animations are looked up by name, the entries are sorted by name.
+class ProceduralAnimationLibrary : public Reference {
+	GDCLASS(ProceduralAnimationLibrary, Reference);
+
+public:
+	enum {
+		MAGIC = 0x4C415050, //PPAL
+		VERSION = 1,
+		DATA_ALIGNMENT = 16,
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t size;
+		uint32_t entry_count;
+		uint32_t entries_offset;
+		uint32_t names_offset;
+		uint32_t names_size;
+	};
+
+	//name_offset is relative to names_offset
+	struct Entry {
+		uint64_t data_offset;
+		uint32_t data_size;
+		uint32_t name_offset;
+		uint32_t name_length;
+		uint32_t reserved;
+	};
+
+	Error open(const String &path);
+	void close();
+
+	bool is_open() const;
+	bool is_memory_mapped() const;
+	String get_path() const;
+
+	int get_animation_count() const;
+	String get_animation_name(const int index) const;
+	int find_animation(const String &name) const;
+	bool has_animation(const String &name) const;
+
+	//Compact data of an animation, use it with ProceduralAnimationCompact
+	const uint8_t *get_animation_data(const int index) const;
+
+	float get_animation_length(const int index) const;
+	int get_track_count(const int index) const;
+	int find_track(const int index, const NodePath &path) const;
+	Transform sample_transform(const int index, const int track, const float time) const;
+
+	Error save_library(const String &path, const Dictionary &animations);
+
+	ProceduralAnimationLibrary();
+	~ProceduralAnimationLibrary();
+
+protected:
+	bool _validate() const;
+	const Entry *_get_entry(const int index) const;
+
+	static void _bind_methods();
+
+private:
+	String _path;
+	const uint8_t *_data;
+	uint64_t _size;
+
+	void *_mapped;
+	Vector<uint8_t> _buffer;
+};
+
+#endif
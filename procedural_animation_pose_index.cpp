@@ -0,0 +1,465 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "procedural_animation_pose_index.h"
+
+#include "core/version.h"
+
+#include "core/core_string_names.h"
+
+Map<ProceduralAnimationPoseIndex::CacheKey, Ref<ProceduralAnimationPoseIndex> > ProceduralAnimationPoseIndex::_cache;
+Mutex ProceduralAnimationPoseIndex::_cache_mutex;
+
+Ref<Animation> ProceduralAnimationPoseIndex::get_animation() const {
+	return _animation;
+}
+
+int ProceduralAnimationPoseIndex::get_fps() const {
+	return _fps;
+}
+
+PoolVector<String> ProceduralAnimationPoseIndex::get_track_filter() const {
+	return _track_filter;
+}
+void ProceduralAnimationPoseIndex::set_track_filter(const PoolVector<String> &value) {
+	ERR_FAIL_COND_MSG(_shared, "ProceduralAnimationPoseIndex: A cached index is shared, build() an own index to change its settings.");
+
+	MutexLock lock(_mutex);
+
+	_track_filter = value;
+	_dirty = true;
+}
+
+float ProceduralAnimationPoseIndex::get_location_weight() const {
+	return _location_weight;
+}
+void ProceduralAnimationPoseIndex::set_location_weight(const float value) {
+	ERR_FAIL_COND_MSG(_shared, "ProceduralAnimationPoseIndex: A cached index is shared, build() an own index to change its settings.");
+
+	MutexLock lock(_mutex);
+
+	_location_weight = value;
+	_dirty = true;
+}
+
+float ProceduralAnimationPoseIndex::get_rotation_weight() const {
+	return _rotation_weight;
+}
+void ProceduralAnimationPoseIndex::set_rotation_weight(const float value) {
+	ERR_FAIL_COND_MSG(_shared, "ProceduralAnimationPoseIndex: A cached index is shared, build() an own index to change its settings.");
+
+	MutexLock lock(_mutex);
+
+	_rotation_weight = value;
+	_dirty = true;
+}
+
+void ProceduralAnimationPoseIndex::build(const Ref<Animation> &animation, const int fps) {
+	ERR_FAIL_COND(fps <= 0);
+	ERR_FAIL_COND_MSG(_shared, "ProceduralAnimationPoseIndex: A cached index is shared, build() an own index to change its settings.");
+
+	MutexLock lock(_mutex);
+
+	if (_animation != animation) {
+		if (_animation.is_valid()) {
+#if VERSION_MAJOR < 4
+			_animation->disconnect(CoreStringNames::get_singleton()->changed, this, "_on_animation_changed");
+#else
+			_animation->disconnect(CoreStringNames::get_singleton()->changed, callable_mp(this, &ProceduralAnimationPoseIndex::_on_animation_changed));
+#endif
+		}
+
+		_animation = animation;
+
+		if (_animation.is_valid()) {
+#if VERSION_MAJOR < 4
+			_animation->connect(CoreStringNames::get_singleton()->changed, this, "_on_animation_changed");
+#else
+			_animation->connect(CoreStringNames::get_singleton()->changed, callable_mp(this, &ProceduralAnimationPoseIndex::_on_animation_changed));
+#endif
+		}
+	}
+
+	_fps = fps;
+
+	_update();
+}
+
+int ProceduralAnimationPoseIndex::get_frame_count() const {
+	return _frame_count;
+}
+
+int ProceduralAnimationPoseIndex::get_feature_count() const {
+	return _track_paths.size() * FEATURES_PER_TRACK;
+}
+
+PoolVector<String> ProceduralAnimationPoseIndex::get_feature_track_paths() const {
+	PoolVector<String> paths;
+	paths.resize(_track_paths.size());
+
+	for (int i = 0; i < _track_paths.size(); ++i) {
+		paths.set(i, String(_track_paths[i]));
+	}
+
+	return paths;
+}
+
+//The unweighted features of a frame, in the layout find_closest_frames() expects.
+PoolVector<real_t> ProceduralAnimationPoseIndex::get_frame_features(const int frame) {
+	MutexLock lock(_mutex);
+
+	if (_dirty)
+		_update();
+
+	ERR_FAIL_INDEX_V(frame, _frame_count, PoolVector<real_t>());
+
+	int count = get_feature_count();
+
+	PoolVector<real_t> features;
+	features.resize(count);
+
+	const float *row = _features.ptr() + frame * _stride;
+
+	for (int i = 0; i < count; ++i) {
+		float w = (i % FEATURES_PER_TRACK) < 3 ? _location_weight : _rotation_weight;
+
+		features.set(i, w > CMP_EPSILON ? row[i] / w : 0);
+	}
+
+	return features;
+}
+
+//The count frames that are closest to features, closest first.
+PoolVector<int> ProceduralAnimationPoseIndex::find_closest_frames(const PoolVector<real_t> &features, const int count) {
+	MutexLock lock(_mutex);
+
+	if (_dirty)
+		_update();
+
+	ERR_FAIL_COND_V(features.size() != get_feature_count(), PoolVector<int>());
+
+	Vector<float> query;
+	query.resize(_stride);
+
+	for (int i = 0; i < _stride; ++i) {
+		query.write[i] = 0;
+	}
+
+	for (int i = 0; i < features.size(); ++i) {
+		float w = (i % FEATURES_PER_TRACK) < 3 ? _location_weight : _rotation_weight;
+
+		query.write[i] = features[i] * w;
+	}
+
+	//The sign of a quaternion doesn't matter, the index stores them with w >= 0
+	for (int t = 0; t < _track_paths.size(); ++t) {
+		float *q = query.ptrw() + t * FEATURES_PER_TRACK + 3;
+
+		if (q[3] < 0) {
+			q[0] = -q[0];
+			q[1] = -q[1];
+			q[2] = -q[2];
+			q[3] = -q[3];
+		}
+	}
+
+	Vector<int> frames;
+	_find_closest(query.ptr(), count, -1, 0, &frames);
+
+	PoolVector<int> result;
+	result.resize(frames.size());
+
+	for (int i = 0; i < frames.size(); ++i) {
+		result.set(i, frames[i]);
+	}
+
+	return result;
+}
+
+//The count frames that look the most like frame, ignoring the frames that are closer to it than min_frame_distance.
+PoolVector<int> ProceduralAnimationPoseIndex::find_similar_frames(const int frame, const int count, const int min_frame_distance) {
+	MutexLock lock(_mutex);
+
+	if (_dirty)
+		_update();
+
+	ERR_FAIL_INDEX_V(frame, _frame_count, PoolVector<int>());
+
+	Vector<int> frames;
+	_find_closest(_features.ptr() + frame * _stride, count, frame, min_frame_distance, &frames);
+
+	PoolVector<int> result;
+	result.resize(frames.size());
+
+	for (int i = 0; i < frames.size(); ++i) {
+		result.set(i, frames[i]);
+	}
+
+	return result;
+}
+
+//One index per source animation and fps, shared by every user. Entries that are only referenced by the cache
+//(and whose animation is only referenced by the cached indexes) are dropped on the next lookup.
+//The index is built without holding the cache lock, if two threads build the same one, the first one wins.
+Ref<ProceduralAnimationPoseIndex> ProceduralAnimationPoseIndex::get_cached(const Ref<Animation> &animation, const int fps) {
+	ERR_FAIL_COND_V(!animation.is_valid(), Ref<ProceduralAnimationPoseIndex>());
+	ERR_FAIL_COND_V(fps <= 0, Ref<ProceduralAnimationPoseIndex>());
+
+	CacheKey key;
+	key.animation_id = static_cast<uint64_t>(animation->get_instance_id());
+	key.fps = fps;
+
+	{
+		MutexLock lock(_cache_mutex);
+
+		//animation id -> number of cached indexes that reference it
+		Map<uint64_t, int> animation_refs;
+
+		for (Map<CacheKey, Ref<ProceduralAnimationPoseIndex> >::Element *E = _cache.front(); E; E = E->next()) {
+			if (E->get()->_animation.is_valid())
+				animation_refs[E->key().animation_id] += 1;
+		}
+
+		Vector<CacheKey> freed;
+
+		for (Map<CacheKey, Ref<ProceduralAnimationPoseIndex> >::Element *E = _cache.front(); E; E = E->next()) {
+			const Ref<ProceduralAnimationPoseIndex> &index = E->get();
+
+			if (index->reference_get_count() <= 1 && (!index->_animation.is_valid() || index->_animation->reference_get_count() <= animation_refs[E->key().animation_id]))
+				freed.push_back(E->key());
+		}
+
+		for (int i = 0; i < freed.size(); ++i) {
+			_cache.erase(freed[i]);
+		}
+
+		Map<CacheKey, Ref<ProceduralAnimationPoseIndex> >::Element *E = _cache.find(key);
+
+		if (E)
+			return E->get();
+	}
+
+	Ref<ProceduralAnimationPoseIndex> index;
+	index.instance();
+	index->build(animation, fps);
+	index->_shared = true;
+
+	MutexLock lock(_cache_mutex);
+
+	Map<CacheKey, Ref<ProceduralAnimationPoseIndex> >::Element *E = _cache.find(key);
+
+	if (E)
+		return E->get();
+
+	_cache[key] = index;
+
+	return index;
+}
+
+//Drops every cached index (and the source animations they hold). Called when the module is unregistered,
+//the cache can't outlive ObjectDB.
+void ProceduralAnimationPoseIndex::clear_cache() {
+	MutexLock lock(_cache_mutex);
+
+	_cache.clear();
+}
+
+ProceduralAnimationPoseIndex::ProceduralAnimationPoseIndex() {
+	_fps = 15;
+	_location_weight = 1;
+	_rotation_weight = 1;
+	_dirty = true;
+	_shared = false;
+	_frame_count = 0;
+	_stride = 0;
+}
+
+ProceduralAnimationPoseIndex::~ProceduralAnimationPoseIndex() {
+	if (_animation.is_valid()) {
+#if VERSION_MAJOR < 4
+		_animation->disconnect(CoreStringNames::get_singleton()->changed, this, "_on_animation_changed");
+#else
+		_animation->disconnect(CoreStringNames::get_singleton()->changed, callable_mp(this, &ProceduralAnimationPoseIndex::_on_animation_changed));
+#endif
+	}
+}
+
+void ProceduralAnimationPoseIndex::_update() {
+	_dirty = false;
+	_track_paths.clear();
+	_features.clear();
+	_frame_count = 0;
+	_stride = 0;
+
+	if (!_animation.is_valid())
+		return;
+
+	Vector<int> tracks;
+
+	for (int i = 0; i < _animation->get_track_count(); ++i) {
+		if (_animation->track_get_type(i) != Animation::TYPE_TRANSFORM || !_animation->track_is_enabled(i))
+			continue;
+
+		String path = _animation->track_get_path(i);
+
+		if (_track_filter.size() > 0) {
+			bool found = false;
+
+			for (int j = 0; j < _track_filter.size(); ++j) {
+				if (path.match(_track_filter[j])) {
+					found = true;
+					break;
+				}
+			}
+
+			if (!found)
+				continue;
+		}
+
+		tracks.push_back(i);
+		_track_paths.push_back(_animation->track_get_path(i));
+	}
+
+	float key_step = 1.0 / static_cast<float>(_fps);
+
+	_frame_count = static_cast<int>(Math::floor(_animation->get_length() * _fps + CMP_EPSILON)) + 1;
+	_stride = ((tracks.size() * FEATURES_PER_TRACK + 3) / 4) * 4;
+
+	_features.resize(_frame_count * _stride);
+
+	float *features = _features.ptrw();
+
+	for (int f = 0; f < _frame_count; ++f) {
+		float *row = features + f * _stride;
+		float time = MIN(f * key_step, _animation->get_length());
+
+		for (int t = 0; t < tracks.size(); ++t) {
+			Vector3 loc;
+			Quat rot;
+			Vector3 scale;
+
+			_animation->transform_track_interpolate(tracks[t], time, &loc, &rot, &scale);
+
+			if (rot.w < 0)
+				rot = -rot;
+
+			float *r = row + t * FEATURES_PER_TRACK;
+
+			r[0] = loc.x * _location_weight;
+			r[1] = loc.y * _location_weight;
+			r[2] = loc.z * _location_weight;
+			r[3] = rot.x * _rotation_weight;
+			r[4] = rot.y * _rotation_weight;
+			r[5] = rot.z * _rotation_weight;
+			r[6] = rot.w * _rotation_weight;
+		}
+
+		for (int i = tracks.size() * FEATURES_PER_TRACK; i < _stride; ++i) {
+			row[i] = 0;
+		}
+	}
+}
+
+void ProceduralAnimationPoseIndex::_on_animation_changed() {
+	MutexLock lock(_mutex);
+
+	_dirty = true;
+}
+
+//Brute force, but a frame is only a few dozen floats, and the inner loop has no branches.
+//The best count frames are kept with an insertion sort, count is expected to be small.
+void ProceduralAnimationPoseIndex::_find_closest(const float *query, const int count, const int exclude_frame, const int min_frame_distance, Vector<int> *r_frames) const {
+	r_frames->clear();
+
+	if (count <= 0 || _frame_count == 0)
+		return;
+
+	Vector<int> best_frames;
+	Vector<float> best_distances;
+
+	const float *features = _features.ptr();
+	int stride = _stride;
+
+	for (int f = 0; f < _frame_count; ++f) {
+		if (exclude_frame != -1 && ABS(f - exclude_frame) <= MAX(min_frame_distance, 0))
+			continue;
+
+		const float *row = features + f * stride;
+
+		float d = 0;
+
+		for (int i = 0; i < stride; ++i) {
+			float diff = row[i] - query[i];
+			d += diff * diff;
+		}
+
+		if (best_frames.size() == count && d >= best_distances[count - 1])
+			continue;
+
+		int pos = best_frames.size();
+
+		while (pos > 0 && best_distances[pos - 1] > d) {
+			--pos;
+		}
+
+		best_frames.insert(pos, f);
+		best_distances.insert(pos, d);
+
+		if (best_frames.size() > count) {
+			best_frames.resize(count);
+			best_distances.resize(count);
+		}
+	}
+
+	*r_frames = best_frames;
+}
+
+void ProceduralAnimationPoseIndex::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_animation"), &ProceduralAnimationPoseIndex::get_animation);
+	ClassDB::bind_method(D_METHOD("get_fps"), &ProceduralAnimationPoseIndex::get_fps);
+
+	ClassDB::bind_method(D_METHOD("get_track_filter"), &ProceduralAnimationPoseIndex::get_track_filter);
+	ClassDB::bind_method(D_METHOD("set_track_filter", "value"), &ProceduralAnimationPoseIndex::set_track_filter);
+	ADD_PROPERTY(PropertyInfo(Variant::POOL_STRING_ARRAY, "track_filter"), "set_track_filter", "get_track_filter");
+
+	ClassDB::bind_method(D_METHOD("get_location_weight"), &ProceduralAnimationPoseIndex::get_location_weight);
+	ClassDB::bind_method(D_METHOD("set_location_weight", "value"), &ProceduralAnimationPoseIndex::set_location_weight);
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "location_weight"), "set_location_weight", "get_location_weight");
+
+	ClassDB::bind_method(D_METHOD("get_rotation_weight"), &ProceduralAnimationPoseIndex::get_rotation_weight);
+	ClassDB::bind_method(D_METHOD("set_rotation_weight", "value"), &ProceduralAnimationPoseIndex::set_rotation_weight);
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "rotation_weight"), "set_rotation_weight", "get_rotation_weight");
+
+	ClassDB::bind_method(D_METHOD("build", "animation", "fps"), &ProceduralAnimationPoseIndex::build);
+
+	ClassDB::bind_method(D_METHOD("get_frame_count"), &ProceduralAnimationPoseIndex::get_frame_count);
+	ClassDB::bind_method(D_METHOD("get_feature_count"), &ProceduralAnimationPoseIndex::get_feature_count);
+	ClassDB::bind_method(D_METHOD("get_feature_track_paths"), &ProceduralAnimationPoseIndex::get_feature_track_paths);
+
+	ClassDB::bind_method(D_METHOD("get_frame_features", "frame"), &ProceduralAnimationPoseIndex::get_frame_features);
+	ClassDB::bind_method(D_METHOD("find_closest_frames", "features", "count"), &ProceduralAnimationPoseIndex::find_closest_frames);
+	ClassDB::bind_method(D_METHOD("find_similar_frames", "frame", "count", "min_frame_distance"), &ProceduralAnimationPoseIndex::find_similar_frames);
+
+#if VERSION_MAJOR < 4
+	ClassDB::bind_method(D_METHOD("_on_animation_changed"), &ProceduralAnimationPoseIndex::_on_animation_changed);
+#endif
+}
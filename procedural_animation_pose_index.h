@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef PROCEDURAL_ANIMATION_POSE_INDEX_H
+#define PROCEDURAL_ANIMATION_POSE_INDEX_H
+
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/object/reference.h"
+#include "core/templates/map.h"
+#include "core/templates/vector.h"
+#else
+#include "core/map.h"
+#include "core/reference.h"
+#include "core/vector.h"
+#endif
+
+#include "core/os/mutex.h"
+
+#include "procedural_animation.h"
+
+//Pose features of every frame of a source animation, in one flat float matrix (frame major).
+//A frame's features are the location and rotation of the selected transform tracks, so a nearest neighbour
+//query is a single branch free scan over the matrix, which the compiler can vectorize.
+//Indexes are cached per source animation with get_cached(), and rebuilt when the source changes.
+//A cached index is shared by the editor and the runtime, so its track filter and weights can't be changed,
+//build() your own index for that. Queries lock the index, so they can come from any thread.
+class ProceduralAnimationPoseIndex : public Reference {
+	GDCLASS(ProceduralAnimationPoseIndex, Reference);
+
+public:
+	enum {
+		//location xyz, rotation xyzw
+		FEATURES_PER_TRACK = 7,
+	};
+
+	Ref<Animation> get_animation() const;
+
+	int get_fps() const;
+
+	PoolVector<String> get_track_filter() const;
+	void set_track_filter(const PoolVector<String> &value);
+
+	float get_location_weight() const;
+	void set_location_weight(const float value);
+
+	float get_rotation_weight() const;
+	void set_rotation_weight(const float value);
+
+	void build(const Ref<Animation> &animation, const int fps);
+
+	int get_frame_count() const;
+	int get_feature_count() const;
+	PoolVector<String> get_feature_track_paths() const;
+
+	PoolVector<real_t> get_frame_features(const int frame);
+	PoolVector<int> find_closest_frames(const PoolVector<real_t> &features, const int count);
+	PoolVector<int> find_similar_frames(const int frame, const int count, const int min_frame_distance);
+
+	static Ref<ProceduralAnimationPoseIndex> get_cached(const Ref<Animation> &animation, const int fps);
+	static void clear_cache();
+
+	ProceduralAnimationPoseIndex();
+	~ProceduralAnimationPoseIndex();
+
+protected:
+	void _update();
+	void _on_animation_changed();
+	void _find_closest(const float *query, const int count, const int exclude_frame, const int min_frame_distance, Vector<int> *r_frames) const;
+
+	static void _bind_methods();
+
+private:
+	Ref<Animation> _animation;
+	int _fps;
+	PoolVector<String> _track_filter;
+	float _location_weight;
+	float _rotation_weight;
+	bool _dirty;
+	bool _shared;
+
+	//Guards the lazy rebuild, the source can change while an other thread queries a shared index
+	Mutex _mutex;
+
+	Vector<NodePath> _track_paths;
+	int _frame_count;
+	int _stride;
+
+	//[frame * _stride + feature], weights are applied, padded with zeros to a multiple of 4
+	Vector<float> _features;
+
+	//Two ProceduralAnimations can use the same source with a different fps, so both are the key
+	struct CacheKey {
+		uint64_t animation_id;
+		int fps;
+
+		bool operator<(const CacheKey &other) const {
+			if (animation_id != other.animation_id)
+				return animation_id < other.animation_id;
+
+			return fps < other.fps;
+		}
+	};
+
+	static Map<CacheKey, Ref<ProceduralAnimationPoseIndex> > _cache;
+	static Mutex _cache_mutex;
+};
+
+#endif
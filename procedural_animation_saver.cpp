@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2020 Péter Magyar
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "procedural_animation_saver.h"
+
+#include "core/io/resource_format_binary.h"
+#include "scene/resources/resource_format_text.h"
+
+#include "procedural_animation.h"
+
+Error ResourceFormatSaverProceduralAnimation::save(const String &p_path, const RES &p_resource, uint32_t p_flags) {
+	Ref<ProceduralAnimation> animation = p_resource;
+
+	ERR_FAIL_COND_V(!animation.is_valid(), ERR_INVALID_PARAMETER);
+
+	PoolVector<int> unreachable = animation->get_graph_analysis()["unreachable"];
+
+	//Only copied when something is pruned
+	if (unreachable.size() > 0) {
+		Ref<ProceduralAnimation> pruned = animation->duplicate();
+
+		ERR_FAIL_COND_V(!pruned.is_valid(), ERR_CANT_CREATE);
+
+		pruned->prune_unreachable_keyframes();
+
+		animation = pruned;
+	}
+
+	List<String> text_extensions;
+	ResourceFormatSaverText::singleton->get_recognized_extensions(p_resource, &text_extensions);
+
+	if (text_extensions.find(p_path.get_extension().to_lower()))
+		return ResourceFormatSaverText::singleton->save(p_path, animation, p_flags);
+
+	return ResourceFormatSaverBinary::singleton->save(p_path, animation, p_flags);
+}
+
+bool ResourceFormatSaverProceduralAnimation::recognize(const RES &p_resource) const {
+	const ProceduralAnimation *animation = Object::cast_to<ProceduralAnimation>(p_resource.ptr());
+
+	return animation && animation->get_prune_unreachable_on_save();
+}
+
+void ResourceFormatSaverProceduralAnimation::get_recognized_extensions(const RES &p_resource, List<String> *p_extensions) const {
+	if (!recognize(p_resource))
+		return;
+
+	ResourceFormatSaverText::singleton->get_recognized_extensions(p_resource, p_extensions);
+	ResourceFormatSaverBinary::singleton->get_recognized_extensions(p_resource, p_extensions);
+}
@@ -22,17 +22,79 @@ SOFTWARE.
 
 #include "register_types.h"
 
+#include "core/version.h"
+
+#if VERSION_MAJOR > 3
+#include "core/config/project_settings.h"
+#include "main/performance.h"
+#else
+#include "core/project_settings.h"
+#endif
+
 #include "procedural_animation.h"
+#include "procedural_animation_baker.h"
+#include "procedural_animation_crowd_evaluator.h"
+#include "procedural_animation_key_pose_extractor.h"
+#include "procedural_animation_library.h"
+#include "procedural_animation_pose_index.h"
+#include "procedural_animation_saver.h"
+
+#include "animation_node_procedural_animation.h"
 
 #include "procedural_animation_editor_plugin.h"
+#include "procedural_animation_export_plugin.h"
+
+static Ref<ResourceFormatSaverProceduralAnimation> procedural_animation_saver;
 
 void register_procedural_animations_types() {
 	ClassDB::register_class<ProceduralAnimation>();
+	ClassDB::register_class<ProceduralAnimationBaker>();
+	ClassDB::register_class<ProceduralAnimationBakeMainLoop>();
+	ClassDB::register_class<ProceduralAnimationCrowdEvaluator>();
+	ClassDB::register_class<ProceduralAnimationKeyPoseExtractor>();
+	ClassDB::register_class<ProceduralAnimationLibrary>();
+	ClassDB::register_class<ProceduralAnimationPoseIndex>();
+
+	ClassDB::register_class<AnimationNodeProceduralAnimation>();
+
+#if VERSION_MAJOR > 3
+	if (Performance::get_singleton()) {
+		Performance::get_singleton()->add_custom_monitor("procedural_animations/memory_usage", callable_mp_static(&ProceduralAnimation::get_total_memory_usage), Vector<Variant>());
+		Performance::get_singleton()->add_custom_monitor("procedural_animations/instances", callable_mp_static(&ProceduralAnimation::get_instance_count), Vector<Variant>());
+	}
+#endif
+
+	ProceduralAnimation::register_settings();
+
+	//In front of the text and binary savers, it only takes the resources that prune on save
+	procedural_animation_saver.instance();
+	ResourceSaver::add_resource_format_saver(procedural_animation_saver, true);
+
+	if (ProceduralAnimationBakeMainLoop::requested_from_command_line()) {
+		ProjectSettings::get_singleton()->set("application/run/main_loop_type", "ProceduralAnimationBakeMainLoop");
+	}
 
 #ifdef TOOLS_ENABLED
+	ProceduralAnimationExportPlugin::register_settings();
+
 	EditorPlugins::add_by_type<ProceduralAnimationEditorPlugin>();
 #endif
 }
 
 void unregister_procedural_animations_types() {
+#if VERSION_MAJOR > 3
+	//The monitors' callables point into this module
+	if (Performance::get_singleton()) {
+		if (Performance::get_singleton()->has_custom_monitor("procedural_animations/memory_usage"))
+			Performance::get_singleton()->remove_custom_monitor("procedural_animations/memory_usage");
+
+		if (Performance::get_singleton()->has_custom_monitor("procedural_animations/instances"))
+			Performance::get_singleton()->remove_custom_monitor("procedural_animations/instances");
+	}
+#endif
+
+	ResourceSaver::remove_resource_format_saver(procedural_animation_saver);
+	procedural_animation_saver.unref();
+
+	ProceduralAnimationPoseIndex::clear_cache();
 }